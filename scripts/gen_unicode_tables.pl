@@ -0,0 +1,196 @@
+#!/usr/bin/env perl
+# This file was developed by Thomas Müller <contact@tom94.net>.
+# It is published under the GPLv3 License. See the LICENSE file.
+
+# Generates src/unicode_tables.h from the Unicode Character Database that ships with perl.
+# Usage: perl scripts/gen_unicode_tables.pl > src/unicode_tables.h
+
+use strict;
+use warnings;
+use Unicode::UCD qw(prop_invmap charprop);
+
+# Returns a list of [first, last, value] ranges of the given property, skipping ranges whose value is `$default`.
+sub ranges {
+	my ($prop, $default, $rename) = @_;
+	my ($list, $map) = prop_invmap($prop);
+	my @result;
+	for my $i (0 .. $#$list) {
+		my $first = $list->[$i];
+		my $last = $i < $#$list ? $list->[$i + 1] - 1 : 0x10FFFF;
+		my $value = $rename->($map->[$i], $first);
+		next if $value eq $default;
+
+		if (@result && $result[-1][2] eq $value && $result[-1][1] + 1 == $first) {
+			$result[-1][1] = $last;
+		} else {
+			push @result, [$first, $last, $value];
+		}
+	}
+
+	return @result;
+}
+
+# Returns a list of [first, last] ranges of code points for which the given binary property holds.
+sub set_ranges {
+	my ($prop, $value) = @_;
+	return map { [$_->[0], $_->[1]] } ranges($prop, "", sub { return $_[0] eq $value ? "Y" : ""; });
+}
+
+sub print_set {
+	my ($name, @ranges) = @_;
+	print "inline constexpr CodePointRange $name\[\] = {\n";
+	for my $r (@ranges) {
+		printf "\t{0x%04X, 0x%04X},\n", $r->[0], $r->[1];
+	}
+	print "};\n";
+}
+
+sub print_table {
+	my ($type, $name, @ranges) = @_;
+	print "inline constexpr UnicodeRange<$type> $name\[\] = {\n";
+	for my $r (@ranges) {
+		printf "\t{0x%04X, 0x%04X, %s::%s},\n", $r->[0], $r->[1], $type, $r->[2];
+	}
+	print "};\n";
+}
+
+# Perl tailors the word break property slightly. Undo its tailorings so that the table follows UAX #29.
+my @word_break = ranges(
+	"Word_Break",
+	"Other",
+	sub {
+		my ($value, $cp) = @_;
+		return "ALetter" if $value eq "ExtPict_LE";
+		return "ExtPict" if $value eq "ExtPict_XX";
+		if ($value eq "Perl_Tailored_HSpace") {
+			return charprop($cp, "General_Category") eq "Space_Separator" ? "WSegSpace" : "Other";
+		}
+
+		return $value;
+	}
+);
+
+my @bidi_class = ranges("Bidi_Class", "L", sub { return $_[0]; });
+
+my @grapheme_break = ranges("Grapheme_Cluster_Break", "Other", sub { return $_[0] eq "ExtPict_XX" ? "ExtPict" : $_[0]; });
+
+my @east_asian_ambiguous = set_ranges("East_Asian_Width", "A");
+my @emoji_presentation = set_ranges("Emoji_Presentation", "Y");
+
+my $version = Unicode::UCD::UnicodeVersion();
+my ($major, $minor, $update) = split(/\./, $version);
+my $version_number = $major * 10000 + $minor * 100 + ($update // 0);
+
+print <<"HEADER";
+// This file was developed by Thomas Müller <contact\@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+// This file was generated by scripts/gen_unicode_tables.pl from the Unicode Character Database $version. Do not edit.
+
+#pragma once
+
+#include <cstdint>
+
+namespace ttt {
+
+// Version of the Unicode Character Database of these tables, as major * 10000 + minor * 100 + update
+inline constexpr uint32_t UNICODE_TABLES_VERSION = $version_number;
+
+template <typename T> struct UnicodeRange {
+	char32_t first;
+	char32_t last;
+	T value;
+};
+
+struct CodePointRange {
+	char32_t first;
+	char32_t last;
+};
+
+// Word_Break property values of UAX #29. `ExtPict` denotes Extended_Pictographic characters that are otherwise `Other`.
+enum class WordBreak : uint8_t {
+	Other,
+	CR,
+	LF,
+	Newline,
+	Extend,
+	ZWJ,
+	Regional_Indicator,
+	Format,
+	Katakana,
+	Hebrew_Letter,
+	ALetter,
+	Single_Quote,
+	Double_Quote,
+	MidNumLet,
+	MidLetter,
+	MidNum,
+	Numeric,
+	ExtendNumLet,
+	WSegSpace,
+	ExtPict,
+};
+
+// Grapheme_Cluster_Break property values of UAX #29. `ExtPict` denotes Extended_Pictographic characters that are otherwise
+// `Other`.
+enum class GraphemeBreak : uint8_t {
+	Other,
+	CR,
+	LF,
+	Control,
+	Extend,
+	ZWJ,
+	Regional_Indicator,
+	Prepend,
+	SpacingMark,
+	L,
+	V,
+	T,
+	LV,
+	LVT,
+	ExtPict,
+};
+
+// Bidi_Class property values of UAX #9.
+enum class BidiClass : uint8_t {
+	L,
+	R,
+	AL,
+	EN,
+	ES,
+	ET,
+	AN,
+	CS,
+	NSM,
+	BN,
+	B,
+	S,
+	WS,
+	ON,
+	LRE,
+	LRO,
+	RLE,
+	RLO,
+	PDF,
+	LRI,
+	RLI,
+	FSI,
+	PDI,
+};
+
+HEADER
+
+print_table("WordBreak", "WORD_BREAK_RANGES", @word_break);
+print "\n";
+print_table("BidiClass", "BIDI_CLASS_RANGES", @bidi_class);
+print "\n";
+print_table("GraphemeBreak", "GRAPHEME_BREAK_RANGES", @grapheme_break);
+print "\n// Characters whose East_Asian_Width is Ambiguous\n";
+print_set("EAST_ASIAN_AMBIGUOUS_RANGES", @east_asian_ambiguous);
+print "\n// Characters with the Emoji_Presentation property\n";
+print_set("EMOJI_PRESENTATION_RANGES", @emoji_presentation);
+
+print <<"FOOTER";
+
+} // namespace ttt
+FOOTER
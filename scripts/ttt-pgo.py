@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+# This file was developed by Thomas Müller <contact@tom94.net>.
+# It is published under the GPLv3 License. See the LICENSE file.
+
+# Builds ttt with profile-guided and link-time optimization: builds instrumented binaries, trains them on ASCII prose,
+# Unicode, code, and large texts with the benchmarks and synthetic typists, rebuilds with the resulting profiles, and compares
+# the benchmarks of the optimized build against a plain Release build.
+# Usage: python3 scripts/ttt-pgo.py [BUILD_DIR] [-- CMAKE_ARGS...]
+
+import glob
+import json
+import math
+import os
+import re
+import shutil
+import subprocess
+import sys
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# Texts for the synthetic typists: prose and code from the repository itself
+BOT_TEXTS = ["README.md", "src/session.cpp", "src/layout.cpp"]
+
+# Measurements alternate between the builds this many times and keep the best result of each, lest noise decide the comparison
+ROUNDS = 2
+
+# Kinds of text that ttt is trained on under a pseudo-terminal, such that the drawing code is covered as well
+PTY_CORPORA = ["ascii", "latin", "cjk", "emoji", "code", "long-words", "rtl"]
+
+def run(args, **kwargs):
+	print("+ " + " ".join(args), flush=True)
+	return subprocess.run(args, check=True, **kwargs)
+
+def build(build_dir, cmake_args):
+	run(["cmake", "-S", ROOT, "-B", build_dir, "-DCMAKE_BUILD_TYPE=Release"] + cmake_args)
+	run(["cmake", "--build", build_dir, "-j", str(os.cpu_count() or 1)])
+
+def exe(build_dir, name):
+	return os.path.join(build_dir, name)
+
+def bots(build_dir, text, n):
+	with open(os.path.join(ROOT, text), "rb") as f:
+		return subprocess.run([exe(build_dir, "ttt-bots"), "-n", str(n), "-j", "1"], stdin=f, capture_output=True, check=True, text=True).stdout
+
+def train(build_dir):
+	run([exe(build_dir, "ttt-microbench"), "--min-time", "0.02", "--max-size", "1M"], stdout=subprocess.DEVNULL)
+
+	# Superlinear scaling makes ttt-scaling fail, which does not matter for training
+	subprocess.run([exe(build_dir, "ttt-scaling"), "--min-time", "0", "--max-size", "16M"], stdout=subprocess.DEVNULL)
+
+	for text in BOT_TEXTS:
+		bots(build_dir, text, 200)
+
+	if os.path.exists(exe(build_dir, "ttt-pty-bench")):
+		for corpus in PTY_CORPORA:
+			run([exe(build_dir, "ttt-pty-bench"), "--corpus", corpus, "--max-size", "100K", "--keystrokes", "500", "--wpm", "6000"], stdout=subprocess.DEVNULL)
+
+def merge_clang_profiles(profile_dir):
+	raw = glob.glob(os.path.join(profile_dir, "*.profraw"))
+	if not raw:
+		return
+
+	llvm_profdata = os.environ.get("LLVM_PROFDATA") or shutil.which("llvm-profdata")
+	command = [llvm_profdata] if llvm_profdata else ["xcrun", "llvm-profdata"]
+	run(command + ["merge", "-output", os.path.join(profile_dir, "ttt.profdata")] + raw)
+
+def measure(build_dir):
+	result = {}
+
+	microbench = json.loads(subprocess.run([exe(build_dir, "ttt-microbench"), "--json", "--min-time", "0.1"], capture_output=True, check=True, text=True).stdout)
+	for r in microbench["results"]:
+		result.setdefault(f"microbench {r['benchmark']} (MB/s)", []).append(r["mb_per_s"])
+
+	scaling = subprocess.run([exe(build_dir, "ttt-scaling"), "--json", "--min-time", "0.1"], capture_output=True, text=True).stdout
+	for r in json.loads(scaling)["results"]:
+		for stage, data in r["stages"].items():
+			# Higher is better throughout, so times are turned into throughputs
+			result.setdefault(f"scaling {stage} (MB/s)", []).append(r["bytes"][-1] / data["seconds"][-1] / 1e6)
+
+	for text in BOT_TEXTS:
+		match = re.search(r"\(([0-9.]+) per second\)", bots(build_dir, text, 2000))
+		result.setdefault("bots (keystrokes/s)", []).append(float(match.group(1)))
+
+	# Geometric means over corpora and texts
+	return {name: math.exp(sum(math.log(max(v, 1e-9)) for v in values) / len(values)) for name, values in result.items()}
+
+def main():
+	args = sys.argv[1:]
+	cmake_args = []
+	if "--" in args:
+		cmake_args = args[args.index("--") + 1:]
+		args = args[:args.index("--")]
+
+	build_dir = os.path.abspath(args[0] if args else os.path.join(ROOT, "build-pgo"))
+	baseline_dir = os.path.join(build_dir, "baseline")
+	pgo_dir = os.path.join(build_dir, "pgo")
+	profile_dir = os.path.join(pgo_dir, "profiles")
+
+	build(baseline_dir, cmake_args + ["-DTTT_PGO="])
+
+	# Both passes must use the same build directory, because GCC names profiles after the paths of the object files.
+	shutil.rmtree(profile_dir, ignore_errors=True)
+	build(pgo_dir, cmake_args + ["-DTTT_PGO=GENERATE", f"-DTTT_PGO_DIR={profile_dir}"])
+	train(pgo_dir)
+	merge_clang_profiles(profile_dir)
+	build(pgo_dir, cmake_args + ["-DTTT_PGO=USE", f"-DTTT_PGO_DIR={profile_dir}"])
+
+	print("\nMeasuring...", flush=True)
+	before, after = {}, {}
+	for _ in range(ROUNDS):
+		for results, build_dir in [(before, baseline_dir), (after, pgo_dir)]:
+			for name, value in measure(build_dir).items():
+				results[name] = max(results.get(name, 0), value)
+
+	print(f"\n{'':<44} {'Release':>12} {'PGO+LTO':>12} {'speedup':>8}")
+	speedups = []
+	for name in before:
+		speedup = after[name] / before[name]
+		speedups.append(speedup)
+		print(f"{name:<44} {before[name]:>12.1f} {after[name]:>12.1f} {speedup:>7.2f}x")
+
+	print(f"{'geometric mean':<44} {'':>12} {'':>12} {math.exp(sum(map(math.log, speedups)) / len(speedups)):>7.2f}x")
+	print(f"\nThe optimized binary is {exe(pgo_dir, 'ttt')}")
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+# This file was developed by Thomas Müller <contact@tom94.net>.
+# It is published under the GPLv3 License. See the LICENSE file.
+
+# Queries statistics of the history from a running `tttd`, as an example of its query protocol (see src/daemon.h).
+# Usage: python3 scripts/ttt-query.py wpm [DAYS] | keys | errors [K]
+
+import os
+import socket
+import struct
+import sys
+import time
+
+WPM_PERCENTILES = 2
+KEY_LATENCIES = 3
+ERROR_HEAVY_HITTERS = 4
+
+PERCENTILES = [0.1, 0.25, 0.5, 0.75, 0.9]
+
+def address():
+	if os.environ.get("TTTD_SOCKET"):
+		return os.environ["TTTD_SOCKET"]
+	if os.environ.get("XDG_RUNTIME_DIR"):
+		return os.path.join(os.environ["XDG_RUNTIME_DIR"], "tttd.sock")
+	sys.exit("Neither $TTTD_SOCKET nor $XDG_RUNTIME_DIR is set")
+
+def receive_exactly(sock, n):
+	data = b""
+	while len(data) < n:
+		chunk = sock.recv(n - len(data))
+		if not chunk:
+			sys.exit("tttd closed the connection")
+		data += chunk
+	return data
+
+def query(payload):
+	with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+		try:
+			sock.connect(address())
+		except OSError as e:
+			sys.exit(f"Could not reach tttd at {address()}: {e.strerror}")
+
+		start = time.perf_counter()
+		sock.sendall(struct.pack("<I", len(payload)) + payload)
+		size = struct.unpack("<I", receive_exactly(sock, 4))[0]
+		response = receive_exactly(sock, size)
+		elapsed = time.perf_counter() - start
+
+	if response[0] != 0:
+		size = struct.unpack_from("<I", response, 1)[0]
+		sys.exit(response[5:5 + size].decode())
+
+	return response[1:], elapsed
+
+def main():
+	kind = sys.argv[1] if len(sys.argv) > 1 else "wpm"
+	if kind == "wpm":
+		days = float(sys.argv[2]) if len(sys.argv) > 2 else 30
+		now = int(time.time() * 1000)
+		payload = struct.pack(f"<BqqI{len(PERCENTILES)}d", WPM_PERCENTILES, now - int(days * 86400000), now, len(PERCENTILES), *PERCENTILES)
+		result, elapsed = query(payload)
+		n_tests, n = struct.unpack_from("<QI", result)
+		wpm = struct.unpack_from(f"<{n}d", result, 12)
+		print(f"{n_tests} tests within the last {days:g} days")
+		for p, value in zip(PERCENTILES, wpm):
+			print(f"  p{p * 100:<3.0f} {value:6.1f} WPM")
+	elif kind == "keys":
+		result, elapsed = query(struct.pack("<B", KEY_LATENCIES))
+		n = struct.unpack_from("<I", result)[0]
+		print("key   count   mean    p50    p90    p99  [ms]")
+		for i in range(n):
+			key, count, mean, p50, p90, p99 = struct.unpack_from("<BQdIII", result, 4 + i * 29)
+			print(f"{chr(key)!r:5} {count:5} {mean:6.0f} {p50:6} {p90:6} {p99:6}")
+	elif kind == "errors":
+		k = int(sys.argv[2]) if len(sys.argv) > 2 else 10
+		result, elapsed = query(struct.pack("<BI", ERROR_HEAVY_HITTERS, k))
+		n = struct.unpack_from("<I", result)[0]
+		offset = 4
+		for _ in range(n):
+			size = struct.unpack_from("<I", result, offset)[0]
+			word = result[offset + 4:offset + 4 + size].decode()
+			count, error = struct.unpack_from("<II", result, offset + 4 + size)
+			offset += 12 + size
+			print(f"{count:5} (±{error}) {word}")
+	else:
+		sys.exit(f"Unknown query {kind}; expected wpm, keys, or errors")
+
+	print(f"Answered in {elapsed * 1000:.2f} ms")
+
+if __name__ == "__main__":
+	main()
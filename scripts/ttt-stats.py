@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+# This file was developed by Thomas Müller <contact@tom94.net>.
+# It is published under the GPLv3 License. See the LICENSE file.
+
+# Prints the live statistics that `ttt --shared-stats` publishes, as an example of reading them from another process.
+# Usage: python3 scripts/ttt-stats.py [PID]
+
+import glob
+import mmap
+import os
+import struct
+import sys
+import time
+
+# Mirrors struct SharedStats in src/shared_stats.h
+LAYOUT = struct.Struct("@IIQIIdddQQQQ64I")
+MAGIC = 0x53545454
+STATES = ["waiting", "typing", "complete", "cancelled"]
+
+def read_snapshot(shm):
+	# Seqlock: retry until the sequence number is even and unchanged across the copy.
+	while True:
+		before = struct.unpack_from("@Q", shm, 8)[0]
+		data = shm[:LAYOUT.size]
+		after = struct.unpack_from("@Q", shm, 8)[0]
+		if before == after and before % 2 == 0:
+			return LAYOUT.unpack(data)
+
+def main():
+	# Segments are named ttt-<pid>, or ttt-<pid>-<n> if the former was taken.
+	if len(sys.argv) > 1:
+		paths = glob.glob(f"/dev/shm/ttt-{sys.argv[1]}") + glob.glob(f"/dev/shm/ttt-{sys.argv[1]}-*")
+	else:
+		paths = glob.glob("/dev/shm/ttt-*")
+
+	# Segments of other users or that are too small were not made by a ttt of ours.
+	paths = [path for path in paths if os.stat(path).st_uid == os.getuid() and os.stat(path).st_size >= LAYOUT.size]
+	if not paths:
+		sys.exit("No running ttt --shared-stats found")
+
+	with open(paths[0], "rb") as f:
+		shm = mmap.mmap(f.fileno(), LAYOUT.size, prot=mmap.PROT_READ)
+
+	while True:
+		magic, version, _, pid, state, seconds, wpm, accuracy, errors, position, text_size, n_keys, *latencies = read_snapshot(shm)
+		if magic != MAGIC or version != 1:
+			sys.exit("Unsupported shared memory layout")
+
+		recent = [latencies[(n_keys - 1 - i) % 64] / 1000 for i in range(min(n_keys, 5))]
+		print(
+			f"\r{STATES[state]:<9} {position}/{text_size} bytes, {wpm:.0f} WPM, {accuracy:.1f}%, {errors} errors, "
+			f"last keys {', '.join(f'{ms:.0f}' for ms in recent)} ms\033[K",
+			end="",
+			flush=True,
+		)
+
+		if state >= 2:
+			print()
+			return
+
+		time.sleep(0.1)
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,342 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+// ttt-bots: simulates many synthetic typists to stress the typing engine or a race server. Each bot feeds its keystrokes
+// through a TypingSession just like the interactive frontend does.
+
+#include "corpus.h"
+#include "session.h"
+#include "text.h"
+#include "typist.h"
+
+#ifdef TTT_NETWORKING
+#	include "net.h"
+#	include "race.h"
+
+#	include <sys/socket.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <format>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace ttt {
+
+using Clock = TypingSession::Clock;
+
+struct BotResults {
+	size_t n_keystrokes = 0;
+	size_t n_finished = 0;
+	double wpm_sum = 0;
+	double accuracy_sum = 0;
+	vector<uint32_t> latencies_ns;
+
+	void add_finished(const TypingSession& session, Clock::time_point time) {
+		auto stats = session.stats(time);
+		++n_finished;
+		wpm_sum += stats.wpm;
+		accuracy_sum += stats.accuracy;
+	}
+
+	void merge(const BotResults& other) {
+		n_keystrokes += other.n_keystrokes;
+		n_finished += other.n_finished;
+		wpm_sum += other.wpm_sum;
+		accuracy_sum += other.accuracy_sum;
+		latencies_ns.insert(latencies_ns.end(), other.latencies_ns.begin(), other.latencies_ns.end());
+	}
+};
+
+uint32_t nanoseconds_since(Clock::time_point begin) {
+	return (uint32_t)min(chrono::duration_cast<chrono::nanoseconds>(Clock::now() - begin).count(), (int64_t)UINT32_MAX);
+}
+
+// Types as fast as possible on a simulated clock. Latency is the time it takes the session to process a keystroke.
+BotResults run_offline(const string& text, const TypistSettings& settings, uint64_t seed, size_t begin, size_t end) {
+	BotResults results;
+	for (size_t i = begin; i < end; i++) {
+		TypingSession session{text};
+		SyntheticTypist typist{settings, seed + i};
+
+		Clock::time_point time = {};
+		while (!session.complete()) {
+			auto keystroke = typist.next(session);
+			time += chrono::duration_cast<Clock::duration>(chrono::duration<double>{keystroke.delay});
+
+			auto feed_begin = Clock::now();
+			session.feed(keystroke.c, time);
+			results.latencies_ns.push_back(nanoseconds_since(feed_begin));
+		}
+
+		results.add_finished(session, time);
+	}
+
+	results.n_keystrokes = results.latencies_ns.size();
+
+	return results;
+}
+
+#ifdef TTT_NETWORKING
+// Races against a server in real time. Latency is the time from when a keystroke was due until its progress report was
+// sent, which includes any delay due to the bots not keeping up.
+BotResults run_race(const string& address, const TypistSettings& settings, uint64_t seed, size_t begin, size_t end) {
+	struct Bot {
+		RaceClient client;
+		TypingSession session;
+		SyntheticTypist typist;
+		SyntheticTypist::Keystroke keystroke = {};
+	};
+
+	vector<optional<Bot>> bots;
+	for (size_t i = begin; i < end; i++) {
+		RaceClient client{address};
+		string text = client.text();
+		trim_trailing_whitespace(text);
+		bots.emplace_back(in_place, std::move(client), TypingSession{std::move(text)}, SyntheticTypist{settings, seed + i});
+	}
+
+	// Min-heap of the bots' next keystrokes by time
+	using Event = pair<Clock::time_point, size_t>;
+	priority_queue<Event, vector<Event>, greater<>> events;
+
+	auto schedule = [&](size_t i, Clock::time_point after) {
+		Bot& bot = *bots[i];
+		bot.keystroke = bot.typist.next(bot.session);
+		events.emplace(after + chrono::duration_cast<Clock::duration>(chrono::duration<double>{bot.keystroke.delay}), i);
+	};
+
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < bots.size(); i++) {
+		schedule(i, start);
+	}
+
+	BotResults results;
+	while (!events.empty()) {
+		auto [due, i] = events.top();
+		events.pop();
+		this_thread::sleep_until(due);
+
+		Bot& bot = *bots[i];
+		auto diff = bot.session.feed(bot.keystroke.c);
+		if (!diff.empty()) {
+			bot.client.report(RaceProgress::of(bot.session));
+		}
+
+		results.latencies_ns.push_back(nanoseconds_since(due));
+		++results.n_keystrokes;
+
+		// Keep up with the server's broadcasts, lest it drop us for being too slow.
+		bot.client.receive();
+
+		if (bot.session.complete()) {
+			results.add_finished(bot.session, Clock::now());
+			bots[i].reset();
+		} else {
+			schedule(i, due);
+		}
+	}
+
+	return results;
+}
+
+// Connects clients that hang up abruptly without reading anything, while the server still has the text queued for them, like
+// racers whose connection breaks. The server has to keep serving everybody else.
+void drop_out(const string& address, size_t n) {
+	vector<UniqueFd> fds;
+	for (size_t i = 0; i < n; i++) {
+		fds.push_back(connect_socket(address));
+	}
+
+	// Give the server time to queue the welcome, then reset the connections, such that its next attempt to send fails
+	this_thread::sleep_for(chrono::milliseconds{100});
+	for (auto& fd : fds) {
+		linger reset = {1, 0};
+		setsockopt(fd.get(), SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+		fd.reset();
+	}
+
+	this_thread::sleep_for(chrono::milliseconds{100});
+}
+#endif
+
+void print_help() {
+	cout << "Usage: ttt-bots [OPTIONS] < TEXT\n"
+		 << "Simulates synthetic typists to stress the typing engine or a race server.\n"
+		 << "\n"
+		 << "Options:\n"
+		 << "  -h, --help                  Show this help message and exit\n"
+		 << "  -n, --bots N                Number of bots (default: 1000)\n"
+		 << "  -j, --threads N             Number of threads (default: number of cores)\n"
+		 << "  --wpm WPM                   Typing speed of the bots (default: 60)\n"
+		 << "  --errors RATE               Probability of mistyping a letter (default: 0.02)\n"
+		 << "  --corrections RATE          Probability of correcting a mistake (default: 0.9)\n"
+		 << "  --seed SEED                 Seed of the bots' randomness (default: 0)\n"
+#ifdef TTT_NETWORKING
+		 << "  --join ADDRESS              Race in real time against the server at ADDRESS, which provides the text\n"
+		 << "  --dropouts N                Before racing, connect N clients that hang up without reading (default: 0)\n"
+#endif
+		 << "\n"
+		 << "Without --join, bots type the text from stdin as fast as possible on a simulated clock.\n";
+	cout.flush();
+}
+
+int main(const vector<string>& args) {
+	size_t n_bots = 1000;
+	size_t n_threads = max(thread::hardware_concurrency(), 1u);
+	uint64_t seed = 0;
+	TypistSettings settings;
+	string join_address = "";
+	size_t n_dropouts = 0;
+
+	for (size_t i = 1; i < args.size(); i++) {
+		const string& arg = args[i];
+		if (arg == "-h" || arg == "--help") {
+			print_help();
+			return 0;
+		} else if (arg == "-n" || arg == "--bots") {
+			n_bots = option_number(args, i, [](const string& s) { return stoul(s); });
+		} else if (arg == "-j" || arg == "--threads") {
+			n_threads = max(option_number(args, i, [](const string& s) { return stoul(s); }), 1ul);
+		} else if (arg == "--wpm") {
+			settings.wpm = option_number(args, i, [](const string& s) { return stod(s); });
+		} else if (arg == "--errors") {
+			settings.error_rate = option_number(args, i, [](const string& s) { return stod(s); });
+		} else if (arg == "--corrections") {
+			settings.correction_rate = option_number(args, i, [](const string& s) { return stod(s); });
+		} else if (arg == "--seed") {
+			seed = option_number(args, i, [](const string& s) { return stoull(s); });
+		} else if (arg == "--join") {
+			join_address = option_value(args, i);
+		} else if (arg == "--dropouts") {
+			n_dropouts = option_number(args, i, [](const string& s) { return stoul(s); });
+		} else {
+			throw invalid_argument{format("Unknown option {}", arg)};
+		}
+	}
+
+	if (settings.wpm <= 0) {
+		throw invalid_argument{"Typing speed must be positive"};
+	}
+
+#ifndef TTT_NETWORKING
+	if (!join_address.empty()) {
+		throw invalid_argument{"Races are only supported on Linux"};
+	}
+#endif
+
+	// When racing, the server provides the text.
+	string text;
+	if (join_address.empty()) {
+		text = nfd(string{istreambuf_iterator<char>(cin), istreambuf_iterator<char>()});
+		trim_trailing_whitespace(text);
+		if (text.empty()) {
+			throw runtime_error{"No text provided"};
+		}
+	}
+
+#ifdef TTT_NETWORKING
+	if (n_dropouts > 0) {
+		if (join_address.empty()) {
+			throw invalid_argument{"--dropouts requires --join"};
+		}
+
+		drop_out(join_address, n_dropouts);
+	}
+#endif
+
+	n_threads = min(n_threads, max(n_bots, (size_t)1));
+
+	vector<BotResults> thread_results(n_threads);
+	vector<thread> threads;
+	atomic<bool> failed = false;
+	string error;
+
+	auto wall_begin = Clock::now();
+	for (size_t t = 0; t < n_threads; t++) {
+		threads.emplace_back([&, t]() {
+			size_t begin = n_bots * t / n_threads, end = n_bots * (t + 1) / n_threads;
+			try {
+#ifdef TTT_NETWORKING
+				if (!join_address.empty()) {
+					thread_results[t] = run_race(join_address, settings, seed, begin, end);
+					return;
+				}
+#endif
+				thread_results[t] = run_offline(text, settings, seed, begin, end);
+			} catch (const exception& e) {
+				if (!failed.exchange(true)) {
+					error = e.what();
+				}
+			}
+		});
+	}
+
+	for (auto& thread : threads) {
+		thread.join();
+	}
+
+	double wall_seconds = chrono::duration<double>(Clock::now() - wall_begin).count();
+	if (failed) {
+		throw runtime_error{error};
+	}
+
+	BotResults results;
+	for (const auto& r : thread_results) {
+		results.merge(r);
+	}
+
+	auto& latencies = results.latencies_ns;
+	auto percentile = [&](double p) -> uint32_t {
+		if (latencies.empty()) {
+			return 0;
+		}
+
+		size_t k = min((size_t)(p * latencies.size()), latencies.size() - 1);
+		nth_element(latencies.begin(), latencies.begin() + k, latencies.end());
+		return latencies[k];
+	};
+
+	cout << format("Bots: {} on {} threads", n_bots, n_threads) << "\n";
+	cout << format("Keystrokes: {} in {:.2f} s ({:.0f} per second)", results.n_keystrokes, wall_seconds, results.n_keystrokes / wall_seconds) << "\n";
+	cout << format(
+		"Latency (ns): p50 {}, p90 {}, p99 {}, p99.9 {}, max {}",
+		percentile(0.5),
+		percentile(0.9),
+		percentile(0.99),
+		percentile(0.999),
+		latencies.empty() ? 0 : *max_element(latencies.begin(), latencies.end())
+	) << "\n";
+
+	if (results.n_finished > 0) {
+		cout << format(
+			"Finished: {}, WPM: {:.1f}, Accuracy: {:.2f}%",
+			results.n_finished,
+			results.wpm_sum / results.n_finished,
+			results.accuracy_sum / results.n_finished
+		) << "\n";
+	}
+
+	return 0;
+}
+
+} // namespace ttt
+
+int main(int argc, char* argv[]) {
+	try {
+		return ttt::main({argv, argv + argc});
+	} catch (const exception& e) {
+		cerr << format("ttt-bots: {}", e.what()) << endl;
+		return 1;
+	}
+}
@@ -0,0 +1,170 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+#include "corpus.h"
+
+#include "text.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+namespace ttt {
+
+const vector<string_view> ENGLISH_WORDS = {
+	"the", "of", "and", "to", "in", "is", "that", "for", "it", "as", "was", "with", "be", "by", "on", "not", "he", "this",
+	"are", "or", "his", "from", "at", "which", "but", "have", "an", "had", "they", "you", "were", "their", "one", "all",
+	"we", "can", "her", "has", "there", "been", "if", "more", "when", "will", "would", "who", "so", "no", "typing", "quick",
+	"brown", "fox", "jumps", "over", "lazy", "dog", "terminal", "keyboard", "practice", "accuracy", "remarkably",
+};
+
+const vector<string_view> LATIN_WORDS = {
+	"café", "naïve", "über", "señor", "façade", "élève", "Ærøskøbing", "smörgåsbord", "jalapeño", "crème", "brûlée", "déjà",
+	"vu", "Müller", "Straße", "Łódź", "čeština", "žluťoučký", "kůň", "São", "Paulo", "résumé", "coöperate", "Ångström",
+	"the", "and", "of", "à", "la", "mañana", "piñata", "hôtel", "forêt", "garçon", "fiancée", "Zürich", "Kraków",
+};
+
+const string_view CJK_CHARACTERS = "的一是不了人我在有他这为之大来以个中上们到说国和地也子时道出而要于就下得可你年生自会那后能对着事其里所去行过"
+								   "家十用发天如然作方成者多日都三小军二无同么经法当起与好看学进种将还分此心前面又定见只主没公从";
+
+const vector<string_view> EMOJI = {
+	"😀", "👍", "👍🏽", "👨‍👩‍👧", "🇩🇪", "🇯🇵", "❤️", "🧑🏻‍💻", "🎉", "🏳️‍🌈", "✨", "🙂",
+};
+
+const vector<string_view> CODE_LINES = {
+	"for (size_t i = 0; i < n; i++) {",
+	"if (layout.text[pos] == '\\n') {",
+	"result.push_back(std::move(value));",
+	"return {begin, end};",
+	"auto it = std::lower_bound(cells.begin(), cells.end(), pos);",
+	"// Skip whitespace at the beginning of the line",
+	"}",
+	"while (!queue.empty() && queue.top().first <= ms) {",
+	"int width = widths.char_width(decode_char(text, i));",
+	"std::cout << std::format(\"{}: {}\", name, value) << std::endl;",
+};
+
+const vector<string_view> HEBREW_WORDS = {
+	"של", "את", "על", "הוא", "לא", "זה", "היא", "עם", "כל", "אבל", "גם", "מה", "יש", "כמו", "אני", "שלום", "עולם", "מקלדת",
+	"תרגול", "דיוק", "מהירות", "שועל", "חום", "קופץ", "מעל", "כלב", "עצלן", "מסוף", "הקלדה", "בדיקה", "ספר", "מילים",
+};
+
+const vector<string_view> LTR_WORDS = {"ttt", "Unicode", "UTF-8", "2024", "80", "3.14", "v1.2", "bidi"};
+
+string_view corpus_name(Corpus corpus) {
+	switch (corpus) {
+		case Corpus::Ascii: return "ascii";
+		case Corpus::LongWords: return "long-words";
+		case Corpus::Latin: return "latin";
+		case Corpus::Cjk: return "cjk";
+		case Corpus::Emoji: return "emoji";
+		case Corpus::Code: return "code";
+		case Corpus::Rtl: return "rtl";
+	}
+
+	return "unknown";
+}
+
+string make_corpus(Corpus corpus, size_t size, uint64_t seed) {
+	mt19937_64 rng{seed};
+	auto pick = [&](const auto& items) -> string_view { return items[rng() % items.size()]; };
+
+	string result;
+	result.reserve(size + 256);
+
+	size_t line_begin = 0;
+	auto end_line = [&](size_t max_length) {
+		if (result.size() - line_begin >= max_length) {
+			result += '\n';
+			line_begin = result.size();
+		}
+	};
+
+	while (result.size() < size) {
+		switch (corpus) {
+			case Corpus::Ascii:
+			case Corpus::Latin: {
+				result += pick(corpus == Corpus::Ascii ? ENGLISH_WORDS : LATIN_WORDS);
+				result += rng() % 12 == 0 ? ". " : " ";
+				end_line(300);
+			} break;
+			case Corpus::LongWords: {
+				for (size_t i = 0, length = 20 + rng() % 180; i < length; i++) {
+					result += (char)('a' + rng() % 26);
+				}
+
+				result += ' ';
+				end_line(1000);
+			} break;
+			case Corpus::Cjk: {
+				// Three bytes per character
+				size_t i = rng() % (CJK_CHARACTERS.size() / 3);
+				result += CJK_CHARACTERS.substr(3 * i, 3);
+				if (rng() % 20 == 0) {
+					result += "。";
+				}
+
+				end_line(120);
+			} break;
+			case Corpus::Emoji: {
+				result += rng() % 3 == 0 ? pick(EMOJI) : pick(ENGLISH_WORDS);
+				result += ' ';
+				end_line(200);
+			} break;
+			case Corpus::Code: {
+				result.append(rng() % 4, '\t');
+				result += pick(CODE_LINES);
+				result += '\n';
+				line_begin = result.size();
+			} break;
+			case Corpus::Rtl: {
+				// Lines end right after a word, in whichever direction it is written
+				result += rng() % 6 == 0 ? pick(LTR_WORDS) : pick(HEBREW_WORDS);
+				if (result.size() - line_begin >= 100) {
+					result += '\n';
+					line_begin = result.size();
+				} else {
+					result += rng() % 12 == 0 ? ". " : " ";
+				}
+			} break;
+		}
+	}
+
+	// Cut at a character boundary
+	size_t end = min(size, result.size());
+	while (end > 0 && end < result.size() && is_utf8_continuation(result[end])) {
+		--end;
+	}
+
+	result.resize(end);
+	return result;
+}
+
+size_t parse_size(const string& str) {
+	size_t end;
+	double value = stod(str, &end);
+	string_view suffix = string_view{str}.substr(end);
+	if (suffix == "K" || suffix == "k") {
+		value *= 1e3;
+	} else if (suffix == "M") {
+		value *= 1e6;
+	} else if (suffix == "G") {
+		value *= 1e9;
+	} else if (!suffix.empty()) {
+		throw invalid_argument{format("Invalid size {}", str)};
+	}
+
+	return (size_t)value;
+}
+
+const string& option_value(const vector<string>& args, size_t& i) {
+	if (i + 1 >= args.size()) {
+		throw invalid_argument{format("Missing value for {}", args[i])};
+	}
+
+	return args[++i];
+}
+
+} // namespace ttt
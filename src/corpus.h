@@ -0,0 +1,55 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+// Deterministic synthetic texts of any size for the benchmarks, each exercising a different path through the text handling,
+// and the parsing of the benchmarks' command lines.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ttt {
+
+enum class Corpus {
+	Ascii,     // English prose
+	LongWords, // Words far longer than a line, which have to be broken
+	Latin,     // Prose with precomposed accented letters, which NFD decomposes
+	Cjk,       // Double-width characters without spaces between words
+	Emoji,     // Prose interspersed with emoji, including ZWJ sequences, flags, and skin tone modifiers
+	Code,      // Tab-indented source code with short lines
+	Rtl,       // Hebrew prose interspersed with Latin words and numbers, such that lines may end in either direction
+};
+
+constexpr std::array<Corpus, 7> ALL_CORPORA = {
+	Corpus::Ascii, Corpus::LongWords, Corpus::Latin, Corpus::Cjk, Corpus::Emoji, Corpus::Code, Corpus::Rtl,
+};
+
+std::string_view corpus_name(Corpus corpus);
+
+// Returns `size` bytes of valid UTF-8 (or slightly fewer, so as not to cut a character in half) made of lines of the given kind.
+// The same arguments always yield the same text.
+std::string make_corpus(Corpus corpus, size_t size, uint64_t seed = 0);
+
+// Parses a number of bytes with an optional suffix K, M, or G, e.g. 64M. Throws `std::invalid_argument` if it is malformed.
+size_t parse_size(const std::string& str);
+
+// Returns the value of the option `args[i]` and advances `i` to it. Throws `std::invalid_argument` if there is none.
+const std::string& option_value(const std::vector<std::string>& args, size_t& i);
+
+// Like `option_value`, but returns what `parse` makes of the value and throws `std::invalid_argument` if that fails
+template <typename Parse> auto option_number(const std::vector<std::string>& args, size_t& i, Parse parse) {
+	const std::string& arg = args[i];
+	const std::string& value = option_value(args, i);
+	try {
+		return parse(value);
+	} catch (...) { throw std::invalid_argument{std::format("Invalid value for {}", arg)}; }
+}
+
+} // namespace ttt
@@ -0,0 +1,297 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+#include "daemon.h"
+#include "net.h"
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <format>
+#include <stdexcept>
+#include <vector>
+
+#include <poll.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace ttt {
+
+constexpr int WidthOverrides::*OVERRIDES[] = {
+	&WidthOverrides::ambiguous,
+	&WidthOverrides::emoji,
+	&WidthOverrides::emoji_vs16,
+	&WidthOverrides::emoji_zwj,
+	&WidthOverrides::emoji_flag,
+	&WidthOverrides::emoji_modifier,
+};
+
+constexpr uint32_t MAX_FRAME_SIZE = 1 << 26;
+
+// Clients wait this long for the daemon before preparing their test themselves
+constexpr int RESPONSE_TIMEOUT_MS = 1000;
+
+string daemon_address() {
+	if (const char* socket = getenv("TTTD_SOCKET"); socket && *socket) {
+		return socket;
+	}
+
+	if (const char* runtime_dir = getenv("XDG_RUNTIME_DIR"); runtime_dir && *runtime_dir) {
+		return format("{}/tttd.sock", runtime_dir);
+	}
+
+	return {};
+}
+
+void put_string(string& out, string_view str) {
+	put_le(out, (uint32_t)str.size());
+	out += str;
+}
+
+optional<string> get_string(ByteReader& reader) {
+	if (!reader.has(4)) {
+		return {};
+	}
+
+	uint32_t size = reader.get<uint32_t>();
+	if (!reader.has(size)) {
+		return {};
+	}
+
+	string result{reader.data.substr(0, size)};
+	reader.data.remove_prefix(size);
+	return result;
+}
+
+string encode_test_request(const TestRequest& request) {
+	string result;
+	put_le(result, (uint8_t)DaemonRequest::Test);
+	put_string(result, request.word_list);
+	put_le(result, (uint32_t)request.n_words);
+	put_string(result, request.quote_list);
+	put_le(result, (uint32_t)request.wrap_width);
+	put_string(result, request.hyphenation);
+	put_le(result, (uint32_t)request.widths.tab_width);
+	for (auto field : OVERRIDES) {
+		put_le(result, (int32_t)(request.widths.overrides.*field));
+	}
+
+	return result;
+}
+
+optional<TestRequest> decode_test_request(string_view payload) {
+	ByteReader reader{payload};
+	if (!reader.has(1) || reader.get<uint8_t>() != (uint8_t)DaemonRequest::Test) {
+		return {};
+	}
+
+	TestRequest result;
+	auto word_list = get_string(reader);
+	if (!word_list || !reader.has(4)) {
+		return {};
+	}
+
+	result.word_list = std::move(*word_list);
+	result.n_words = reader.get<uint32_t>();
+
+	auto quote_list = get_string(reader);
+	if (!quote_list || !reader.has(4)) {
+		return {};
+	}
+
+	result.quote_list = std::move(*quote_list);
+	result.wrap_width = reader.get<uint32_t>();
+
+	auto hyphenation = get_string(reader);
+	if (!hyphenation || !reader.has(4 + 4 * size(OVERRIDES))) {
+		return {};
+	}
+
+	result.hyphenation = std::move(*hyphenation);
+	result.widths.tab_width = reader.get<uint32_t>();
+	for (auto field : OVERRIDES) {
+		result.widths.overrides.*field = reader.get<int32_t>();
+	}
+
+	return result;
+}
+
+string encode_test_response(const PreparedTest& test) {
+	string result;
+	put_le(result, (uint8_t)0);
+	put_string(result, test.text);
+	put_string(result, test.attribution);
+	return result;
+}
+
+string encode_error_response(string_view message) {
+	string result;
+	put_le(result, (uint8_t)1);
+	put_string(result, message);
+	return result;
+}
+
+bool is_query(string_view payload) {
+	if (payload.empty()) {
+		return false;
+	}
+
+	auto type = (DaemonRequest)payload[0];
+	return type == DaemonRequest::WpmPercentiles || type == DaemonRequest::KeyLatencies || type == DaemonRequest::ErrorHeavyHitters;
+}
+
+optional<string> answer_query(string_view payload, const Rollups& rollups) {
+	ByteReader reader{payload};
+	if (!reader.has(1)) {
+		return {};
+	}
+
+	string result;
+	put_le(result, (uint8_t)0);
+
+	switch ((DaemonRequest)reader.get<uint8_t>()) {
+		case DaemonRequest::WpmPercentiles: {
+			if (!reader.has(20)) {
+				return {};
+			}
+
+			int64_t from_ms = reader.get<int64_t>();
+			int64_t to_ms = reader.get<int64_t>();
+			uint32_t n = reader.get<uint32_t>();
+			if (!reader.has(8ull * n)) {
+				return {};
+			}
+
+			vector<double> percentiles;
+			for (uint32_t i = 0; i < n; i++) {
+				percentiles.push_back(bit_cast<double>(reader.get<uint64_t>()));
+			}
+
+			auto wpm = rollups.wpm_percentiles(from_ms, to_ms, percentiles);
+			put_le(result, rollups.n_tests(from_ms, to_ms));
+			put_le(result, (uint32_t)wpm.size());
+			for (double value : wpm) {
+				put_le(result, bit_cast<uint64_t>(value));
+			}
+		} break;
+		case DaemonRequest::KeyLatencies: {
+			const auto& keys = rollups.key_latencies();
+			put_le(result, (uint32_t)count_if(keys.begin(), keys.end(), [](const Rollups::KeyLatency& key) { return key.count > 0; }));
+			for (size_t i = 0; i < keys.size(); i++) {
+				if (keys[i].count == 0) {
+					continue;
+				}
+
+				put_le(result, (uint8_t)i);
+				put_le(result, keys[i].count);
+				put_le(result, bit_cast<uint64_t>((double)keys[i].sum_ms / keys[i].count));
+				put_le(result, keys[i].percentile_ms(0.5));
+				put_le(result, keys[i].percentile_ms(0.9));
+				put_le(result, keys[i].percentile_ms(0.99));
+			}
+		} break;
+		case DaemonRequest::ErrorHeavyHitters: {
+			if (!reader.has(4)) {
+				return {};
+			}
+
+			auto hitters = rollups.heavy_hitters(reader.get<uint32_t>());
+			put_le(result, (uint32_t)hitters.size());
+			for (const auto& hitter : hitters) {
+				put_string(result, hitter.item);
+				put_le(result, hitter.count);
+				put_le(result, hitter.error);
+			}
+		} break;
+		default: return {};
+	}
+
+	return result;
+}
+
+string frame(string_view payload) {
+	string result;
+	put_le(result, (uint32_t)payload.size());
+	result += payload;
+	return result;
+}
+
+optional<string> receive_frame(int fd, int timeout_ms) {
+	// A peer that trickles in its frame byte by byte must not keep the daemon waiting for longer than a silent one.
+	auto deadline = chrono::steady_clock::now() + chrono::milliseconds{timeout_ms};
+	string buffer;
+	char chunk[4096];
+	while (true) {
+		ByteReader reader{buffer};
+		if (reader.has(4)) {
+			uint32_t size = reader.get<uint32_t>();
+			if (size > MAX_FRAME_SIZE) {
+				return {};
+			} else if (reader.has(size)) {
+				return string{reader.data.substr(0, size)};
+			}
+		}
+
+		pollfd pfd = {fd, POLLIN, 0};
+		int n_ready = poll(&pfd, 1, remaining_ms(deadline));
+		if (n_ready < 0 && errno == EINTR) {
+			continue;
+		} else if (n_ready <= 0) {
+			return {};
+		}
+
+		ssize_t n = read(fd, chunk, sizeof(chunk));
+		if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+			continue;
+		} else if (n <= 0) {
+			return {};
+		}
+
+		buffer.append(chunk, n);
+	}
+}
+
+optional<PreparedTest> request_test(const string& address, const TestRequest& request) {
+	if (address.empty()) {
+		return {};
+	}
+
+	UniqueFd fd;
+	try {
+		fd = connect_socket(address);
+		if (!is_same_user(fd.get())) {
+			return {};
+		}
+
+		send_all(fd.get(), frame(encode_test_request(request)));
+	} catch (const exception&) { return {}; }
+
+	auto response = receive_frame(fd.get(), RESPONSE_TIMEOUT_MS);
+	if (!response) {
+		return {};
+	}
+
+	ByteReader reader{*response};
+	if (!reader.has(1)) {
+		return {};
+	}
+
+	uint8_t status = reader.get<uint8_t>();
+	if (status != 0) {
+		auto message = get_string(reader);
+		throw invalid_argument{message ? *message : "The daemon rejected the request"};
+	}
+
+	auto text = get_string(reader);
+	auto attribution = get_string(reader);
+	if (!text || !attribution) {
+		return {};
+	}
+
+	return PreparedTest{std::move(*text), std::move(*attribution)};
+}
+
+} // namespace ttt
@@ -0,0 +1,66 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+// ttt's optional resident daemon (`tttd`) keeps resources parsed and tests prepared in memory, such that `ttt` obtains its
+// test in a single round-trip instead of preparing it on every start.
+//
+// Clients connect to a Unix socket, send one request, and receive one response. Both are framed as u32 payload size followed
+// by the payload; all integers are little endian and strings are u32 size followed by the bytes.
+// - TEST request: u8 type (1), str word list, u32 number of words, str quote list, u32 wrap width, str hyphenation patterns,
+//   u32 tab width, i32 width overrides in the order of `WidthOverrides`.
+// - Response: u8 status, then either str text and str attribution (status 0) or str error message (status 1).
+//
+// The daemon also answers read-only queries about the history from its rollups (see rollups.h), without reading any
+// recordings. Responses are u8 status, then the result (status 0) or str error message (status 1).
+// - WPM_PERCENTILES request: u8 type (2), i64 from, i64 to (ms since the Unix epoch), u32 n, n f64 percentiles in [0, 1].
+//   Result: u64 number of tests, u32 n, n f64 WPM (n = 0 if there were no tests).
+// - KEY_LATENCIES request: u8 type (3). Result: u32 n, n times (u8 key, u64 count, f64 mean, u32 p50, u32 p90, u32 p99), all
+//   in milliseconds, for each ASCII key that was typed at least once. Percentiles are upper bounds with a factor 2 resolution.
+// - ERROR_HEAVY_HITTERS request: u8 type (4), u32 k. Result: u32 n, n times (str word, u32 count, u32 error), most frequently
+//   misspelled words first, where `count` overestimates the true count by at most `error`.
+
+#pragma once
+
+#include "rollups.h"
+#include "tests.h"
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace ttt {
+
+enum class DaemonRequest : uint8_t {
+	Test = 1,
+	WpmPercentiles = 2,
+	KeyLatencies = 3,
+	ErrorHeavyHitters = 4,
+};
+
+// $TTTD_SOCKET if set, else $XDG_RUNTIME_DIR/tttd.sock, or an empty string if neither is set. There is no fallback in a
+// directory that other users can write to, such as /tmp, where they could take the socket's place.
+std::string daemon_address();
+
+std::string encode_test_request(const TestRequest& request);
+std::optional<TestRequest> decode_test_request(std::string_view payload);
+
+std::string encode_test_response(const PreparedTest& test);
+std::string encode_error_response(std::string_view message);
+
+// Whether `payload` is a query rather than a test request
+bool is_query(std::string_view payload);
+
+// The response to the query `payload`, or nothing if it is malformed
+std::optional<std::string> answer_query(std::string_view payload, const Rollups& rollups);
+
+// Prepends the payload's size
+std::string frame(std::string_view payload);
+
+// Reads one frame from `fd`, giving up if it does not arrive within `timeout_ms` in total or if the peer disconnects
+std::optional<std::string> receive_frame(int fd, int timeout_ms);
+
+// Asks the daemon at `address` for a test. Returns nothing if no daemon answers, in which case callers prepare the test
+// themselves. Throws if the daemon rejected the request.
+std::optional<PreparedTest> request_test(const std::string& address, const TestRequest& request);
+
+} // namespace ttt
@@ -0,0 +1,58 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+#include "histogram.h"
+
+#include <algorithm>
+#include <bit>
+
+using namespace std;
+
+namespace ttt {
+
+size_t LogHistogram::bucket_of(uint64_t value) {
+	if (value < SUB_BUCKETS) {
+		return value;
+	}
+
+	// The SUB_BUCKET_BITS bits below the leading one select the bucket within the value's power of two.
+	size_t shift = bit_width(value) - 1 - SUB_BUCKET_BITS;
+	return SUB_BUCKETS + shift * SUB_BUCKETS + (size_t)((value >> shift) - SUB_BUCKETS);
+}
+
+uint64_t LogHistogram::upper_bound_of(size_t bucket) {
+	if (bucket < SUB_BUCKETS) {
+		return bucket;
+	}
+
+	size_t shift = (bucket - SUB_BUCKETS) / SUB_BUCKETS;
+	uint64_t sub_bucket = (bucket - SUB_BUCKETS) % SUB_BUCKETS;
+	return ((SUB_BUCKETS + sub_bucket + 1) << shift) - 1;
+}
+
+void LogHistogram::record(uint64_t value) {
+	++mCounts[bucket_of(value)];
+	++mCount;
+	mSum += value;
+	mMin = std::min(mMin, value);
+	mMax = std::max(mMax, value);
+}
+
+uint64_t LogHistogram::percentile(double p) const {
+	if (mCount == 0) {
+		return 0;
+	}
+
+	uint64_t target = std::min((uint64_t)(clamp(p, 0.0, 1.0) * mCount), mCount - 1);
+	uint64_t seen = 0;
+	for (size_t i = 0; i < N_BUCKETS; i++) {
+		seen += mCounts[i];
+		if (seen > target) {
+			return std::min(upper_bound_of(i), mMax);
+		}
+	}
+
+	return mMax;
+}
+
+} // namespace ttt
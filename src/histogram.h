@@ -0,0 +1,44 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace ttt {
+
+// Histogram of non-negative integers with bounded relative error, in the style of HdrHistogram: values are grouped by their
+// power of two, and each such range is split into SUB_BUCKETS equally wide buckets, so every bucket is at most 1/SUB_BUCKETS as
+// wide as the values in it. Recording a value takes a few instructions and never allocates.
+class LogHistogram {
+public:
+	static constexpr size_t SUB_BUCKET_BITS = 4;
+	static constexpr size_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+
+	void record(uint64_t value);
+
+	uint64_t count() const { return mCount; }
+	uint64_t min() const { return mCount > 0 ? mMin : 0; }
+	uint64_t max() const { return mMax; }
+	double mean() const { return mCount > 0 ? (double)mSum / mCount : 0; }
+
+	// Upper bound of the bucket that contains the `p`th quantile (p in [0, 1]), but at most the largest recorded value
+	uint64_t percentile(double p) const;
+
+private:
+	// Values below SUB_BUCKETS have a bucket each. Each power of two above contributes SUB_BUCKETS buckets.
+	static constexpr size_t N_BUCKETS = SUB_BUCKETS + (64 - SUB_BUCKET_BITS) * SUB_BUCKETS;
+
+	static size_t bucket_of(uint64_t value);
+	static uint64_t upper_bound_of(size_t bucket);
+
+	std::array<uint64_t, N_BUCKETS> mCounts = {};
+	uint64_t mCount = 0;
+	uint64_t mSum = 0;
+	uint64_t mMin = UINT64_MAX;
+	uint64_t mMax = 0;
+};
+
+} // namespace ttt
@@ -0,0 +1,472 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+#include "history.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace ttt {
+
+ProgressIndex::ProgressIndex(string_view text) : mText{text} {
+	// FNV-1a over the significant bytes
+	mHash = 0xcbf29ce484222325;
+	for (size_t i = 0; i < text.size(); i++) {
+		if (size_t skip = insignificant_length(i); skip > 0) {
+			i += skip - 1;
+			continue;
+		}
+
+		if (mSize % STRIDE == 0) {
+			mCheckpoints.push_back((uint32_t)i);
+		}
+
+		++mSize;
+		mHash = (mHash ^ (uint8_t)text[i]) * 0x100000001b3;
+	}
+}
+
+size_t ProgressIndex::insignificant_length(size_t pos) const {
+	if (mText.substr(pos, SOFT_HYPHEN.size()) == SOFT_HYPHEN) {
+		return SOFT_HYPHEN.size();
+	}
+
+	return isspace((unsigned char)mText[pos]) ? 1 : 0;
+}
+
+size_t ProgressIndex::progress_of(size_t pos) const {
+	// Count onwards from the last checkpoint before `pos`
+	size_t checkpoint = lower_bound(mCheckpoints.begin(), mCheckpoints.end(), pos) - mCheckpoints.begin();
+	if (checkpoint == 0) {
+		return 0;
+	}
+
+	size_t progress = (checkpoint - 1) * STRIDE;
+	for (size_t i = mCheckpoints[checkpoint - 1]; i < pos && i < mText.size();) {
+		size_t skip = insignificant_length(i);
+		if (skip == 0) {
+			++progress;
+			skip = 1;
+		}
+
+		i += skip;
+	}
+
+	return progress;
+}
+
+size_t ProgressIndex::position_of(size_t progress) const {
+	if (progress == 0 || mSize == 0) {
+		return 0;
+	}
+
+	// Offset of the significant byte with index `progress - 1`, counted onwards from the checkpoint before it
+	size_t index = min(progress, mSize) - 1;
+	size_t i = mCheckpoints[index / STRIDE];
+	for (size_t n = index % STRIDE; n > 0;) {
+		size_t skip = insignificant_length(i);
+		if (skip == 0) {
+			--n;
+			skip = 1;
+		}
+
+		i += skip;
+	}
+
+	while (size_t skip = insignificant_length(i)) {
+		i += skip;
+	}
+
+	return i + 1;
+}
+
+size_t Recording::events_until(uint32_t ms) const { return upper_bound(times_ms.begin(), times_ms.end(), ms) - times_ms.begin(); }
+
+optional<double> Recording::mean_dwell_ms() const {
+	double sum = 0;
+	size_t n = 0;
+	for (uint32_t dwell : dwell_ms) {
+		if (dwell != NO_DWELL) {
+			sum += dwell;
+			++n;
+		}
+	}
+
+	return n > 0 ? optional{sum / n} : nullopt;
+}
+
+optional<double> Recording::mean_flight_ms() const {
+	double sum = 0;
+	size_t n = 0;
+	for (int32_t flight : flight_ms) {
+		if (flight != NO_FLIGHT) {
+			sum += flight;
+			++n;
+		}
+	}
+
+	return n > 0 ? optional{sum / n} : nullopt;
+}
+
+Recorder::Recorder(const ProgressIndex& index) : mIndex{index} {
+	// Typos and corrections add bytes beyond the text's own
+	size_t capacity = min(2 * index.size() + 64, MAX_RESERVED_EVENTS);
+	mRecording.times_ms.reserve(capacity);
+	mRecording.progress.reserve(capacity);
+	mRecording.keys.reserve(capacity);
+	mRecording.dwell_ms.reserve(capacity);
+	mRecording.flight_ms.reserve(capacity);
+}
+
+void Recorder::clear() {
+	// Keeps the reserved space
+	mRecording.times_ms.clear();
+	mRecording.progress.clear();
+	mRecording.keys.clear();
+	mRecording.dwell_ms.clear();
+	mRecording.flight_ms.clear();
+	mNHeld = 0;
+	mReleaseMs.reset();
+}
+
+void Recorder::record(const TypingSession& session, char c, TypingSession::Clock::time_point time, uint32_t key) {
+	if (!session.started()) {
+		clear();
+		return;
+	}
+
+	uint32_t ms = (uint32_t)(session.seconds(time) * 1000);
+	mRecording.times_ms.push_back(ms);
+	mRecording.progress.push_back((uint32_t)mIndex.progress_of(session.cursor()));
+	mRecording.keys.push_back(c);
+
+	if (key == 0 && mRecording.dwell_ms.empty()) {
+		return;
+	}
+
+	mRecording.dwell_ms.resize(mRecording.times_ms.size(), Recording::NO_DWELL);
+	mRecording.flight_ms.resize(mRecording.times_ms.size(), Recording::NO_FLIGHT);
+	if (key == 0) {
+		return;
+	}
+
+	size_t event = mRecording.times_ms.size() - 1;
+	if (mReleaseMs) {
+		mRecording.flight_ms[event] = (int32_t)(ms - *mReleaseMs);
+		mReleaseMs.reset();
+	}
+
+	for (size_t i = 0; i < mNHeld; i++) {
+		if (mHeld[i].next_event == NO_EVENT) {
+			mHeld[i].next_event = event;
+		}
+	}
+
+	// Keys whose release never arrives, e.g. because the terminal lost focus, eventually make room for new ones.
+	if (mNHeld == MAX_HELD_KEYS) {
+		move(mHeld.begin() + 1, mHeld.end(), mHeld.begin());
+		--mNHeld;
+	}
+
+	mHeld[mNHeld++] = {key, event, NO_EVENT};
+}
+
+void Recorder::release(const TypingSession& session, uint32_t key, TypingSession::Clock::time_point time) {
+	auto it = find_if(mHeld.begin(), mHeld.begin() + mNHeld, [&](const HeldKey& held) { return held.key == key; });
+	if (it == mHeld.begin() + mNHeld) {
+		return;
+	}
+
+	uint32_t ms = (uint32_t)(session.seconds(time) * 1000);
+	mRecording.dwell_ms[it->event] = ms - mRecording.times_ms[it->event];
+	if (it->next_event != NO_EVENT) {
+		mRecording.flight_ms[it->next_event] = (int32_t)(mRecording.times_ms[it->next_event] - ms);
+	} else {
+		mReleaseMs = ms;
+	}
+
+	move(it + 1, mHeld.begin() + mNHeld, it);
+	--mNHeld;
+}
+
+Recording Recorder::finish(const TypingSession& session) const {
+	Recording result = mRecording;
+	result.text_hash = mIndex.text_hash();
+	result.finished_at = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+
+	auto stats = session.stats();
+	result.wpm = stats.wpm;
+	result.accuracy = stats.accuracy;
+
+	return result;
+}
+
+filesystem::path data_dir() {
+	if (const char* xdg_data_home = getenv("XDG_DATA_HOME"); xdg_data_home && *xdg_data_home) {
+		return filesystem::path{xdg_data_home} / "ttt";
+	} else if (const char* home = getenv("HOME"); home && *home) {
+		return filesystem::path{home} / ".local" / "share" / "ttt";
+	}
+
+	return {};
+}
+
+// The header of a recording file, followed by `n_events` times, then as many progress values, then as many keys, and, if
+// `flags` has HAS_KEY_TIMES set, as many dwell times and flight times. All native-endian.
+struct RecordingHeader {
+	static constexpr uint32_t MAGIC = 0x52545454; // "TTTR"
+	static constexpr uint32_t VERSION = 1;
+	static constexpr uint32_t HAS_KEY_TIMES = 1;
+
+	uint32_t magic;
+	uint32_t version;
+	uint64_t text_hash;
+	int64_t finished_at;
+	double wpm;
+	double accuracy;
+	uint32_t n_events;
+	uint32_t flags;
+};
+
+Recording load_recording(const filesystem::path& path) {
+	ifstream in{path, ios::binary};
+	if (!in) {
+		throw runtime_error{format("Could not read {}", path.string())};
+	}
+
+	error_code ec;
+	RecordingHeader header;
+	if (!in.read((char*)&header, sizeof(header)) || header.magic != RecordingHeader::MAGIC || header.version != RecordingHeader::VERSION ||
+		(header.flags & ~RecordingHeader::HAS_KEY_TIMES) != 0 ||
+		filesystem::file_size(path, ec) !=
+			sizeof(header) + header.n_events * (2 * sizeof(uint32_t) + 1 + (header.flags & RecordingHeader::HAS_KEY_TIMES ? 8 : 0))) {
+		throw runtime_error{format("{} is not a recording", path.string())};
+	}
+
+	Recording recording;
+	recording.text_hash = header.text_hash;
+	recording.finished_at = header.finished_at;
+	recording.wpm = header.wpm;
+	recording.accuracy = header.accuracy;
+	recording.times_ms.resize(header.n_events);
+	recording.progress.resize(header.n_events);
+	recording.keys.resize(header.n_events);
+	in.read((char*)recording.times_ms.data(), header.n_events * sizeof(uint32_t));
+	in.read((char*)recording.progress.data(), header.n_events * sizeof(uint32_t));
+	in.read(recording.keys.data(), header.n_events);
+	if (header.flags & RecordingHeader::HAS_KEY_TIMES) {
+		recording.dwell_ms.resize(header.n_events);
+		recording.flight_ms.resize(header.n_events);
+		in.read((char*)recording.dwell_ms.data(), header.n_events * sizeof(uint32_t));
+		in.read((char*)recording.flight_ms.data(), header.n_events * sizeof(int32_t));
+	}
+
+	// Damaged files are rejected rather than replayed wrongly.
+	if (!in || !is_sorted(recording.times_ms.begin(), recording.times_ms.end())) {
+		throw runtime_error{format("{} is damaged", path.string())};
+	}
+
+	return recording;
+}
+
+filesystem::path History::text_dir(uint64_t text_hash) const { return mDir / "history" / format("{:016x}", text_hash); }
+
+void History::save(const Recording& recording, const set<string>& misspelled_words) const {
+	// Loaded first, such that rebuilding missing rollups does not count `recording` twice
+	Rollups rollups = this->rollups();
+
+	auto dir = text_dir(recording.text_hash);
+	filesystem::create_directories(dir);
+
+	auto path = dir / format("{}.rec", recording.finished_at);
+	RecordingHeader header = {
+		RecordingHeader::MAGIC,
+		RecordingHeader::VERSION,
+		recording.text_hash,
+		recording.finished_at,
+		recording.wpm,
+		recording.accuracy,
+		(uint32_t)recording.times_ms.size(),
+		recording.dwell_ms.empty() ? 0 : RecordingHeader::HAS_KEY_TIMES,
+	};
+
+	// Written to a temporary file first, such that a crash does not leave a truncated recording behind.
+	auto tmp_path = path;
+	tmp_path += ".tmp";
+
+	{
+		ofstream out{tmp_path, ios::binary};
+		out.write((const char*)&header, sizeof(header));
+		out.write((const char*)recording.times_ms.data(), recording.times_ms.size() * sizeof(uint32_t));
+		out.write((const char*)recording.progress.data(), recording.progress.size() * sizeof(uint32_t));
+		out.write(recording.keys.data(), recording.keys.size());
+		out.write((const char*)recording.dwell_ms.data(), recording.dwell_ms.size() * sizeof(uint32_t));
+		out.write((const char*)recording.flight_ms.data(), recording.flight_ms.size() * sizeof(int32_t));
+		if (!out) {
+			throw runtime_error{format("Could not write {}", tmp_path.string())};
+		}
+	}
+
+	filesystem::rename(tmp_path, path);
+
+	rollups.add(recording, misspelled_words);
+	rollups.save(rollups_path());
+}
+
+Rollups History::rollups() const {
+	if (filesystem::exists(rollups_path())) {
+		try {
+			return Rollups::load(rollups_path());
+		} catch (const runtime_error&) {
+			// Rebuilt below
+		}
+	}
+
+	Rollups result;
+
+	error_code ec;
+	for (const auto& entry : filesystem::recursive_directory_iterator{mDir / "history", ec}) {
+		if (entry.path().extension() != ".rec") {
+			continue;
+		}
+
+		try {
+			result.add(load_recording(entry.path()), {});
+		} catch (const runtime_error&) {
+			// Files that cannot be read are skipped.
+		}
+	}
+
+	return result;
+}
+
+vector<Recording> History::load(uint64_t text_hash) const {
+	vector<Recording> result;
+
+	error_code ec;
+	for (const auto& entry : filesystem::directory_iterator{text_dir(text_hash), ec}) {
+		if (entry.path().extension() != ".rec") {
+			continue;
+		}
+
+		try {
+			Recording recording = load_recording(entry.path());
+			if (recording.text_hash == text_hash) {
+				result.push_back(std::move(recording));
+			}
+		} catch (const runtime_error&) {
+			// Files that cannot be read are skipped.
+		}
+	}
+
+	sort(result.begin(), result.end(), [](const Recording& a, const Recording& b) { return a.finished_at < b.finished_at; });
+	return result;
+}
+
+optional<Recording> History::best(uint64_t text_hash) const {
+	auto recordings = load(text_hash);
+	auto it = max_element(recordings.begin(), recordings.end(), [](const Recording& a, const Recording& b) { return a.wpm < b.wpm; });
+	if (it == recordings.end()) {
+		return {};
+	}
+
+	return std::move(*it);
+}
+
+GhostReplay::GhostReplay(vector<Recording> recordings, const Layout& layout, const ProgressIndex& index) :
+	mLayout{layout}, mIndex{index}, mCells(layout.cells.size()) {
+	for (auto& recording : recordings) {
+		mGhosts.push_back({std::move(recording), 0, layout.cells.size()});
+	}
+
+	rewind();
+}
+
+void GhostReplay::move(Ghost& ghost, size_t n_events) {
+	ghost.next_event = n_events;
+
+	uint32_t progress = n_events == 0 ? 0 : ghost.recording.progress[n_events - 1];
+	size_t cell = mLayout.cell_of(mIndex.position_of(progress));
+	if (cell == ghost.cell) {
+		return;
+	}
+
+	if (ghost.cell < mCells.size()) {
+		--mCells[ghost.cell];
+		mChanged.push_back(ghost.cell);
+	}
+
+	if (cell < mCells.size()) {
+		++mCells[cell];
+		mChanged.push_back(cell);
+	}
+
+	ghost.cell = cell;
+}
+
+const vector<size_t>& GhostReplay::changed_cells() {
+	// Cells that several ghosts entered or left are reported once.
+	sort(mChanged.begin(), mChanged.end());
+	mChanged.erase(unique(mChanged.begin(), mChanged.end()), mChanged.end());
+	return mChanged;
+}
+
+const vector<size_t>& GhostReplay::rewind() {
+	mChanged.clear();
+	if (mAtStart) {
+		return mChanged;
+	}
+
+	mEvents = {};
+	for (size_t i = 0; i < mGhosts.size(); i++) {
+		move(mGhosts[i], 0);
+		if (!mGhosts[i].recording.times_ms.empty()) {
+			mEvents.emplace(mGhosts[i].recording.times_ms[0], (uint32_t)i);
+		}
+	}
+
+	mTime = 0;
+	mAtStart = true;
+	return changed_cells();
+}
+
+const vector<size_t>& GhostReplay::advance(uint32_t ms) {
+	mChanged.clear();
+
+	if (ms < mTime) {
+		mEvents = {};
+		for (size_t i = 0; i < mGhosts.size(); i++) {
+			const auto& times = mGhosts[i].recording.times_ms;
+			size_t n_events = mGhosts[i].recording.events_until(ms);
+			move(mGhosts[i], n_events);
+			if (n_events < times.size()) {
+				mEvents.emplace(times[n_events], (uint32_t)i);
+			}
+		}
+	} else {
+		while (!mEvents.empty() && mEvents.top().first <= ms) {
+			Ghost& ghost = mGhosts[mEvents.top().second];
+			uint32_t i = mEvents.top().second;
+			mEvents.pop();
+
+			move(ghost, ghost.next_event + 1);
+			if (ghost.next_event < ghost.recording.times_ms.size()) {
+				mEvents.emplace(ghost.recording.times_ms[ghost.next_event], i);
+			}
+		}
+	}
+
+	mTime = ms;
+	mAtStart = false;
+	return changed_cells();
+}
+
+} // namespace ttt
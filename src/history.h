@@ -0,0 +1,208 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+// Recordings of completed tests, such that later tests of the same text can race against them. Each recording is a file
+// $XDG_DATA_HOME/ttt/history/<text hash>/<finish time>.rec, holding one event per byte that was fed into the session.
+// $XDG_DATA_HOME/ttt/rollups aggregates all recordings (see rollups.h).
+
+#pragma once
+
+#include "rollups.h"
+#include "session.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <queue>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace ttt {
+
+// Recordings refer to positions within their text by the number of significant bytes before them, i.e. bytes that are
+// neither whitespace nor soft hyphens. Wrapping only ever inserts or replaces such insignificant bytes, so this progress is
+// the same at any wrap width, and so is the hash of the significant bytes by which recordings are matched to texts.
+//
+// Only the offset of every `STRIDE`th significant byte is kept, such that the index of a large text stays small; the bytes in
+// between are counted when they are looked up. `text` must outlive the index.
+class ProgressIndex {
+public:
+	ProgressIndex(std::string_view text);
+
+	uint64_t text_hash() const { return mHash; }
+	size_t size() const { return mSize; }
+
+	// Number of significant bytes before byte `pos`
+	size_t progress_of(size_t pos) const;
+
+	// Byte offset right after the `progress`th significant byte, i.e. where a typist who got that far sits
+	size_t position_of(size_t progress) const;
+
+private:
+	static constexpr size_t STRIDE = 64;
+
+	// Number of bytes at `pos` to skip, which is 0 if it begins a significant byte
+	size_t insignificant_length(size_t pos) const;
+
+	std::string_view mText;
+	std::vector<uint32_t> mCheckpoints; // Byte offsets of significant bytes 0, STRIDE, 2 * STRIDE, ...
+	size_t mSize = 0;
+	uint64_t mHash;
+};
+
+struct Recording {
+	uint64_t text_hash = 0;
+	int64_t finished_at = 0; // Milliseconds since the Unix epoch
+	double wpm = 0;
+	double accuracy = 0;
+
+	// One entry per byte fed into the session. Times are in milliseconds since the first keystroke and hence sorted.
+	std::vector<uint32_t> times_ms;
+	std::vector<uint32_t> progress; // Progress of the cursor after the byte
+	std::vector<char> keys;
+
+	// How long each key was held, and the time from releasing the previously pressed key to pressing it, which is negative if
+	// the two were held at once. Known only for the first byte of each key press and only if the terminal reported key
+	// releases (see keyboard.h). Either empty or one entry per byte.
+	static constexpr uint32_t NO_DWELL = UINT32_MAX;
+	static constexpr int32_t NO_FLIGHT = INT32_MIN;
+	std::vector<uint32_t> dwell_ms;
+	std::vector<int32_t> flight_ms;
+
+	// Averages over the key presses whose dwell and flight time is known, if any
+	std::optional<double> mean_dwell_ms() const;
+	std::optional<double> mean_flight_ms() const;
+
+	uint32_t duration_ms() const { return times_ms.empty() ? 0 : times_ms.back(); }
+
+	// Number of events within the first `ms` milliseconds. A binary search over `times_ms`.
+	size_t events_until(uint32_t ms) const;
+};
+
+// Reads the recording at `path`. Throws if it is not a valid recording.
+Recording load_recording(const std::filesystem::path& path);
+
+// Records a session as bytes are fed into it. Space for a typical test is reserved up front, such that recording keystrokes
+// does not allocate, but no more than `MAX_RESERVED_EVENTS`, lest large texts reserve far more than is ever typed.
+class Recorder {
+public:
+	Recorder(const ProgressIndex& index);
+
+	// Notes that `c` was fed into `session` at `time`. `key` identifies the key whose press produced `c` if it is the first
+	// such byte and the terminal reports key releases, else 0. Resetting the session discards what was recorded so far.
+	void record(const TypingSession& session, char c, TypingSession::Clock::time_point time, uint32_t key = 0);
+
+	// Notes that `key` was released at `time`, which completes the dwell time of its latest press and the flight time to the
+	// next press
+	void release(const TypingSession& session, uint32_t key, TypingSession::Clock::time_point time);
+
+	// The recording of `session`, which must be complete
+	Recording finish(const TypingSession& session) const;
+
+	static constexpr size_t MAX_RESERVED_EVENTS = 1 << 18;
+
+private:
+	static constexpr size_t MAX_HELD_KEYS = 8;
+	static constexpr size_t NO_EVENT = SIZE_MAX;
+
+	struct HeldKey {
+		uint32_t key;
+		size_t event;
+		size_t next_event; // The next key press after this one, if any yet
+	};
+
+	void clear();
+
+	const ProgressIndex& mIndex;
+	Recording mRecording;
+
+	std::array<HeldKey, MAX_HELD_KEYS> mHeld;
+	size_t mNHeld = 0;
+
+	// Release of the latest key press, if it preceded the next press
+	std::optional<uint32_t> mReleaseMs;
+};
+
+// $XDG_DATA_HOME/ttt or ~/.local/share/ttt, or an empty path if neither is set
+std::filesystem::path data_dir();
+
+// The recordings of all texts within a directory
+class History {
+public:
+	History(std::filesystem::path dir) : mDir{std::move(dir)} {}
+
+	// Writes `recording` into a new file and adds it to the rollups
+	void save(const Recording& recording, const std::set<std::string>& misspelled_words) const;
+
+	// All readable recordings of the text with hash `text_hash`, oldest first
+	std::vector<Recording> load(uint64_t text_hash) const;
+
+	// The fastest recording of the text with hash `text_hash`, if any
+	std::optional<Recording> best(uint64_t text_hash) const;
+
+	// Aggregates over all recordings. Rebuilt from the recordings if the rollups file is missing or damaged, in which case
+	// misspelled words are not known.
+	Rollups rollups() const;
+	std::filesystem::path rollups_path() const { return mDir / "rollups"; }
+
+private:
+	std::filesystem::path text_dir(uint64_t text_hash) const;
+
+	std::filesystem::path mDir;
+};
+
+// Replays any number of recordings of a text in step with a live session, keeping track of the cells of `layout` that the
+// ghosts' carets cover. The recordings' events are merged by time with a min-heap, such that catching up with the session
+// costs time proportional to the number of events since the previous call rather than to the number of ghosts.
+class GhostReplay {
+public:
+	GhostReplay(std::vector<Recording> recordings, const Layout& layout, const ProgressIndex& index);
+
+	size_t size() const { return mGhosts.size(); }
+
+	// Number of ghosts covering each cell
+	const std::vector<uint16_t>& cells() const { return mCells; }
+
+	// Whether all recordings have been replayed to their end
+	bool finished() const { return !mAtStart && mEvents.empty(); }
+
+	// Moves all ghosts back to the beginning of the text. Returns the cells whose number of ghosts changed.
+	const std::vector<size_t>& rewind();
+
+	// Moves all ghosts to where their recordings were `ms` milliseconds after the first keystroke. Returns the cells whose
+	// number of ghosts changed. Going back in time requires a binary search per ghost.
+	const std::vector<size_t>& advance(uint32_t ms);
+
+private:
+	struct Ghost {
+		Recording recording;
+		size_t next_event = 0;
+		size_t cell;
+	};
+
+	// Moves `ghost` to the position after its first `n_events` events
+	void move(Ghost& ghost, size_t n_events);
+	const std::vector<size_t>& changed_cells();
+
+	const Layout& mLayout;
+	const ProgressIndex& mIndex;
+
+	std::vector<Ghost> mGhosts;
+	std::vector<uint16_t> mCells;
+
+	// The next event of each ghost that has any left, by time
+	using Event = std::pair<uint32_t, uint32_t>;
+	std::priority_queue<Event, std::vector<Event>, std::greater<>> mEvents;
+
+	uint32_t mTime = 0;
+	bool mAtStart = false;
+	std::vector<size_t> mChanged;
+};
+
+} // namespace ttt
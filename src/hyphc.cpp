@@ -0,0 +1,268 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+// ttt-hyphc: compiles TeX hyphenation patterns (\patterns{...} and \hyphenation{...}) into the packed trie format
+// described in hyphenation.h. Runs at build time; the result is embedded into ttt as a resource.
+
+#include "hyphenation.h"
+
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+
+using namespace std;
+
+namespace ttt {
+
+struct TrieNode {
+	map<uint8_t, unique_ptr<TrieNode>> children;
+	vector<uint8_t> values;
+	uint32_t base = 0;
+};
+
+struct Pattern {
+	u32string chars;
+	vector<uint8_t> values; // chars.size() + 1 values, one before, between, and after the characters
+};
+
+// Parses a pattern such as ".ad4der" into its characters and values
+Pattern parse_pattern(const string& str) {
+	Pattern result;
+	result.values.push_back(0);
+	for (string_view rest = str; !rest.empty();) {
+		char32_t c = unilib::utf::decode(rest);
+		if (c >= '0' && c <= '9') {
+			result.values.back() = (uint8_t)(c - '0');
+		} else {
+			result.chars.push_back(c == '.' ? U'.' : unilib::unicode::lowercase(c));
+			result.values.push_back(0);
+		}
+	}
+
+	return result;
+}
+
+// Turns an exception such as "ta-ble" into a whole-word pattern whose values override all regular patterns
+Pattern parse_exception(const string& str) {
+	Pattern result;
+	result.chars.push_back(U'.');
+	result.values = {0, 0};
+	for (string_view rest = str; !rest.empty();) {
+		char32_t c = unilib::utf::decode(rest);
+		if (c == '-') {
+			result.values.back() = 11;
+		} else {
+			if (result.chars.size() > 1 && result.values.back() == 0) {
+				result.values.back() = 10;
+			}
+
+			result.chars.push_back(unilib::unicode::lowercase(c));
+			result.values.push_back(0);
+		}
+	}
+
+	result.chars.push_back(U'.');
+	result.values.push_back(0);
+	return result;
+}
+
+int main(int argc, char* argv[]) {
+	if (argc != 3) {
+		throw invalid_argument{"Usage: ttt-hyphc INPUT OUTPUT"};
+	}
+
+	ifstream in{argv[1]};
+	if (!in) {
+		throw runtime_error{format("Could not open {}", argv[1])};
+	}
+
+	// Tokenize, dropping comments
+	vector<string> tokens;
+	for (string line; getline(in, line);) {
+		line = line.substr(0, line.find('%'));
+		for (char& c : line) {
+			if (c == '{' || c == '}') {
+				c = ' ';
+			}
+		}
+
+		istringstream line_stream{line};
+		for (string token; line_stream >> token;) {
+			tokens.push_back(token);
+		}
+	}
+
+	HyphenationTrieHeader header = {};
+	header.magic = HyphenationTrieHeader::MAGIC;
+	header.version = HyphenationTrieHeader::VERSION;
+	header.left_min = 2;
+	header.right_min = 3;
+
+	vector<Pattern> patterns;
+	string section;
+	for (size_t i = 0; i < tokens.size(); i++) {
+		const string& token = tokens[i];
+		if (token == "\\lefthyphenmin" && i + 1 < tokens.size()) {
+			header.left_min = stoul(tokens[++i]);
+		} else if (token == "\\righthyphenmin" && i + 1 < tokens.size()) {
+			header.right_min = stoul(tokens[++i]);
+		} else if (token.starts_with('\\')) {
+			section = token;
+		} else if (section == "\\patterns") {
+			patterns.emplace_back(parse_pattern(token));
+		} else if (section == "\\hyphenation") {
+			patterns.emplace_back(parse_exception(token));
+		} else {
+			throw runtime_error{format("Unexpected token '{}' outside of \\patterns and \\hyphenation", token)};
+		}
+	}
+
+	// The word boundary gets code 0, all other characters are numbered in order.
+	set<char32_t> alphabet_set;
+	for (const auto& pattern : patterns) {
+		alphabet_set.insert(pattern.chars.begin(), pattern.chars.end());
+	}
+
+	alphabet_set.erase(U'.');
+	vector<char32_t> alphabet(alphabet_set.begin(), alphabet_set.end());
+	if (alphabet.size() > 254) {
+		throw runtime_error{"Too many distinct characters in patterns"};
+	}
+
+	auto code = [&](char32_t c) -> uint8_t {
+		return c == U'.' ? 0 : (uint8_t)(lower_bound(alphabet.begin(), alphabet.end(), c) - alphabet.begin() + 1);
+	};
+
+	TrieNode root;
+	for (const auto& pattern : patterns) {
+		TrieNode* node = &root;
+		for (char32_t c : pattern.chars) {
+			auto& child = node->children[code(c)];
+			if (!child) {
+				child = make_unique<TrieNode>();
+			}
+
+			node = child.get();
+		}
+
+		// Duplicate patterns are merged by taking the maximum of their values.
+		node->values.resize(max(node->values.size(), pattern.values.size()), 0);
+		for (size_t i = 0; i < pattern.values.size(); i++) {
+			node->values[i] = max(node->values[i], pattern.values[i]);
+		}
+	}
+
+	// Pack the trie by placing each node at the first base at which none of its children collide with previously placed
+	// transitions. The root sits at base 0.
+	vector<uint32_t> slots, node_patterns;
+	vector<bool> is_base;
+	vector<uint32_t> pattern_entries;
+	vector<uint8_t> values;
+	map<string, uint32_t> pattern_indices;
+	size_t first_free_slot = 0, first_free_base = 0;
+
+	auto reserve = [&](size_t size) {
+		if (slots.size() < size) {
+			slots.resize(size, 0);
+			node_patterns.resize(size, 0);
+			is_base.resize(size, false);
+		}
+	};
+
+	auto fits = [&](const TrieNode& node, size_t base) {
+		if (base < is_base.size() && is_base[base]) {
+			return false;
+		}
+
+		for (const auto& [c, child] : node.children) {
+			if (base + c < slots.size() && slots[base + c] != 0) {
+				return false;
+			}
+		}
+
+		return true;
+	};
+
+	vector<TrieNode*> queue = {&root};
+	reserve(root.children.empty() ? 1 : root.children.rbegin()->first + 1);
+	is_base[0] = true;
+	for (const auto& [c, child] : root.children) {
+		slots[c] = c + 1;
+	}
+	for (size_t i = 0; i < queue.size(); i++) {
+		TrieNode* node = queue[i];
+
+		if (!node->values.empty()) {
+			auto [it, inserted] = pattern_indices.emplace(string{node->values.begin(), node->values.end()}, (uint32_t)pattern_entries.size() + 1);
+			if (inserted) {
+				pattern_entries.push_back(((uint32_t)values.size() << 8) | (uint32_t)node->values.size());
+				values.insert(values.end(), node->values.begin(), node->values.end());
+			}
+
+			node_patterns[node->base] = it->second;
+		}
+
+		for (auto& [c, child] : node->children) {
+			// Leaves have no transitions and only need a unique base to attach their pattern to.
+			size_t& first = child->children.empty() ? first_free_base : first_free_slot;
+			while (first < slots.size() && (is_base[first] || (!child->children.empty() && slots[first] != 0))) {
+				first++;
+			}
+
+			size_t base = first;
+			while (!fits(*child, base)) {
+				base++;
+			}
+
+			// Claim the slots of the child's transitions right away; they are filled in once the child is dequeued.
+			child->base = (uint32_t)base;
+			reserve(base + (child->children.empty() ? 0 : child->children.rbegin()->first) + 1);
+			is_base[base] = true;
+			for (const auto& [grandchild_c, grandchild] : child->children) {
+				slots[base + grandchild_c] = grandchild_c + 1;
+			}
+
+			queue.push_back(child.get());
+		}
+
+		for (auto& [c, child] : node->children) {
+			slots[node->base + c] = (child->base << 8) | (uint32_t)(c + 1);
+		}
+	}
+
+	header.n_alphabet = (uint32_t)alphabet.size();
+	header.n_slots = (uint32_t)slots.size();
+	header.n_patterns = (uint32_t)pattern_entries.size();
+	header.values_size = (uint32_t)values.size();
+
+	ofstream out{argv[2], ios::binary};
+	auto write = [&](const auto& vec) { out.write((const char*)vec.data(), vec.size() * sizeof(vec[0])); };
+	out.write((const char*)&header, sizeof(header));
+	write(alphabet);
+	write(slots);
+	write(node_patterns);
+	write(pattern_entries);
+	write(values);
+
+	if (!out) {
+		throw runtime_error{format("Could not write {}", argv[2])};
+	}
+
+	cout << format("Compiled {} patterns into {} trie slots", patterns.size(), slots.size()) << endl;
+	return 0;
+}
+
+} // namespace ttt
+
+int main(int argc, char* argv[]) {
+	try {
+		return ttt::main(argc, argv);
+	} catch (const exception& e) {
+		cerr << format("ttt-hyphc: {}", e.what()) << endl;
+		return 1;
+	}
+}
@@ -0,0 +1,176 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+#pragma once
+
+#include <unilib/unicode.h>
+#include <unilib/utf.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace ttt {
+
+// Binary format of compiled hyphenation patterns, as produced by `ttt-hyphc` (src/hyphc.cpp). All integers are little
+// endian and the sections follow the header in the order listed there.
+//
+// Liang's patterns are stored as a packed trie over an alphabet of code points: code 0 denotes the word boundary `.` and
+// code i > 0 the i-th entry of the alphabet. The transition of the node with base b on code c lives in slot b + c and is
+// valid iff its low byte equals c + 1, in which case the remaining bits hold the base of the child node. `node_patterns[b]`
+// is the index + 1 of the pattern that ends at the node with base b, or 0 if there is none.
+//
+// Exceptions (TeX's \hyphenation list) are compiled into whole-word patterns whose values are >= 10, such that they take
+// precedence over all regular patterns.
+struct HyphenationTrieHeader {
+	static constexpr uint32_t MAGIC = 0x48545454; // "TTTH"
+	static constexpr uint32_t VERSION = 1;
+
+	uint32_t magic;
+	uint32_t version;
+	uint32_t left_min;    // Minimum number of characters before a hyphen
+	uint32_t right_min;   // Minimum number of characters after a hyphen
+	uint32_t n_alphabet;  // char32_t alphabet[n_alphabet], sorted
+	uint32_t n_slots;     // uint32_t slots[n_slots]; uint32_t node_patterns[n_slots]
+	uint32_t n_patterns;  // uint32_t patterns[n_patterns]: (offset into values << 8) | number of values
+	uint32_t values_size; // uint8_t values[values_size]
+};
+
+class Hyphenator {
+public:
+	Hyphenator(std::string_view data) {
+		size_t pos = 0;
+		auto read = [&](void* dst, size_t size) {
+			if (pos + size > data.size()) {
+				throw std::runtime_error{"Truncated hyphenation patterns"};
+			}
+
+			memcpy(dst, data.data() + pos, size);
+			pos += size;
+		};
+
+		auto read_vector = [&](auto& vec, size_t n) {
+			vec.resize(n);
+			read(vec.data(), n * sizeof(vec[0]));
+		};
+
+		HyphenationTrieHeader header;
+		read(&header, sizeof(header));
+		if (header.magic != HyphenationTrieHeader::MAGIC || header.version != HyphenationTrieHeader::VERSION) {
+			throw std::runtime_error{"Invalid hyphenation patterns"};
+		}
+
+		mLeftMin = header.left_min;
+		mRightMin = header.right_min;
+		read_vector(mAlphabet, header.n_alphabet);
+		read_vector(mSlots, header.n_slots);
+		read_vector(mNodePatterns, header.n_slots);
+		read_vector(mPatterns, header.n_patterns);
+		read_vector(mValues, header.values_size);
+
+		for (size_t i = 0; i < mAlphabet.size(); i++) {
+			if (mAlphabet[i] < mAsciiCodes.size()) {
+				mAsciiCodes[mAlphabet[i]] = (uint8_t)(i + 1);
+			}
+		}
+	}
+
+	// Returns the byte offsets within `word` at which it may be hyphenated. Results are memoized per word.
+	const std::vector<uint32_t>& hyphenate(std::string_view word) const {
+		auto it = mCache.find(word);
+		if (it != mCache.end()) {
+			return it->second;
+		}
+
+		return mCache.emplace(std::string{word}, compute(word)).first->second;
+	}
+
+private:
+	// Returns the alphabet code of `c`, or -1 if it does not take part in any pattern.
+	int code(char32_t c) const {
+		c = unilib::unicode::lowercase(c);
+		if (c < mAsciiCodes.size()) {
+			return mAsciiCodes[c] == 0 ? -1 : mAsciiCodes[c];
+		}
+
+		auto it = std::lower_bound(mAlphabet.begin(), mAlphabet.end(), c);
+		return it == mAlphabet.end() || *it != c ? -1 : (int)(it - mAlphabet.begin()) + 1;
+	}
+
+	std::vector<uint32_t> compute(std::string_view word) const {
+		// Codes of the word padded with word boundaries and the byte offset of each character
+		std::vector<uint8_t> codes = {0};
+		std::vector<uint32_t> offsets;
+		for (std::string_view rest = word; !rest.empty();) {
+			offsets.push_back((uint32_t)(word.size() - rest.size()));
+			int c = code(unilib::utf::decode(rest));
+			if (c < 0) {
+				// Words with characters foreign to the patterns' language are left alone.
+				return {};
+			}
+
+			codes.push_back((uint8_t)c);
+		}
+
+		codes.push_back(0);
+
+		size_t n = offsets.size();
+		if (n < mLeftMin + mRightMin) {
+			return {};
+		}
+
+		// values[k] is the hyphenation value between codes[k - 1] and codes[k]. Odd values permit a hyphen.
+		std::vector<uint8_t> values(codes.size() + 1, 0);
+		for (size_t i = 0; i < codes.size(); i++) {
+			uint32_t node = 0;
+			for (size_t j = i; j < codes.size(); j++) {
+				uint32_t slot = node + codes[j];
+				if (slot >= mSlots.size() || (mSlots[slot] & 0xFF) != codes[j] + 1u) {
+					break;
+				}
+
+				node = mSlots[slot] >> 8;
+				if (uint32_t pattern = mNodePatterns[node]; pattern != 0) {
+					uint32_t entry = mPatterns[pattern - 1];
+					const uint8_t* pattern_values = &mValues[entry >> 8];
+					for (size_t k = 0; k < (entry & 0xFF); k++) {
+						values[i + k] = std::max(values[i + k], pattern_values[k]);
+					}
+				}
+			}
+		}
+
+		std::vector<uint32_t> result;
+		for (size_t k = mLeftMin; k + mRightMin <= n; k++) {
+			if (values[k + 1] % 2 == 1) {
+				result.push_back(offsets[k]);
+			}
+		}
+
+		return result;
+	}
+
+	uint32_t mLeftMin, mRightMin;
+	std::vector<char32_t> mAlphabet;
+	std::vector<uint32_t> mSlots;
+	std::vector<uint32_t> mNodePatterns;
+	std::vector<uint32_t> mPatterns;
+	std::vector<uint8_t> mValues;
+	std::array<uint8_t, 128> mAsciiCodes = {};
+
+	struct StringHash {
+		using is_transparent = void;
+		size_t operator()(std::string_view str) const { return std::hash<std::string_view>{}(str); }
+	};
+
+	mutable std::unordered_map<std::string, std::vector<uint32_t>, StringHash, std::equal_to<>> mCache;
+};
+
+} // namespace ttt
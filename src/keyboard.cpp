@@ -0,0 +1,132 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+#include "keyboard.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace ttt {
+
+// Key codes within the Unicode private use area denote functional keys such as F1 or Left Shift, which produce no text
+constexpr uint32_t FIRST_FUNCTIONAL_KEY = 57344;
+constexpr uint32_t LAST_FUNCTIONAL_KEY = 63743;
+
+constexpr size_t N_FIELDS = 3;
+constexpr size_t MAX_PARTS = 8;
+
+optional<KeyEvent> KittyDecoder::feed(char c) {
+	if (mSize == 0) {
+		if (c == 27) {
+			mSequence[mSize++] = c;
+			return {};
+		}
+
+		KeyEvent event = {KeyEvent::Type::Press, 0, {}, 1};
+		event.bytes[0] = c;
+		return event;
+	}
+
+	if (mSize == 1 && c != '[') {
+		// Not a CSI sequence; drop the Esc and treat `c` on its own.
+		mSize = 0;
+		return feed(c);
+	}
+
+	if (mSize == mSequence.size()) {
+		// Too long to be a key event. Skip to its end.
+		if (c >= 0x40 && c <= 0x7e) {
+			mSize = 0;
+		}
+
+		return {};
+	}
+
+	mSequence[mSize++] = c;
+	if (mSize == 2 || c < 0x40 || c > 0x7e) {
+		return {};
+	}
+
+	auto result = decode();
+	mSize = 0;
+	return result;
+}
+
+optional<KeyEvent> KittyDecoder::decode() const {
+	// CSI key[:alternates] ; modifiers[:event type] ; text code points u, where numbers are separated by ':' within fields and
+	// omitted numbers take their default. Functional keys may also end in other letters or '~', but never produce text.
+	string_view params{mSequence.data() + 2, mSize - 3};
+	char final = mSequence[mSize - 1];
+
+	array<array<uint32_t, MAX_PARTS>, N_FIELDS> fields = {};
+	array<size_t, N_FIELDS> n_parts = {};
+	size_t field = 0, part = 0;
+	for (char c : params) {
+		if (c >= '0' && c <= '9') {
+			if (field < N_FIELDS && part < MAX_PARTS) {
+				fields[field][part] = fields[field][part] * 10 + (c - '0');
+				n_parts[field] = max(n_parts[field], part + 1);
+			}
+		} else if (c == ':') {
+			++part;
+		} else if (c == ';') {
+			++field;
+			part = 0;
+		} else {
+			// Responses to queries, such as CSI ? flags u
+			return {};
+		}
+	}
+
+	uint32_t key = fields[0][0];
+	uint32_t modifiers = fields[1][0] > 0 ? fields[1][0] - 1 : 0;
+	uint32_t type = fields[1][1] > 0 ? fields[1][1] : 1;
+	if (type < 1 || type > 3) {
+		return {};
+	}
+
+	KeyEvent event = {(KeyEvent::Type)type, final == 'u' ? key : 0, {}, 0};
+	if (event.type == KeyEvent::Type::Release || final != 'u') {
+		return event;
+	}
+
+	auto append = [&](uint32_t cp) {
+		size_t length = cp < 0x80 ? 1 : cp < 0x800 ? 2 : cp < 0x10000 ? 3 : 4;
+		if (cp > 0x10ffff || event.n_bytes + length > event.bytes.size()) {
+			return;
+		}
+
+		char* out = event.bytes.data() + event.n_bytes;
+		if (length == 1) {
+			out[0] = (char)cp;
+		} else {
+			out[0] = (char)((0xf00 >> length) | (cp >> (6 * (length - 1))));
+			for (size_t i = 1; i < length; i++) {
+				out[i] = (char)(0x80 | ((cp >> (6 * (length - 1 - i))) & 0x3f));
+			}
+		}
+
+		event.n_bytes += (uint8_t)length;
+	};
+
+	bool alt = modifiers & 2;
+	bool ctrl = modifiers & 4;
+	if (n_parts[2] > 0) {
+		for (size_t i = 0; i < n_parts[2]; i++) {
+			append(fields[2][i]);
+		}
+	} else if (ctrl && key >= 'a' && key <= 'z') {
+		append(key & 0x1f);
+	} else if (ctrl && key == 127) { // Ctrl+Backspace
+		append(8);
+	} else if (key == 27 || key == 13 || key == 9 || key == 127) { // Esc, Enter, Tab, Backspace
+		append(key);
+	} else if (!ctrl && !alt && key >= 32 && (key < FIRST_FUNCTIONAL_KEY || key > LAST_FUNCTIONAL_KEY)) {
+		append(key);
+	}
+
+	return event;
+}
+
+} // namespace ttt
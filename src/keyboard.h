@@ -0,0 +1,61 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+// Decoder for the kitty keyboard protocol (https://sw.kovidgoyal.net/kitty/keyboard-protocol/), which terminals use to report
+// key presses, repeats, and releases as escape sequences, rather than sending only the bytes that a key press produces.
+// Knowing when each key is released lets ttt measure how long keys are held.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace ttt {
+
+// Flags to push onto the terminal's keyboard mode stack: disambiguate escape codes (1), report event types (2), report all keys
+// as escape codes (8), and report the text that keys produce (16).
+constexpr std::string_view KITTY_KEYBOARD_PUSH = "\033[>27u";
+constexpr std::string_view KITTY_KEYBOARD_POP = "\033[<u";
+constexpr std::string_view KITTY_KEYBOARD_QUERY = "\033[?u";
+
+struct KeyEvent {
+	enum class Type : uint8_t {
+		Press = 1,
+		Repeat = 2,
+		Release = 3,
+	};
+
+	Type type;
+
+	// Unicode code point of the key without modifiers (e.g. 'a' also when Shift is held), or one of the protocol's codes for
+	// functional keys. 0 for bytes that were not part of an escape sequence.
+	uint32_t key;
+
+	// What to feed into a `TypingSession` for this event. Empty for releases and for keys that produce no text, such as Shift.
+	std::array<char, 16> bytes;
+	uint8_t n_bytes;
+
+	std::string_view text() const { return {bytes.data(), n_bytes}; }
+};
+
+// Turns the bytes that a terminal sends in kitty keyboard mode back into key events. Escape sequences are assembled in a fixed
+// buffer, such that decoding never allocates.
+class KittyDecoder {
+public:
+	// Consumes one byte, returning the event it completes, if any. Bytes outside of escape sequences (e.g. pasted text) are
+	// reported as key presses of their own.
+	std::optional<KeyEvent> feed(char c);
+
+private:
+	std::optional<KeyEvent> decode() const;
+
+	// Long enough for a key with all its alternate key codes and a few code points of associated text; longer sequences are
+	// dropped.
+	std::array<char, 96> mSequence;
+	size_t mSize = 0;
+};
+
+} // namespace ttt
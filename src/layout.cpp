@@ -0,0 +1,422 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+#include "hyphenation.h"
+#include "layout.h"
+#include "text.h"
+
+#include <unilib/unicode.h>
+#include <unilib/utf.h>
+
+#include <algorithm>
+#include <bit>
+#include <iterator>
+#include <sstream>
+
+using namespace std;
+
+namespace ttt {
+
+// Breaks the prefix of `word` that fits onto the current `line` off at the last hyphenation point and appends it to `wrapped`.
+// Returns the remainder of the word.
+string hyphenate_word(const Hyphenator& hyphenator, string word, string& line, string& wrapped, size_t wrap_width) {
+	if ((line.empty() ? 0 : line.size() + 1) + word.size() <= wrap_width) {
+		return word;
+	}
+
+	// Only hyphenate the word's core; not any punctuation surrounding it.
+	size_t core_begin = 0, core_end = word.size();
+	while (core_begin < core_end && ispunct((unsigned char)word[core_begin])) {
+		core_begin++;
+	}
+
+	while (core_end > core_begin && ispunct((unsigned char)word[core_end - 1])) {
+		core_end--;
+	}
+
+	const auto& points = hyphenator.hyphenate(string_view{word}.substr(core_begin, core_end - core_begin));
+
+	size_t consumed = 0;
+	while (true) {
+		size_t remaining = word.size() - consumed;
+		size_t line_width = line.empty() ? 0 : line.size() + 1;
+		if (line_width + remaining <= wrap_width) {
+			break;
+		}
+
+		// Find the last hyphenation point that leaves room for the hyphen itself
+		size_t split = 0;
+		for (size_t point : points) {
+			point += core_begin;
+			if (point > consumed && line_width + point - consumed + 1 <= wrap_width) {
+				split = point;
+			}
+		}
+
+		if (split == 0) {
+			if (line.empty()) {
+				break;
+			}
+
+			wrapped += line + "\n";
+			line.clear();
+			continue;
+		}
+
+		if (!line.empty()) {
+			line += ' ';
+		}
+
+		line += string_view{word}.substr(consumed, split - consumed);
+		line += SOFT_HYPHEN;
+		wrapped += line + "\n";
+		line.clear();
+		consumed = split;
+	}
+
+	return word.substr(consumed);
+}
+
+string wrap_text(const string& text, int wrap_width, const WidthContext& widths, const Hyphenator* hyphenator) {
+	if (wrap_width <= 0) {
+		return text;
+	}
+
+	string wrapped;
+	size_t start = 0;
+	while (start < text.size()) {
+		size_t newline_pos = text.find('\n', start);
+		string paragraph;
+		if (newline_pos == string::npos) {
+			paragraph = text.substr(start);
+			start = text.size();
+		} else {
+			paragraph = text.substr(start, newline_pos - start);
+			start = newline_pos + 1;
+		}
+
+		istringstream iss(paragraph);
+		vector<string> words{istream_iterator<string>(iss), istream_iterator<string>()};
+		string line;
+
+		for (auto word : words) {
+			if (hyphenator) {
+				word = hyphenate_word(*hyphenator, std::move(word), line, wrapped, wrap_width);
+			}
+
+			// If the word is longer than wrap_width, break it up
+			if (word.size() > static_cast<size_t>(wrap_width)) {
+				// First, add any existing line content
+				if (!line.empty()) {
+					wrapped += line + "\n";
+					line.clear();
+				}
+
+				// Break up the long word while respecting grapheme clusters
+				size_t word_start = 0;
+				size_t current_width = 0;
+				size_t chunk_start = word_start;
+
+				while (word_start < word.size()) {
+					size_t cluster_end = find_grapheme_cluster_end(word, word_start);
+					size_t cluster_size = cluster_end - word_start;
+
+					// Get the display width of this cluster
+					size_t width = widths.cluster_width(string_view{word}.substr(word_start, cluster_size));
+
+					if (current_width + width > static_cast<size_t>(wrap_width)) {
+						// This cluster would exceed the wrap width
+						if (chunk_start < word_start) {
+							// Output the accumulated chunk
+							if (chunk_start > 0) {
+								wrapped += "\n";
+							}
+							wrapped += word.substr(chunk_start, word_start - chunk_start);
+							chunk_start = word_start;
+							current_width = 0;
+						} else if (width > static_cast<size_t>(wrap_width)) {
+							// Single cluster wider than wrap width - force break
+							if (word_start > 0) {
+								wrapped += "\n";
+							}
+							wrapped += word.substr(word_start, cluster_size);
+							word_start = cluster_end;
+							chunk_start = word_start;
+							current_width = 0;
+							continue;
+						}
+					}
+
+					current_width += width;
+					word_start = cluster_end;
+				}
+
+				// Output any remaining chunk
+				if (chunk_start < word_start) {
+					if (chunk_start > 0) {
+						wrapped += "\n";
+					}
+					wrapped += word.substr(chunk_start, word_start - chunk_start);
+				}
+
+				continue;
+			}
+
+			// Normal word handling
+			if (line.empty()) {
+				line = word;
+			} else if (line.size() + 1 + word.size() <= static_cast<size_t>(wrap_width)) {
+				line += " " + word;
+			} else {
+				wrapped += line + "\n";
+				line = word;
+			}
+		}
+
+		if (!line.empty()) {
+			wrapped += line;
+		}
+
+		if (newline_pos != string::npos) {
+			wrapped += "\n";
+		}
+	}
+
+	return wrapped;
+}
+
+// Paragraphs are wrapped independently of each other, so chunks of at least this size that end after a newline can be, too
+constexpr size_t WRAP_CHUNK_SIZE = 16 * 1024;
+
+void wrap_text_in_place(string& text, int wrap_width, const WidthContext& widths, const Hyphenator* hyphenator) {
+	if (wrap_width <= 0) {
+		return;
+	}
+
+	transform_in_place(
+		text,
+		[](const string& text, size_t begin) {
+			size_t newline_pos = text.find('\n', min(begin + WRAP_CHUNK_SIZE, text.size()) - 1);
+			return newline_pos == string::npos ? text.size() : newline_pos + 1;
+		},
+		[&](const string& chunk) { return wrap_text(chunk, wrap_width, widths, hyphenator); }
+	);
+}
+
+// What a layout is made of while it is computed. The layout keeps it alive and refers to it afterwards.
+struct LayoutTables {
+	string text;
+	vector<Layout::Line> lines;
+	vector<Layout::Cell> cells;
+	vector<uint32_t> visual_order;
+	vector<Layout::Word> words;
+	vector<uint64_t> word_stops;
+};
+
+void add_line(LayoutTables& t, const WidthContext& widths, size_t begin, size_t end);
+
+Layout::Layout(string text_, const WidthContext& widths_) : widths{widths_} {
+	auto t = make_shared<LayoutTables>();
+	t->text = std::move(text_);
+	t->word_stops.resize((t->text.size() + 63) / 64);
+
+	// The tables are allocated once, rather than grown, which would briefly need the memory of both their old and new copies.
+	// Cells are reserved for every code point, of which a grapheme cluster holds at least one; space that is reserved but never
+	// used takes up no memory.
+	t->lines.reserve(count(t->text.begin(), t->text.end(), '\n') + 1);
+	t->cells.reserve(count_if(t->text.begin(), t->text.end(), [](char c) { return ((uint8_t)c & 0xC0) != 0x80; }));
+
+	for (size_t begin = 0; begin <= t->text.size();) {
+		size_t end = min(t->text.find('\n', begin), t->text.size());
+		add_line(*t, widths, begin, end);
+		begin = end + 1;
+	}
+
+	enum class Kind { Word, Space, Punctuation };
+	auto kind_of = [&](size_t begin, size_t end) {
+		bool is_word = false, is_space = true;
+		for (string_view rest = string_view{t->text}.substr(begin, end - begin); !rest.empty();) {
+			char32_t c = unilib::utf::decode(rest);
+			auto category = unilib::unicode::category(c);
+			is_word |= (category & (unilib::unicode::L | unilib::unicode::N)) != 0;
+			is_space &= (category & unilib::unicode::Z) != 0 || (c >= '\t' && c <= '\r');
+		}
+
+		return is_word ? Kind::Word : (is_space ? Kind::Space : Kind::Punctuation);
+	};
+
+	// Words are counted before they are stored, for the same reason
+	size_t n_words = 0;
+	for_each_word_segment(t->text, [&](size_t begin, size_t end) { n_words += kind_of(begin, end) == Kind::Word; });
+	t->words.reserve(n_words);
+
+	Kind prev_kind = Kind::Space;
+	for_each_word_segment(t->text, [&](size_t begin, size_t end) {
+		Kind kind = kind_of(begin, end);
+		if (kind == Kind::Word) {
+			t->words.push_back({begin, end});
+		}
+
+		if (kind == Kind::Word || (kind == Kind::Punctuation && prev_kind != Kind::Punctuation)) {
+			t->word_stops[begin / 64] |= 1ull << (begin % 64);
+		}
+
+		prev_kind = kind;
+	});
+
+	text = t->text;
+	lines = t->lines;
+	cells = t->cells;
+	visual_order = t->visual_order;
+	words = t->words;
+	word_stops = t->word_stops;
+	mStorage = std::move(t);
+}
+
+Layout::Layout(
+	shared_ptr<const void> storage,
+	string_view text_,
+	const WidthContext& widths_,
+	span<const Line> lines_,
+	span<const Cell> cells_,
+	span<const uint32_t> visual_order_,
+	span<const Word> words_,
+	span<const uint64_t> word_stops_
+) :
+	text{text_},
+	widths{widths_},
+	lines{lines_},
+	cells{cells_},
+	visual_order{visual_order_},
+	words{words_},
+	word_stops{word_stops_},
+	mStorage{std::move(storage)} {}
+
+size_t Layout::cell_end(size_t i) const {
+	size_t end = i + 1 < cells.size() ? cells[i + 1].begin : text.size();
+	while (end > cells[i].begin + 1 && text[end - 1] == '\n') {
+		end--;
+	}
+
+	return end;
+}
+
+size_t Layout::visual_position_at_column(size_t i, size_t column) const {
+	size_t lo = lines[i].cells_begin, hi = lines[i].cells_end;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (cells[cell_at_visual_position(mid)].column < column) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+size_t Layout::line_of(size_t pos) const {
+	auto it = upper_bound(lines.begin(), lines.end(), pos, [](size_t pos, const Line& line) { return pos < line.begin; });
+	return it - lines.begin() - 1;
+}
+
+size_t Layout::column_of(size_t pos) const {
+	const Line& line = lines[line_of(pos)];
+	if (pos >= line.end) {
+		return line.end_column;
+	}
+
+	auto it = upper_bound(cells.begin() + line.cells_begin, cells.begin() + line.cells_end, pos, [](size_t pos, const Cell& cell) {
+		return pos < cell.begin;
+	});
+
+	return (it - 1)->column;
+}
+
+size_t Layout::cell_of(size_t pos) const {
+	if (pos >= text.size() || text[pos] == '\n') {
+		return cells.size();
+	}
+
+	auto it = upper_bound(cells.begin(), cells.end(), pos, [](size_t pos, const Cell& cell) { return pos < cell.begin; });
+	return it - cells.begin() - 1;
+}
+
+size_t Layout::prev_word_stop(size_t pos) const {
+	if (pos == 0) {
+		return 0;
+	}
+
+	size_t i = min(pos, text.size()) - 1;
+	size_t block = i / 64;
+	uint64_t bits = word_stops[block] & (~0ull >> (63 - i % 64));
+	while (bits == 0 && block > 0) {
+		bits = word_stops[--block];
+	}
+
+	return bits == 0 ? 0 : block * 64 + 63 - countl_zero(bits);
+}
+
+void add_line(LayoutTables& t, const WidthContext& widths, size_t begin, size_t end) {
+	Layout::Line line = {begin, end, t.cells.size(), t.cells.size(), 0, 0, false, false};
+
+	vector<BidiClass> classes;
+	bool has_rtl = false;
+	for (size_t pos = begin; pos < end;) {
+		size_t cluster_end = min(find_grapheme_cluster_end(t.text, pos), end);
+
+		string_view cluster = string_view{t.text}.substr(pos, cluster_end - pos);
+		uint32_t width = (uint32_t)widths.cluster_width(cluster);
+		t.cells.push_back({(uint32_t)pos, (uint32_t)line.width, width});
+		line.width += width;
+
+		classes.push_back(bidi_class(unilib::utf::decode(cluster)));
+		has_rtl |= classes.back() == BidiClass::R || classes.back() == BidiClass::AL || classes.back() == BidiClass::AN;
+
+		pos = cluster_end;
+	}
+
+	line.cells_end = t.cells.size();
+	line.end_column = line.width;
+
+	// Lines without right-to-left characters are displayed as is. Others are reordered and their cells' columns recomputed.
+	if (has_rtl) {
+		vector<uint8_t> levels;
+		line.is_rtl = resolve_bidi_levels(std::move(classes), levels) % 2 == 1;
+		line.is_reordered = true;
+
+		if (t.visual_order.empty()) {
+			t.visual_order.reserve(t.cells.capacity());
+			t.visual_order.resize(t.cells.size());
+			for (size_t i = 0; i < t.cells.size(); i++) {
+				t.visual_order[i] = (uint32_t)i;
+			}
+		} else {
+			t.visual_order.resize(t.cells.size());
+		}
+
+		vector<uint32_t> order = reorder_bidi_levels(levels);
+		uint32_t column = 0;
+		for (size_t i = 0; i < order.size(); i++) {
+			size_t cell = line.cells_begin + order[i];
+			t.visual_order[line.cells_begin + i] = (uint32_t)cell;
+			t.cells[cell].column = column;
+			column += t.cells[cell].width;
+		}
+
+		// Right-to-left lines end at their left edge, unless they end in left-to-right text, such as a number, which is shown
+		// at the left edge. Then the end is right after it.
+		if (line.is_rtl) {
+			const Layout::Cell& last = t.cells[line.cells_end - 1];
+			line.end_column = levels.back() % 2 == 0 ? last.column + last.width : 0;
+		}
+	} else if (!t.visual_order.empty()) {
+		for (size_t i = line.cells_begin; i < line.cells_end; i++) {
+			t.visual_order.push_back((uint32_t)i);
+		}
+	}
+
+	t.lines.push_back(line);
+}
+
+} // namespace ttt
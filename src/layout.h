@@ -0,0 +1,113 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+#pragma once
+
+#include "text.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ttt {
+
+class Hyphenator;
+
+// Marks a line break inside of a hyphenated word. Displayed as a hyphen and typed automatically.
+inline const std::string SOFT_HYPHEN = "\u00AD";
+inline const std::string SOFT_HYPHEN_BREAK = SOFT_HYPHEN + "\n";
+
+// Word-wraps `text` at `wrap_width` columns. If a `hyphenator` is given, words that do not fit onto a line are hyphenated.
+std::string wrap_text(const std::string& text, int wrap_width, const WidthContext& widths, const Hyphenator* hyphenator = nullptr);
+
+// Like `wrap_text`, but in place and a few paragraphs at a time, such that the memory needed beyond `text` is bounded by the
+// longest paragraph rather than by the size of the text.
+void wrap_text_in_place(std::string& text, int wrap_width, const WidthContext& widths, const Hyphenator* hyphenator = nullptr);
+
+// The target text along with everything about it that the typing loop needs to know. Computed once up front such that
+// queries while typing are cheap. The text and tables are immutable and shared by copies of the layout; they either belong to
+// it or to a file of the layout cache that is mapped into memory.
+struct Layout {
+	// A grapheme cluster of the target text and where it is displayed within its line
+	struct Cell {
+		uint32_t begin;  // Byte offset within `text`
+		uint32_t column; // Display column of the cell's left edge
+		uint32_t width;
+	};
+
+	struct Line {
+		size_t begin, end;             // Byte range within `text`, excluding the newline
+		size_t cells_begin, cells_end; // Range of `cells`
+		size_t width;
+		size_t end_column; // Display column of the line's end, i.e. of the cursor once the line was typed
+		bool is_rtl;       // Whether the line's base direction is right-to-left
+		bool is_reordered; // Whether the line contains right-to-left text and therefore has a non-trivial `visual_order`
+	};
+
+	struct Word {
+		size_t begin, end;
+	};
+
+	std::string_view text;
+	WidthContext widths;
+	std::span<const Line> lines;
+	std::span<const Cell> cells;
+
+	// Maps the visual position of each cell within its line to its logical index in `cells`. Only populated if at least one
+	// line needs reordering; otherwise, visual order equals logical order.
+	std::span<const uint32_t> visual_order;
+
+	// Byte ranges of the words of `text` as determined by UAX #29, i.e. segments containing letters or digits.
+	std::span<const Word> words;
+
+	// Bitset over the bytes of `text` marking the positions at which Ctrl+W stops: the beginnings of words and of runs of
+	// punctuation or symbols. Whitespace is deleted along with whatever precedes it.
+	std::span<const uint64_t> word_stops;
+
+	Layout(std::string text_, const WidthContext& widths_ = {});
+
+	// Wraps text and tables that were computed before, e.g. by an earlier run. `storage` keeps them alive.
+	Layout(
+		std::shared_ptr<const void> storage,
+		std::string_view text_,
+		const WidthContext& widths_,
+		std::span<const Line> lines_,
+		std::span<const Cell> cells_,
+		std::span<const uint32_t> visual_order_,
+		std::span<const Word> words_,
+		std::span<const uint64_t> word_stops_
+	);
+
+	std::string_view line_text(size_t i) const { return std::string_view{text}.substr(lines[i].begin, lines[i].end - lines[i].begin); }
+
+	// Cells never contain newlines, so a cell ends where the next one begins, minus any newlines in between.
+	size_t cell_end(size_t i) const;
+
+	size_t cell_at_visual_position(size_t i) const { return visual_order.empty() ? i : visual_order[i]; }
+
+	// Returns the first visual position within line `i` whose cell starts at or after `column`. Columns increase with the
+	// visual position, so this is a binary search.
+	size_t visual_position_at_column(size_t i, size_t column) const;
+
+	// Returns the index of the line that contains byte `pos`. The newline at the end of a line belongs to it.
+	size_t line_of(size_t pos) const;
+
+	// Returns the display column at which the character at byte `pos` is shown within its line or, if `pos` is the line's end,
+	// the column right after its last character.
+	size_t column_of(size_t pos) const;
+
+	// Returns the index of the cell that contains byte `pos`, or `cells.size()` if `pos` is a newline or the end of the text.
+	size_t cell_of(size_t pos) const;
+
+	// Returns the last position before `pos` at which Ctrl+W stops, or 0 if there is none.
+	size_t prev_word_stop(size_t pos) const;
+
+private:
+	std::shared_ptr<const void> mStorage;
+};
+
+} // namespace ttt
@@ -0,0 +1,413 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+#include "layout_cache.h"
+#include "unicode_tables.h"
+
+#include <unilib/version.h>
+
+#ifndef _WIN32
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace ttt {
+
+// Sets `a` and `b` to the low and high halves of their 128-bit product
+void multiply(uint64_t& a, uint64_t& b) {
+#ifdef __SIZEOF_INT128__
+	unsigned __int128 product = (unsigned __int128)a * b;
+	a = (uint64_t)product;
+	b = (uint64_t)(product >> 64);
+#else
+	uint64_t ha = a >> 32, la = (uint32_t)a, hb = b >> 32, lb = (uint32_t)b;
+	uint64_t hh = ha * hb, hl = ha * lb, lh = la * hb, ll = la * lb;
+	uint64_t mid = (ll >> 32) + (uint32_t)hl + (uint32_t)lh;
+	a = (mid << 32) | (uint32_t)ll;
+	b = hh + (hl >> 32) + (lh >> 32) + (mid >> 32);
+#endif
+}
+
+uint64_t mix(uint64_t a, uint64_t b) {
+	multiply(a, b);
+	return a ^ b;
+}
+
+uint64_t read64(const char* p) {
+	uint64_t result;
+	memcpy(&result, p, sizeof(result));
+	return result;
+}
+
+uint64_t read32(const char* p) {
+	uint32_t result;
+	memcpy(&result, p, sizeof(result));
+	return result;
+}
+
+uint64_t hash_bytes(string_view data, uint64_t seed) {
+	constexpr uint64_t SECRET[4] = {0xa0761d6478bd642f, 0xe7037ed1a0b428db, 0x8ebc6af09c88c6e3, 0x589965cc75374cc3};
+
+	const char* p = data.data();
+	size_t n = data.size();
+	seed ^= mix(seed ^ SECRET[0], SECRET[1]);
+
+	uint64_t a, b;
+	if (n <= 16) {
+		if (n >= 4) {
+			a = (read32(p) << 32) | read32(p + ((n >> 3) << 2));
+			b = (read32(p + n - 4) << 32) | read32(p + n - 4 - ((n >> 3) << 2));
+		} else if (n > 0) {
+			a = ((uint64_t)(uint8_t)p[0] << 16) | ((uint64_t)(uint8_t)p[n >> 1] << 8) | (uint8_t)p[n - 1];
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		size_t i = n;
+		if (i > 48) {
+			// Three independent lanes, such that the multiplications overlap
+			uint64_t lane1 = seed, lane2 = seed;
+			do {
+				seed = mix(read64(p) ^ SECRET[1], read64(p + 8) ^ seed);
+				lane1 = mix(read64(p + 16) ^ SECRET[2], read64(p + 24) ^ lane1);
+				lane2 = mix(read64(p + 32) ^ SECRET[3], read64(p + 40) ^ lane2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+
+			seed ^= lane1 ^ lane2;
+		}
+
+		for (; i > 16; i -= 16, p += 16) {
+			seed = mix(read64(p) ^ SECRET[1], read64(p + 8) ^ seed);
+		}
+
+		a = read64(p + i - 16);
+		b = read64(p + i - 8);
+	}
+
+	a ^= SECRET[1];
+	b ^= seed;
+	multiply(a, b);
+	return mix(a ^ SECRET[0] ^ n, b ^ SECRET[1]);
+}
+
+LayoutCacheKey layout_cache_key(string_view text, int wrap_width, string_view hyphenation_patterns, const WidthContext& widths) {
+	// Segmentation, bidi classes, and the widths of emoji and ambiguous characters come from the generated Unicode tables,
+	// normalization from unilib. Regenerating or updating either invalidates the layouts prepared before. Changes to ttt's own
+	// code, including the wcwidth it embeds, bump `LayoutFileHeader::VERSION` instead.
+	return {
+		hash_bytes(text),
+		text.size(),
+		hyphenation_patterns.empty() ? 0 : hash_bytes(hyphenation_patterns),
+		wrap_width,
+		(uint32_t)widths.tab_width,
+		widths.overrides,
+		hash_bytes(unilib::version::current().to_string(), UNICODE_TABLES_VERSION),
+	};
+}
+
+filesystem::path layout_cache_dir() {
+	if (const char* xdg_cache_home = getenv("XDG_CACHE_HOME"); xdg_cache_home && *xdg_cache_home) {
+		return filesystem::path{xdg_cache_home} / "ttt" / "layouts";
+	} else if (const char* home = getenv("HOME"); home && *home) {
+		return filesystem::path{home} / ".cache" / "ttt" / "layouts";
+	}
+
+	return {};
+}
+
+// The header of a layout file. It is followed by the sections it lists, each at an offset that is a multiple of 8 bytes, such
+// that the tables are aligned when the file is mapped into memory. All native-endian.
+struct LayoutFileHeader {
+	static constexpr uint32_t MAGIC = 0x4C545454; // "TTTL"
+
+	// Bump whenever the preparation or the layout of texts changes, lest layouts from before be loaded
+	static constexpr uint32_t VERSION = 3;
+
+	struct Section {
+		uint64_t offset, count;
+	};
+
+	uint32_t magic;
+	uint32_t version;
+
+	// Sizes of the structs that the tables are made of, which differ between platforms
+	uint32_t line_size, cell_size, word_size, header_size;
+
+	LayoutCacheKey key;
+	Section text, lines, cells, visual_order, words, word_stops;
+};
+
+size_t align8(size_t offset) { return (offset + 7) & ~(size_t)7; }
+
+// Returns the elements of `section` within the `size` bytes at `data`, or nothing if they lie outside of them
+template <typename T> optional<span<const T>> section_of(const char* data, size_t size, const LayoutFileHeader::Section& section) {
+	if (section.offset % 8 != 0 || section.offset > size || section.count > (size - section.offset) / sizeof(T)) {
+		return nullopt;
+	}
+
+	return span<const T>{(const T*)(data + section.offset), (size_t)section.count};
+}
+
+// Whether the tables refer only to what lies within them and the text, such that a corrupt file cannot make the layout read
+// out of bounds. Lines must cover the text, separated by newlines, and each hold the cells of its grapheme clusters in order.
+bool is_consistent(
+	span<const char> text,
+	span<const Layout::Line> lines,
+	span<const Layout::Cell> cells,
+	span<const uint32_t> visual_order,
+	span<const Layout::Word> words
+) {
+	size_t begin = 0, cells_begin = 0;
+	for (const auto& line : lines) {
+		if (line.begin != begin || line.end < line.begin || line.end > text.size() || line.cells_begin != cells_begin ||
+			line.cells_end < line.cells_begin || line.cells_end > cells.size() || line.end_column > line.width ||
+			(line.is_reordered && visual_order.empty())) {
+			return false;
+		}
+
+		for (size_t i = line.cells_begin; i < line.cells_end; i++) {
+			const auto& cell = cells[i];
+			bool is_in_order = i == line.cells_begin ? cell.begin == line.begin : cell.begin > cells[i - 1].begin;
+			if (!is_in_order || cell.begin >= line.end || (uint64_t)cell.column + cell.width > line.width) {
+				return false;
+			}
+
+			if (!visual_order.empty() && (visual_order[i] < line.cells_begin || visual_order[i] >= line.cells_end)) {
+				return false;
+			}
+		}
+
+		// All but the last line end at a newline
+		bool is_last = &line == &lines.back();
+		if (is_last ? line.end != text.size() : line.end == text.size() || text[line.end] != '\n') {
+			return false;
+		}
+
+		begin = line.end + 1;
+		cells_begin = line.cells_end;
+	}
+
+	if (cells_begin != cells.size()) {
+		return false;
+	}
+
+	size_t prev_end = 0;
+	for (const auto& word : words) {
+		if (word.begin < prev_end || word.end <= word.begin || word.end > text.size()) {
+			return false;
+		}
+
+		prev_end = word.end;
+	}
+
+	return true;
+}
+
+LayoutCache::LayoutCache(filesystem::path dir, uint64_t max_size) : mDir{std::move(dir)}, mMaxSize{max_size} {}
+
+filesystem::path LayoutCache::path(const LayoutCacheKey& key) const {
+	const auto& o = key.overrides;
+	int64_t fields[] = {
+		(int64_t)key.text_hash,
+		(int64_t)key.text_size,
+		(int64_t)key.hyphenation_hash,
+		key.wrap_width,
+		key.tab_width,
+		o.ambiguous,
+		o.emoji,
+		o.emoji_vs16,
+		o.emoji_zwj,
+		o.emoji_flag,
+		o.emoji_modifier,
+		(int64_t)key.unicode_hash,
+	};
+
+	return mDir / format("{:016x}.layout", hash_bytes({(const char*)fields, sizeof(fields)}));
+}
+
+optional<Layout> LayoutCache::load(const LayoutCacheKey& key, const WidthContext& widths) const {
+	auto file = path(key);
+
+	// The storage of the layout is the file's mapping or, where files cannot be mapped, a copy of it
+#ifdef _WIN32
+	error_code ec;
+	size_t size = filesystem::file_size(file, ec);
+	if (ec || size < sizeof(LayoutFileHeader)) {
+		return nullopt;
+	}
+
+	auto buffer = make_shared<vector<uint64_t>>((size + 7) / 8);
+	if (!ifstream{file, ios::binary}.read((char*)buffer->data(), size)) {
+		return nullopt;
+	}
+
+	shared_ptr<const void> storage{buffer, buffer->data()};
+#else
+	int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return nullopt;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(LayoutFileHeader)) {
+		close(fd);
+		return nullopt;
+	}
+
+	size_t size = st.st_size;
+	void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		return nullopt;
+	}
+
+	shared_ptr<const void> storage{mapping, [size](const void* mapping) { munmap(const_cast<void*>(mapping), size); }};
+#endif
+
+	const char* data = (const char*)storage.get();
+	LayoutFileHeader header;
+	memcpy(&header, data, sizeof(header));
+	if (header.magic != LayoutFileHeader::MAGIC || header.version != LayoutFileHeader::VERSION ||
+		header.line_size != sizeof(Layout::Line) || header.cell_size != sizeof(Layout::Cell) || header.word_size != sizeof(Layout::Word) ||
+		header.header_size != sizeof(LayoutFileHeader) || header.key != key) {
+		return nullopt;
+	}
+
+	auto text = section_of<char>(data, size, header.text);
+	auto lines = section_of<Layout::Line>(data, size, header.lines);
+	auto cells = section_of<Layout::Cell>(data, size, header.cells);
+	auto visual_order = section_of<uint32_t>(data, size, header.visual_order);
+	auto words = section_of<Layout::Word>(data, size, header.words);
+	auto word_stops = section_of<uint64_t>(data, size, header.word_stops);
+	if (!text || !lines || !cells || !visual_order || !words || !word_stops || lines->empty() ||
+		word_stops->size() != (text->size() + 63) / 64 || (!visual_order->empty() && visual_order->size() != cells->size()) ||
+		!is_consistent(*text, *lines, *cells, *visual_order, *words)) {
+		return nullopt;
+	}
+
+	// Marks the file as recently used, such that it is evicted last
+	error_code ec;
+	filesystem::last_write_time(file, filesystem::file_time_type::clock::now(), ec);
+
+	return Layout{
+		std::move(storage), string_view{text->data(), text->size()}, widths, *lines, *cells, *visual_order, *words, *word_stops,
+	};
+}
+
+void LayoutCache::store(const LayoutCacheKey& key, const Layout& layout) const {
+	filesystem::create_directories(mDir);
+
+	LayoutFileHeader header = {};
+	header.magic = LayoutFileHeader::MAGIC;
+	header.version = LayoutFileHeader::VERSION;
+	header.line_size = sizeof(Layout::Line);
+	header.cell_size = sizeof(Layout::Cell);
+	header.word_size = sizeof(Layout::Word);
+	header.header_size = sizeof(LayoutFileHeader);
+	header.key = key;
+
+	size_t offset = align8(sizeof(header));
+	auto place = [&](LayoutFileHeader::Section& section, size_t count, size_t element_size) {
+		section = {offset, count};
+		offset = align8(offset + count * element_size);
+	};
+
+	place(header.text, layout.text.size(), 1);
+	place(header.lines, layout.lines.size(), sizeof(Layout::Line));
+	place(header.cells, layout.cells.size(), sizeof(Layout::Cell));
+	place(header.visual_order, layout.visual_order.size(), sizeof(uint32_t));
+	place(header.words, layout.words.size(), sizeof(Layout::Word));
+	place(header.word_stops, layout.word_stops.size(), sizeof(uint64_t));
+
+	// Written next to its final path and then renamed, such that other processes never see a partial file
+	auto file = path(key);
+	auto tmp_file = file;
+	tmp_file += format(".{:08x}.tmp", random_device{}());
+
+	{
+		ofstream out{tmp_file, ios::binary};
+		size_t written = 0;
+		auto write = [&](const LayoutFileHeader::Section& section, const void* data, size_t size) {
+			static const char padding[8] = {};
+			out.write(padding, section.offset - written);
+			out.write((const char*)data, size);
+			written = section.offset + size;
+		};
+
+		out.write((const char*)&header, sizeof(header));
+		written = sizeof(header);
+		write(header.text, layout.text.data(), layout.text.size());
+		write(header.lines, layout.lines.data(), layout.lines.size_bytes());
+		write(header.cells, layout.cells.data(), layout.cells.size_bytes());
+		write(header.visual_order, layout.visual_order.data(), layout.visual_order.size_bytes());
+		write(header.words, layout.words.data(), layout.words.size_bytes());
+		write(header.word_stops, layout.word_stops.data(), layout.word_stops.size_bytes());
+
+		if (!out.flush()) {
+			out.close();
+			error_code ec;
+			filesystem::remove(tmp_file, ec);
+			throw runtime_error{format("Could not write {}", file.string())};
+		}
+	}
+
+	filesystem::rename(tmp_file, file);
+	evict(file);
+}
+
+void LayoutCache::evict(const filesystem::path& keep) const {
+	struct Entry {
+		filesystem::file_time_type time;
+		uint64_t size;
+		filesystem::path path;
+	};
+
+	vector<Entry> entries;
+	uint64_t total_size = 0;
+
+	error_code ec;
+	for (const auto& entry : filesystem::directory_iterator{mDir, ec}) {
+		if (entry.path().extension() != ".layout") {
+			continue;
+		}
+
+		uint64_t size = entry.file_size(ec);
+		auto time = entry.last_write_time(ec);
+		if (!ec) {
+			entries.push_back({time, size, entry.path()});
+			total_size += size;
+		}
+	}
+
+	sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.time < b.time; });
+	for (const auto& entry : entries) {
+		if (total_size <= mMaxSize) {
+			break;
+		}
+
+		if (entry.path != keep && filesystem::remove(entry.path, ec)) {
+			total_size -= entry.size;
+		}
+	}
+}
+
+} // namespace ttt
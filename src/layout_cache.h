@@ -0,0 +1,67 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+// Cache of prepared texts and their layouts in $XDG_CACHE_HOME/ttt/layouts/<key>.layout, such that typing the same large text
+// again skips normalizing, wrapping, and laying it out. Each file holds a header followed by the text and the tables of its
+// layout in the native byte order and struct layout, such that it can be mapped into memory and used as is.
+
+#pragma once
+
+#include "layout.h"
+#include "text.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string_view>
+
+namespace ttt {
+
+// Fast non-cryptographic 64-bit hash in the manner of wyhash, which consumes 48 bytes per iteration
+uint64_t hash_bytes(std::string_view data, uint64_t seed = 0);
+
+// Everything that the prepared text and its layout depend on: the text as it was given, before normalization, and how it was
+// wrapped and measured
+struct LayoutCacheKey {
+	uint64_t text_hash;
+	uint64_t text_size;
+	uint64_t hyphenation_hash; // Of the compiled hyphenation patterns, or 0 if words are not hyphenated
+	int32_t wrap_width;
+	uint32_t tab_width;
+	WidthOverrides overrides;
+	uint64_t unicode_hash; // Of the versions of ttt's Unicode tables and of unilib, which normalizes
+
+	bool operator==(const LayoutCacheKey&) const = default;
+};
+
+// `hyphenation_patterns` are the compiled patterns that words are hyphenated with, or empty if they are not hyphenated.
+LayoutCacheKey layout_cache_key(
+	std::string_view text, int wrap_width, std::string_view hyphenation_patterns, const WidthContext& widths
+);
+
+// $XDG_CACHE_HOME/ttt/layouts, falling back to ~/.cache/ttt/layouts, or an empty path if neither is set
+std::filesystem::path layout_cache_dir();
+
+class LayoutCache {
+public:
+	// Once the files in `dir` exceed `max_size` bytes in total, the least recently used ones are removed.
+	LayoutCache(std::filesystem::path dir, uint64_t max_size = 4ull << 30);
+
+	// Maps the file of `key` into memory, if there is a valid one, and returns its layout. The tables are checked to refer only
+	// to what lies within the file, such that a corrupt file is ignored rather than read out of bounds; this takes a pass over
+	// the lines, cells, and words, but not the hashing of the text.
+	std::optional<Layout> load(const LayoutCacheKey& key, const WidthContext& widths) const;
+
+	// Writes `layout` to the file of `key`. Throws `std::runtime_error` if it cannot be written.
+	void store(const LayoutCacheKey& key, const Layout& layout) const;
+
+private:
+	std::filesystem::path path(const LayoutCacheKey& key) const;
+	void evict(const std::filesystem::path& keep) const;
+
+	std::filesystem::path mDir;
+	uint64_t mMaxSize;
+};
+
+} // namespace ttt
@@ -1,25 +1,43 @@
 // This file was developed by Thomas Müller <contact@tom94.net>.
 // It is published under the GPLv3 License; see the LICENSE file.
 
-#include <cmrc/cmrc.hpp>
-
-#include <json/json.hpp>
-
-#include <unilib/uninorms.h>
-#include <unilib/utf.h>
+#include "histogram.h"
+#include "history.h"
+#include "keyboard.h"
+#include "layout_cache.h"
+#include "probe.h"
+#include "session.h"
+#include "tests.h"
+#include "text.h"
+
+#ifdef TTT_NETWORKING
+#	include "daemon.h"
+#	include "race.h"
+#	include "spectate.h"
+#endif
 
-#include <wcwidth/wcwidth.h>
+#ifdef TTT_SHARED_STATS
+#	include "shared_stats.h"
+#endif
 
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cctype>
 #include <chrono>
+#include <cstdlib>
 #include <cstring>
+#include <filesystem>
 #include <format>
+#include <fstream>
 #include <iostream>
 #include <iterator>
-#include <random>
+#include <limits>
+#include <optional>
 #include <set>
-#include <sstream>
+#include <streambuf>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <wchar.h>
 
@@ -30,22 +48,16 @@
 #	undef NOMINMAX
 #else
 #	include <fcntl.h>
+#	include <poll.h>
 #	include <sys/ioctl.h>
 #	include <termios.h>
 #	include <unistd.h>
 #endif
 
 using namespace std;
-using namespace nlohmann;
-
-CMRC_DECLARE(ttt);
 
 namespace ttt {
 
-auto g_fs = cmrc::ttt::get_filesystem();
-
-size_t g_tab_width = 4;
-
 template <typename T> class ScopeGuard {
 public:
 	ScopeGuard(const T& callback) : mCallback{callback} {}
@@ -63,288 +75,261 @@ private:
 	T mCallback;
 };
 
-template <typename T> std::string join(const T& components, const std::string& delim) {
-	std::ostringstream s;
-	for (const auto& component : components) {
-		if (&components[0] != &component) {
-			s << delim;
-		}
-		s << component;
-	}
+const string ANSI_SAVE_CURSOR = "\033[s";
+const string ANSI_RESTORE_CURSOR = "\033[u";
+const string ANSI_GRAY = "\033[38;5;243m";
+const string ANSI_RESET = "\033[0m";
+const string ANSI_CORRECT = "\033[0m";
+const string ANSI_INCORRECT = "\033[38;5;9m";
+const string ANSI_INCORRECT_WHITESPACE = "\033[41m";
+const string ANSI_GHOST = "\033[48;5;238m";
+const string ANSI_CLEAR_LINE = "\r\033[2K";
+const string ANSI_MOVE_CURSOR_TO_BEGINNING_OF_LINE = "\r\033[G";
+const string ANSI_BIDI_EXPLICIT = "\033[8l";
+const string ANSI_BIDI_IMPLICIT = "\033[8h";
+const string ANSI_ENTER_ALTERNATE_SCREEN = "\033[?1049h";
+const string ANSI_EXIT_ALTERNATE_SCREEN = "\033[?1049l";
+const string ANSI_HIDE_CURSOR = "\033[?25l";
+const string ANSI_SHOW_CURSOR = "\033[?25h";
+const string ANSI_REQUEST_CURSOR_POSITION = "\033[6n";
+const string ANSI_REQUEST_DEVICE_ATTRIBUTES = "\033[c";
 
-	return s.str();
-}
+// Interval at which ghost carets are redrawn
+const int GHOST_TICK_MS = 16;
 
-vector<string> split(string text, const string& delim) {
-	vector<string> result;
-	size_t begin = 0;
-	while (true) {
-		size_t end = text.find_first_of(delim, begin);
-		if (end == string::npos) {
-			result.emplace_back(text.substr(begin));
-			return result;
-		} else {
-			result.emplace_back(text.substr(begin, end - begin));
-			begin = end + 1;
-		}
-	}
+// An Esc that is not followed by the rest of a terminal reply within this time was typed by the user
+const int ESC_TIMEOUT_MS = 50;
 
-	return result;
-}
+// Replies that are still outstanding when the test ends are awaited this long, lest they end up in the shell
+const int PROBE_DRAIN_MS = 250;
 
-// Returns the number of bytes in a UTF-8 character based on its first byte
-int utf8_char_length(unsigned char first_byte) {
-	if ((first_byte & 0x80) == 0) {
-		return 1;
-	}
+// Minimum interval between redraws of the debug overlay
+const int OVERLAY_INTERVAL_MS = 250;
 
-	if ((first_byte & 0xE0) == 0xC0) {
-		return 2;
-	}
+string move_cursor_up(int n) { return std::format("\033[{}A", n); }
+string move_cursor_down(int n) { return std::format("\033[{}B", n); }
+string move_cursor_right(int n) { return std::format("\033[{}C", n); }
+string move_cursor_left(int n) { return std::format("\033[{}D", n); }
 
-	if ((first_byte & 0xF0) == 0xE0) {
-		return 3;
+// Returns what to print for the grapheme cluster `cluster` that occupies `width` columns.
+string display_cell(string_view cluster, size_t width) {
+	if (cluster == "\t") {
+		return string(width, ' ');
 	}
 
-	if ((first_byte & 0xF8) == 0xF0) {
-		return 4;
+	if (cluster == SOFT_HYPHEN) {
+		return "-";
 	}
 
-	return 1; // Invalid UTF-8 byte, treat as single byte
+	return string{cluster};
 }
 
-// Check if this byte is a continuation byte in UTF-8
-bool is_utf8_continuation(unsigned char byte) { return (byte & 0xC0) == 0x80; }
+// The window of columns that is displayed of each line. The terminal would soft-wrap lines that are wider than it, which
+// breaks relative cursor movement, so such lines are scrolled horizontally to keep the cursor in view instead.
+struct Viewport {
+	size_t width;
+	vector<size_t> scroll; // First displayed column of each line
 
-// Check if this byte starts a combining character
-bool is_combining_char(const string& str, size_t pos) {
-	if (pos >= str.length()) {
-		return false;
-	}
+	Viewport(const Layout& layout, size_t width_) : width{width_ == 0 ? numeric_limits<uint32_t>::max() : width_}, scroll(layout.lines.size(), 0) {}
 
-	wchar_t wc;
-	char buf[8] = {0};
-	int len = utf8_char_length(str[pos]);
-	strncpy(buf, &str[pos], len);
-	mbtowc(&wc, buf, len);
+	// Scrolls line `i` such that `column` is visible, jumping by a quarter of the width at a time to avoid scrolling on every
+	// keystroke. Returns whether the scroll position changed.
+	bool scroll_to(const Layout& layout, size_t i, size_t column) {
+		size_t line_width = layout.lines[i].width;
+		if (line_width <= width) {
+			return false;
+		}
 
-	// Unicode ranges for combining characters
-	return (wc >= 0x0300 && wc <= 0x036F) || // Combining Diacritical Marks
-		(wc >= 0x1AB0 && wc <= 0x1AFF) ||    // Combining Diacritical Marks Extended
-		(wc >= 0x1DC0 && wc <= 0x1DFF) ||    // Combining Diacritical Marks Supplement
-		(wc >= 0x20D0 && wc <= 0x20FF) ||    // Combining Diacritical Marks for Symbols
-		(wc >= 0xFE20 && wc <= 0xFE2F);      // Combining Half Marks
-}
+		size_t margin = width / 4;
+		size_t prev = scroll[i];
+		if (column < scroll[i]) {
+			scroll[i] = column > margin ? column - margin : 0;
+		} else if (column >= scroll[i] + width) {
+			scroll[i] = min(column + margin + 1 - width, line_width + 1 - width);
+		}
 
-// Find the end of the current grapheme cluster
-size_t find_grapheme_cluster_end(const string& str, size_t start) {
-	if (start >= str.length()) {
-		return start;
+		return scroll[i] != prev;
 	}
+};
 
-	size_t pos = start;
-	pos += utf8_char_length(str[pos]);
-
-	// Include any following combining characters
-	while (pos < str.length() && is_combining_char(str, pos)) {
-		pos += utf8_char_length(str[pos]);
-	}
+// Prints cell `cell_index` of the target text, colored according to whether the user typed it correctly. Cells covered by a
+// ghost caret are highlighted.
+void draw_cell(const Layout& layout, size_t cell_index, const string& user_input, const vector<uint16_t>& ghost_cells) {
+	const auto& cell = layout.cells[cell_index];
+	size_t begin = cell.begin, end = layout.cell_end(cell_index);
+	string_view target_cluster = string_view{layout.text}.substr(begin, end - begin);
+	string_view ghost = !ghost_cells.empty() && ghost_cells[cell_index] > 0 ? string_view{ANSI_GHOST} : "";
+
+	// Characters that have not been (fully) typed yet are shown in gray.
+	if (user_input.size() <= begin || (user_input.size() < end && target_cluster.starts_with(string_view{user_input}.substr(begin)))) {
+		cout << ANSI_GRAY << ghost << display_cell(target_cluster, cell.width) << ANSI_RESET;
+	} else if (user_input.compare(begin, end - begin, target_cluster) == 0) {
+		cout << ANSI_CORRECT << ghost << display_cell(target_cluster, cell.width) << ANSI_RESET;
+	} else {
+		// Show what the user typed instead, unless that would shift the remainder of the line.
+		string_view user_cluster = target_cluster;
+		if (!is_utf8_continuation(user_input[begin])) {
+			size_t user_end = find_grapheme_cluster_end(user_input, begin);
+			string_view candidate = string_view{user_input}.substr(begin, user_end - begin);
+			if (layout.widths.cluster_width(candidate) == cell.width) {
+				user_cluster = candidate;
+			}
+		}
 
-	// Check for emoji sequences
-	if (pos < str.length()) {
-		using byte = unsigned char;
-		byte next = str[pos];
-		// Check for emoji modifiers, ZWJ sequences, etc.
-		if ((next == 0xF0 && pos + 3 < str.length()) ||                                                             // Emoji
-			(next == 0xE2 && pos + 2 < str.length() && (byte)str[pos + 1] == 0x80 && (byte)str[pos + 2] == 0x8D)) { // ZWJ
-			return find_grapheme_cluster_end(str, pos);
+		if (isspace(user_input[begin])) {
+			cout << ANSI_INCORRECT_WHITESPACE << ghost << display_cell(user_cluster, cell.width) << ANSI_RESET;
+		} else {
+			cout << ANSI_INCORRECT << ghost << display_cell(user_cluster, cell.width) << ANSI_RESET;
 		}
 	}
-
-	return pos;
 }
 
-// Get the display width of a UTF-8 character
-int get_char_width(const string& str, size_t pos) {
-	if (pos >= str.length()) {
-		return 0;
-	}
+// Redraws the visible part of line `i` of the target text. Only the cells within the viewport are visited, so the cost does
+// not depend on the length of the line.
+void draw_line(const Layout& layout, const Viewport& viewport, size_t i, const string& user_input, const vector<uint16_t>& ghost_cells) {
+	const auto& line = layout.lines[i];
+	cout << ANSI_CLEAR_LINE;
+
+	size_t left = viewport.scroll[i], right = left + viewport.width;
+	size_t column = left;
+	for (size_t v = layout.visual_position_at_column(i, left); v < line.cells_end; v++) {
+		size_t cell_index = layout.cell_at_visual_position(v);
+		const auto& cell = layout.cells[cell_index];
+		if (cell.column + cell.width > right) {
+			break;
+		}
 
-	if (is_utf8_continuation(str[pos])) {
-		return 1;
-	}
+		// Leave room for a wide cell that is cut off by the left edge.
+		if (cell.column > column) {
+			cout << string(cell.column - column, ' ');
+		}
 
-	// Tab width
-	if (str[pos] == '\t') {
-		return g_tab_width;
+		column = cell.column + cell.width;
+		draw_cell(layout, cell_index, user_input, ghost_cells);
 	}
+}
 
-	// Convert the UTF-8 character to a wide character
-	wchar_t wc;
-	char buf[8] = {0};
-	int len = utf8_char_length(str[pos]);
-	strncpy(buf, &str[pos], len);
-	mbtowc(&wc, buf, len);
+// Moves the cursor from the beginning of the displayed text to where the character at byte `pos` is shown.
+void move_cursor(const Layout& layout, const Viewport& viewport, size_t pos) {
+	cout << ANSI_RESTORE_CURSOR;
 
-	if (wc >= 0x1F300) {
-		// Unicode range for emojis and other symbols
-		return 2;
+	size_t line = layout.line_of(min(pos, layout.text.size()));
+	if (line > 0) {
+		cout << move_cursor_down(line);
 	}
 
-	int width = mk_wcwidth(wc);
-	return width >= 0 ? width : 1;
+	size_t column = layout.column_of(pos) - viewport.scroll[line];
+	if (column > 0) {
+		cout << move_cursor_right(column);
+	}
 }
 
-// Get the next UTF-8 character position
-size_t next_char_pos(const string& str, size_t pos) {
-	if (pos >= str.length()) {
-		return str.length();
+// Redraws cell `cell_index` in place, provided that it is within the viewport.
+void redraw_cell(const Layout& layout, const Viewport& viewport, size_t cell_index, const string& user_input, const vector<uint16_t>& ghost_cells) {
+	const auto& cell = layout.cells[cell_index];
+	size_t line = layout.line_of(cell.begin);
+	size_t left = viewport.scroll[line];
+	if (cell.column < left || cell.column + cell.width > left + viewport.width) {
+		return;
 	}
 
-	return pos + utf8_char_length(str[pos]);
-}
-
-// Get the previous UTF-8 character position
-size_t prev_char_pos(const string& str, size_t pos) {
-	if (pos <= 0) {
-		return 0;
+	cout << ANSI_RESTORE_CURSOR;
+	if (line > 0) {
+		cout << move_cursor_down(line);
 	}
 
-	size_t prev = pos - 1;
-	while (prev > 0 && (str[prev] & 0xC0) == 0x80) {
-		prev--;
+	if (cell.column > left) {
+		cout << move_cursor_right(cell.column - left);
 	}
 
-	return prev;
+	draw_cell(layout, cell_index, user_input, ghost_cells);
 }
 
-const string ANSI_SAVE_CURSOR = "\033[s";
-const string ANSI_RESTORE_CURSOR = "\033[u";
-const string ANSI_GRAY = "\033[38;5;243m";
-const string ANSI_RESET = "\033[0m";
-const string ANSI_CORRECT = "\033[0m";
-const string ANSI_INCORRECT = "\033[38;5;9m";
-const string ANSI_INCORRECT_WHITESPACE = "\033[41m";
-const string ANSI_CLEAR_LINE = "\r\033[2K";
-const string ANSI_MOVE_CURSOR_TO_BEGINNING_OF_LINE = "\r\033[G";
-
-string move_cursor_up(int n) { return std::format("\033[{}A", n); }
-string move_cursor_down(int n) { return std::format("\033[{}B", n); }
-string move_cursor_right(int n) { return std::format("\033[{}C", n); }
-string move_cursor_left(int n) { return std::format("\033[{}D", n); }
-
-string display_char(const string& str, size_t pos, bool leading = false) {
-	if (pos >= str.length()) {
-		return "";
-	}
+#ifdef TTT_NETWORKING
+// Draws the standings of a race in a single line: the leaders and, wherever we are, ourselves.
+void draw_race_status(const RaceClient& race, size_t width) {
+	cout << ANSI_CLEAR_LINE;
 
-	if (leading && str[pos] == '\t') {
-		return "    ";
-	}
+	auto standings = race.standings();
+	string status = format("Race ({} racers):", standings.size());
+	for (size_t i = 0; i < standings.size(); i++) {
+		uint32_t id = standings[i];
+		if (i >= 3 && id != race.id()) {
+			continue;
+		}
 
-	// Skip if we're in the middle of a UTF-8 character
-	if (is_utf8_continuation(str[pos])) {
-		return "";
+		const RaceProgress& progress = race.racers().at(id);
+		status += format(
+			"  {}. {} {}",
+			i + 1,
+			id == race.id() ? "you" : format("#{}", id),
+			progress.complete() ? "done" : format("{}%", progress.progress * 100 / RaceProgress::COMPLETE)
+		);
 	}
 
-	int len = utf8_char_length(str[pos]);
-	return str.substr(pos, len);
+	cout << status.substr(0, width);
 }
+#endif
 
-string nfd(const string& str) {
-	u32string decoded;
-	unilib::utf::decode(str.c_str(), decoded);
-	unilib::uninorms::nfd(decoded);
-	string result;
-	unilib::utf::encode(decoded, result);
-	return result;
-}
+// Forwards output to another stream buffer while counting the bytes that pass through, such that the size of each frame is
+// known without buffering it separately.
+class CountingStreambuf : public streambuf {
+public:
+	CountingStreambuf(streambuf* target) : mTarget{target} {}
 
-size_t draw_state(const vector<string>& target_lines, string user_input) {
-	user_input = nfd(user_input);
-
-	// Compute cumulative offsets for each line within the displayed block.
-	vector<size_t> offsets(target_lines.size());
-	size_t cum = 0;
-	for (size_t i = 0; i < target_lines.size(); i++) {
-		offsets[i] = cum;
-		cum += target_lines[i].size() + 1; // +1 for the newline
-	}
-
-	// Update each displayed line without clearing the entire screen.
-	for (size_t i = 0; i < target_lines.size(); i++) {
-		// Compute leading whitespace count for the current line.
-		int indent = 0;
-		while (indent < (int)target_lines[i].size() && (target_lines[i][indent] == ' ' || target_lines[i][indent] == '\t')) {
-			indent++;
-		}
-
-		cout << ANSI_CLEAR_LINE;
-		int line_start = offsets[i];
-		int line_end = offsets[i] + target_lines[i].size();
-		for (int j = line_start; j < line_end;) {
-			int local_j = j - offsets[i];
-			bool is_leading = (local_j < indent);
-			if (j < (int)user_input.size()) {
-				string target_char = display_char(target_lines[i], local_j, is_leading);
-				string user_char = display_char(user_input, j, is_leading);
-
-				if (!target_char.empty()) { // Only process if it's a valid character start
-					if (user_char == target_char) {
-						cout << ANSI_CORRECT << target_char << ANSI_RESET;
-					} else {
-						if (isspace(user_input[j])) {
-							cout << ANSI_INCORRECT_WHITESPACE << user_char << ANSI_RESET;
-						} else {
-							cout << ANSI_INCORRECT << user_char << ANSI_RESET;
-						}
-					}
-				}
-			} else if (!is_utf8_continuation(target_lines[i][local_j])) {
-				cout << ANSI_GRAY << display_char(target_lines[i], local_j, is_leading) << ANSI_RESET;
-			}
+	streambuf* target() const { return mTarget; }
+	size_t count() const { return mCount; }
 
-			// Move to the next character
-			if (is_utf8_continuation(target_lines[i][local_j])) {
-				j++; // Skip continuation bytes
-			} else {
-				j += utf8_char_length(target_lines[i][local_j]);
-			}
+protected:
+	int_type overflow(int_type c) override {
+		if (traits_type::eq_int_type(c, traits_type::eof())) {
+			return traits_type::not_eof(c);
 		}
 
-		if (i < target_lines.size() - 1) {
-			cout << "\n";
-		}
+		++mCount;
+		return mTarget->sputc(traits_type::to_char_type(c));
 	}
 
-	size_t total_expected = offsets.back() + target_lines.back().size();
-	return total_expected;
-}
-
-void move_cursor(const string& user_input) {
-	// Determine the cursor's current row and column based on userInput (accounting for tab width).
-	int current_line = 0, current_col = 0;
-	size_t pos = 0;
-	while (pos < user_input.length()) {
-		if (user_input[pos] == '\n') {
-			++current_line;
-			current_col = 0;
-			pos++;
-		} else {
-			current_col += get_char_width(user_input, pos);
-			pos = next_char_pos(user_input, pos);
-		}
+	streamsize xsputn(const char* s, streamsize n) override {
+		mCount += n;
+		return mTarget->sputn(s, n);
 	}
 
-	if (current_line > 0) {
-		cout << move_cursor_down(current_line);
-	}
+	int sync() override { return mTarget->pubsync(); }
 
-	if (current_col > 0) {
-		cout << move_cursor_right(current_col);
-	}
+private:
+	streambuf* mTarget;
+	size_t mCount = 0;
+};
 
-	cout.flush();
+// Statistics of the frames that keystrokes caused, shown by --debug-overlay
+struct DebugOverlay {
+	LogHistogram latency_ns; // From reading a keystroke until the frame it caused was written
+	LogHistogram frame_bytes;
+
+	CountingStreambuf output{cout.rdbuf()};
+	TypingSession::Clock::time_point drawn_at;
+	bool dirty = false;
+};
+
+string format_duration_ns(uint64_t ns) { return ns < 10'000'000 ? format("{}us", ns / 1000) : format("{}ms", ns / 1'000'000); }
+
+// Draws the overlay's statistics into the top right corner of the screen. Callers move the cursor back afterwards.
+void draw_debug_overlay(const DebugOverlay& overlay, size_t width) {
+	const auto& latency = overlay.latency_ns;
+	const auto& bytes = overlay.frame_bytes;
+	string text = format(
+		" latency p50 {} p99 {} max {} | frame p50 {}B p99 {}B max {}B ",
+		format_duration_ns(latency.percentile(0.5)),
+		format_duration_ns(latency.percentile(0.99)),
+		format_duration_ns(latency.max()),
+		bytes.percentile(0.5),
+		bytes.percentile(0.99),
+		bytes.max()
+	);
+
+	text = text.substr(0, width);
+	cout << format("\033[1;{}H", width - text.size() + 1) << ANSI_GHOST << text << ANSI_RESET;
 }
 
 // Helper class to ensure terminal settings are restored on exit.
@@ -375,6 +360,7 @@ struct TerminalSettings {
 	int fd;
 	struct termios orig;
 	bool restored;
+	bool kitty_keyboard = false; // Whether the kitty keyboard protocol was enabled and must be disabled again
 	TerminalSettings(int fd_in) : fd{fd_in}, restored{false} {
 		tcgetattr(fd, &orig);
 
@@ -386,6 +372,12 @@ struct TerminalSettings {
 	~TerminalSettings() { restore(); }
 	void restore() {
 		if (!restored) {
+			// Flushing the input discards key releases that arrived before the terminal left kitty keyboard mode.
+			if (kitty_keyboard) {
+				cout << KITTY_KEYBOARD_POP;
+				cout.flush();
+			}
+
 			tcsetattr(fd, TCSAFLUSH, &orig);
 			restored = true;
 		}
@@ -393,142 +385,182 @@ struct TerminalSettings {
 };
 #endif
 
-string wrap_text(const string& text, int wrap_width) {
-	if (wrap_width <= 0) {
-		return text;
-	}
+// Characters whose width varies between terminals, one per field of `WidthOverrides`
+struct WidthProbe {
+	const char* name;
+	const char* sample;
+	int WidthOverrides::*width;
+};
 
-	string wrapped;
-	size_t start = 0;
-	while (start < text.size()) {
-		size_t newline_pos = text.find('\n', start);
-		string paragraph;
-		if (newline_pos == string::npos) {
-			paragraph = text.substr(start);
-			start = text.size();
-		} else {
-			paragraph = text.substr(start, newline_pos - start);
-			start = newline_pos + 1;
+const WidthProbe WIDTH_PROBES[] = {
+	{"ambiguous", "\u00B1", &WidthOverrides::ambiguous},
+	{"emoji", "\U0001F600", &WidthOverrides::emoji},
+	{"emoji_vs16", "\u2764\uFE0F", &WidthOverrides::emoji_vs16},
+	{"emoji_zwj", "\U0001F468\u200D\U0001F469\u200D\U0001F467", &WidthOverrides::emoji_zwj},
+	{"emoji_flag", "\U0001F1E9\U0001F1EA", &WidthOverrides::emoji_flag},
+	{"emoji_modifier", "\U0001F44D\U0001F3FD", &WidthOverrides::emoji_modifier},
+};
+
+// Calibrated widths are cached per terminal, identified by its name and version as far as the environment tells.
+filesystem::path width_cache_path() {
+	string key;
+	for (const char* var : {"TERM", "TERM_PROGRAM", "TERM_PROGRAM_VERSION", "VTE_VERSION"}) {
+		const char* value = getenv(var);
+		if (value && *value) {
+			key += (key.empty() ? "" : "-") + string{value};
 		}
+	}
 
-		istringstream iss(paragraph);
-		vector<string> words{istream_iterator<string>(iss), istream_iterator<string>()};
-		string line;
+	if (key.empty()) {
+		return {};
+	}
 
-		for (const auto& word : words) {
-			// If the word is longer than wrap_width, break it up
-			if (word.size() > static_cast<size_t>(wrap_width)) {
-				// First, add any existing line content
-				if (!line.empty()) {
-					wrapped += line + "\n";
-					line.clear();
-				}
+	for (char& c : key) {
+		if (!isalnum((unsigned char)c) && c != '.' && c != '-') {
+			c = '_';
+		}
+	}
 
-				// Break up the long word while respecting grapheme clusters
-				size_t word_start = 0;
-				size_t current_width = 0;
-				size_t chunk_start = word_start;
-
-				while (word_start < word.size()) {
-					size_t cluster_end = find_grapheme_cluster_end(word, word_start);
-					size_t cluster_size = cluster_end - word_start;
-
-					// Get the display width of this cluster
-					int cluster_width = 0;
-					for (size_t pos = word_start; pos < cluster_end; pos += utf8_char_length(word[pos])) {
-						cluster_width += get_char_width(word, pos);
-					}
-
-					if (current_width + cluster_width > static_cast<size_t>(wrap_width)) {
-						// This cluster would exceed the wrap width
-						if (chunk_start < word_start) {
-							// Output the accumulated chunk
-							if (chunk_start > 0) {
-								wrapped += "\n";
-							}
-							wrapped += word.substr(chunk_start, word_start - chunk_start);
-							chunk_start = word_start;
-							current_width = 0;
-						} else if (cluster_width > wrap_width) {
-							// Single cluster wider than wrap width - force break
-							if (word_start > 0) {
-								wrapped += "\n";
-							}
-							wrapped += word.substr(word_start, cluster_size);
-							word_start = cluster_end;
-							chunk_start = word_start;
-							current_width = 0;
-							continue;
-						}
-					}
-
-					current_width += cluster_width;
-					word_start = cluster_end;
-				}
+	filesystem::path cache_dir;
+	if (const char* xdg_cache_home = getenv("XDG_CACHE_HOME"); xdg_cache_home && *xdg_cache_home) {
+		cache_dir = xdg_cache_home;
+	} else if (const char* home = getenv("HOME"); home && *home) {
+		cache_dir = filesystem::path{home} / ".cache";
+	} else {
+		return {};
+	}
 
-				// Output any remaining chunk
-				if (chunk_start < word_start) {
-					if (chunk_start > 0) {
-						wrapped += "\n";
-					}
-					wrapped += word.substr(chunk_start, word_start - chunk_start);
-				}
+	return cache_dir / "ttt" / "widths" / key;
+}
 
-				continue;
-			}
+WidthOverrides load_width_overrides(const filesystem::path& path) {
+	WidthOverrides result;
+	if (path.empty()) {
+		return result;
+	}
 
-			// Normal word handling
-			if (line.empty()) {
-				line = word;
-			} else if (line.size() + 1 + word.size() <= static_cast<size_t>(wrap_width)) {
-				line += " " + word;
-			} else {
-				wrapped += line + "\n";
-				line = word;
+	ifstream in{path};
+	for (string line; getline(in, line);) {
+		size_t eq = line.find('=');
+		for (const auto& probe : WIDTH_PROBES) {
+			if (eq != string::npos && line.compare(0, eq, probe.name) == 0) {
+				try {
+					result.*probe.width = stoi(line.substr(eq + 1));
+				} catch (...) {}
 			}
 		}
+	}
 
-		if (!line.empty()) {
-			wrapped += line;
-		}
+	return result;
+}
+
+void save_width_overrides(const filesystem::path& path, const WidthOverrides& overrides) {
+	filesystem::create_directories(path.parent_path());
+	ofstream out{path};
+	for (const auto& probe : WIDTH_PROBES) {
+		out << probe.name << "=" << overrides.*probe.width << "\n";
+	}
+
+	if (!out) {
+		throw runtime_error{format("Could not write {}", path.string())};
+	}
+}
+
+#ifndef _WIN32
+// Prints `sample` at the beginning of an empty line and asks the terminal where that left the cursor (DSR 6).
+int measure_width(int fd, const string& sample) {
+	cout << ANSI_CLEAR_LINE << sample << ANSI_REQUEST_CURSOR_POSITION;
+	cout.flush();
 
-		if (newline_pos != string::npos) {
-			wrapped += "\n";
+	// The terminal responds with ESC [ row ; column R
+	string response;
+	while (!response.ends_with('R')) {
+		pollfd pfd = {fd, POLLIN, 0};
+		char c;
+		if (poll(&pfd, 1, 1000) <= 0 || read(fd, &c, 1) != 1) {
+			throw runtime_error{"Terminal did not report the cursor position"};
 		}
+
+		response += c;
+	}
+
+	size_t semicolon = response.find(';', response.rfind("\033["));
+	if (semicolon == string::npos) {
+		throw runtime_error{format("Invalid cursor position report '{}'", response.substr(1))};
 	}
 
-	return wrapped;
+	return stoi(response.substr(semicolon + 1)) - 1;
 }
 
-set<string> find_misspelled_words(const string& target, const string& user_input) {
-	set<string> misspelled;
-	size_t i = 0;
-	while (i < target.size()) {
-		while (i < target.size() && isspace((unsigned char)target[i])) {
-			i++;
+// Asks whether the terminal implements the kitty keyboard protocol. Every terminal answers the subsequent request for its
+// primary device attributes (DA1), so those that ignore the query are detected without waiting for a timeout.
+bool supports_kitty_keyboard(int fd) {
+	cout << KITTY_KEYBOARD_QUERY << ANSI_REQUEST_DEVICE_ATTRIBUTES;
+	cout.flush();
+
+	// The terminal responds with ESC [ ? flags u, if it implements the protocol, and then ESC [ ? attributes c
+	bool supported = false;
+	string response;
+	while (true) {
+		pollfd pfd = {fd, POLLIN, 0};
+		char c;
+		if (poll(&pfd, 1, 1000) <= 0 || read(fd, &c, 1) != 1) {
+			return false;
 		}
 
-		size_t start = i;
-		while (i < target.size() && !isspace((unsigned char)target[i])) {
-			i++;
+		response += c;
+		if (response.find("\033[?") == string::npos) {
+			continue;
 		}
 
-		if (start < i) {
-			bool wordError = false;
-			for (size_t j = start; j < i; j++) {
-				if (j >= user_input.size() || user_input[j] != target[j]) {
-					wordError = true;
-					break;
-				}
-			}
+		if (c == 'u') {
+			supported = true;
+			response.clear();
+		} else if (c == 'c') {
+			return supported;
+		}
+	}
+}
+#endif
 
-			if (wordError) {
-				misspelled.insert(target.substr(start, i - start));
-			}
+// Measures how wide the terminal renders each of `WIDTH_PROBES` and caches the result.
+void calibrate_widths() {
+#ifdef _WIN32
+	throw runtime_error{"Width calibration is not supported on Windows"};
+#else
+	int fd = open("/dev/tty", O_RDONLY);
+	if (fd < 0) {
+		throw runtime_error{"Cannot open /dev/tty"};
+	}
+
+	ScopeGuard fd_guard{[fd] { close(fd); }};
+
+	WidthOverrides overrides;
+	{
+		TerminalSettings term(fd);
+		cout << ANSI_ENTER_ALTERNATE_SCREEN << ANSI_HIDE_CURSOR;
+		ScopeGuard screen_guard{[] {
+			cout << ANSI_CLEAR_LINE << ANSI_SHOW_CURSOR << ANSI_EXIT_ALTERNATE_SCREEN;
+			cout.flush();
+		}};
+
+		for (const auto& probe : WIDTH_PROBES) {
+			overrides.*probe.width = measure_width(fd, probe.sample);
 		}
 	}
 
-	return misspelled;
+	for (const auto& probe : WIDTH_PROBES) {
+		cout << format("{:<16}{} {}", probe.name, probe.sample, overrides.*probe.width) << "\n";
+	}
+
+	auto path = width_cache_path();
+	if (path.empty()) {
+		cout << "Could not identify the terminal; widths are not cached.\n";
+	} else {
+		save_width_overrides(path, overrides);
+		cout << format("Saved to {}", path.string()) << "\n";
+	}
+#endif
 }
 
 void print_help() {
@@ -541,12 +573,29 @@ void print_help() {
 		 << "  -n, --nwords N [LISTNAME]   N random words [word list name]\n"
 		 << "  -q, --quote [LISTNAME]      Random quote from list [quote list name]\n"
 		 << "  -t, --tab WIDTH             Tab width\n"
-		 << "  -w, --wrap WIDTH            Word-wrap text at WIDTH characters\n"
+		 << "  -w, --wrap WIDTH            Word-wrap text at WIDTH characters (0: scroll long lines instead)\n"
+		 << "  --hyphenate [PATTERNS]      Hyphenate words when wrapping [hyphenation pattern name]\n"
+		 << "  --calibrate                 Measure how wide the terminal draws ambiguous characters and emoji, then exit\n"
+		 << "  --serve ADDRESS             Host a race on the selected text at ADDRESS (socket path or [HOST:]PORT)\n"
+		 << "  --join ADDRESS              Join the race hosted at ADDRESS\n"
+		 << "  --broadcast ADDRESS         Let others watch the test live at ADDRESS\n"
+		 << "  --spectate ADDRESS          Watch the test that is broadcast at ADDRESS\n"
+		 << "  --shared-stats              Publish live statistics to /dev/shm/ttt-<pid> for overlays and dashboards\n"
+		 << "  --ghost                     Race against a ghost of your fastest recorded test of the same text\n"
+		 << "  --ghosts N                  Race against ghosts of your N most recent tests of the same text\n"
+		 << "  --ghost-file FILE           Race against a ghost of the recorded test in FILE (may be repeated)\n"
+		 << "  --no-history                Do not record this test\n"
+		 << "  --memory-budget             Prepare text from stdin in place, needing little memory beyond the text and its layout\n"
+		 << "  --no-layout-cache           Neither reuse nor store the prepared layouts of large texts from stdin\n"
+		 << "  --kitty-keyboard            Measure how long keys are held if the terminal supports the kitty keyboard protocol\n"
+		 << "  --latency-probe             Measure how long the terminal takes to process each frame and report it at exit\n"
+		 << "  --debug-overlay             Show how long keystrokes take to be drawn and how large the frames are\n"
 		 << "\n"
 		 << "Shortcuts:\n"
 		 << "  - Ctrl+C or Esc             Cancel the test\n"
 		 << "  - Ctrl+W or Ctrl+Backspace  Delete the previous word\n"
 		 << "  - Ctrl+R                    Reset the test\n"
+		 << "  - Ctrl+L                    Redraw the text\n"
 		 << "\n"
 		 << "Input test via stdin.\n";
 	cout.flush();
@@ -554,21 +603,6 @@ void print_help() {
 
 void print_version() { cout << "ttt — terminal typing test" << endl << "version " << TTT_VERSION << endl; }
 
-string ls(const string& path) {
-	ostringstream result;
-	bool first = true;
-	for (const auto& entry : g_fs.iterate_directory(path)) {
-		if (!first) {
-			result << ", ";
-		}
-
-		first = false;
-		result << entry.filename();
-	}
-
-	return result.str();
-}
-
 size_t console_width() {
 #ifdef _WIN32
 	CONSOLE_SCREEN_BUFFER_INFO csbi;
@@ -585,32 +619,39 @@ size_t console_width() {
 	return 0;
 }
 
-vector<string> get_word_list(const string& name) {
-	vector<string> words;
+// Texts from stdin that are at least this large have their layouts cached. Smaller ones are prepared in milliseconds.
+constexpr size_t MIN_CACHED_TEXT_SIZE = 64 * 1024;
 
-	try {
-		auto words_file = g_fs.open(format("resources/words/{}", name));
-		string words_string = {words_file.cbegin(), words_file.cend()};
-		return split(words_string, "\n");
-	} catch (...) { throw invalid_argument{format("Invalid word list name provided. Available lists: {}", ls("resources/words"))}; }
-}
-
-json get_quote_list(const string& name) {
-	try {
-		auto quotes_file = g_fs.open(format("resources/quotes/{}", name));
-		return json::parse(quotes_file);
-	} catch (...) { throw invalid_argument{format("Invalid quote list name provided. Available lists: {}", ls("resources/quotes"))}; }
-}
-
-random_device g_rd;
-mt19937 g_rd_gen(g_rd());
+// Resources and settings of a typing session. Owned by `main` rather than global, such that the engine can be embedded into
+// programs running several sessions at once.
+struct Context {
+	TestFactory tests;
+	WidthContext widths;
+};
 
 int main(const vector<string>& args) {
+	Context ctx;
+
 	// Parse command line options
 	string quote_list_name = "";
 	string word_list_name = "";
 	size_t n_words = 20;
-	size_t wrap_width = 0;
+	optional<size_t> wrap_width;
+	string hyphenation_name = "";
+	string serve_address = "";
+	string join_address = "";
+	string broadcast_address = "";
+	string spectate_address = "";
+	bool shared_stats = false;
+	bool use_ghost = false;
+	size_t n_ghosts = 0;
+	vector<string> ghost_paths;
+	bool record_history = true;
+	bool memory_budget = false;
+	bool use_layout_cache = true;
+	bool kitty_keyboard = false;
+	bool latency_probe = false;
+	bool debug_overlay = false;
 	for (size_t i = 1; i < args.size(); i++) {
 		const string& arg = args[i];
 		if (arg == "-h" || arg == "--help") {
@@ -639,70 +680,259 @@ int main(const vector<string>& args) {
 			}
 		} else if ((arg == "-t" || arg == "--tab") && i + 1 < args.size()) {
 			try {
-				g_tab_width = stoul(args[++i]);
+				ctx.widths.tab_width = stoul(args[++i]);
 			} catch (...) { throw invalid_argument{"Invalid tab width provided"}; }
 		} else if ((arg == "-w" || arg == "--wrap") && i + 1 < args.size()) {
 			try {
 				wrap_width = stoul(args[++i]);
 			} catch (...) { throw invalid_argument{"Invalid wrap width provided"}; }
+		} else if (arg == "--hyphenate") {
+			if (i + 1 < args.size() && !args[i + 1].starts_with('-')) {
+				hyphenation_name = args[++i];
+			} else {
+				hyphenation_name = "en-us";
+			}
+		} else if (arg == "--calibrate") {
+			calibrate_widths();
+			return 0;
+		} else if (arg == "--serve" && i + 1 < args.size()) {
+			serve_address = args[++i];
+		} else if (arg == "--join" && i + 1 < args.size()) {
+			join_address = args[++i];
+		} else if (arg == "--broadcast" && i + 1 < args.size()) {
+			broadcast_address = args[++i];
+		} else if (arg == "--spectate" && i + 1 < args.size()) {
+			spectate_address = args[++i];
+		} else if (arg == "--shared-stats") {
+			shared_stats = true;
+		} else if (arg == "--ghost") {
+			use_ghost = true;
+		} else if (arg == "--ghosts" && i + 1 < args.size()) {
+			try {
+				n_ghosts = stoul(args[++i]);
+			} catch (...) { throw invalid_argument{"Invalid number of ghosts provided"}; }
+		} else if (arg == "--ghost-file" && i + 1 < args.size()) {
+			ghost_paths.push_back(args[++i]);
+		} else if (arg == "--no-history") {
+			record_history = false;
+		} else if (arg == "--memory-budget") {
+			memory_budget = true;
+		} else if (arg == "--no-layout-cache") {
+			use_layout_cache = false;
+		} else if (arg == "--kitty-keyboard") {
+			kitty_keyboard = true;
+		} else if (arg == "--latency-probe") {
+			latency_probe = true;
+		} else if (arg == "--debug-overlay") {
+			debug_overlay = true;
 		}
 	}
 
+	bool spectating = !spectate_address.empty();
+
+#ifdef TTT_NETWORKING
+	optional<RaceClient> race;
+	optional<SpectatorServer> broadcast;
+	optional<SpectatorClient> spectate;
+
+	// Spectators replay the typist's keystrokes with the typist's timing.
+	TypingSession::Clock::time_point spectate_time = TypingSession::Clock::now();
+#else
+	if (!serve_address.empty() || !join_address.empty() || !broadcast_address.empty() || spectating) {
+		throw invalid_argument{"Races and spectating are only supported on Linux"};
+	}
+#endif
+
+	// Use the widths measured by `--calibrate` for this terminal, if any.
+	ctx.widths.overrides = load_width_overrides(width_cache_path());
+
 	// While this program *technically* works without wrapping, it's better to set the wrap width to the terminal width
-	// so that words don't get broken up by the terminal which doesn't care for word boundaries.
-	if (wrap_width == 0) {
+	// so that words don't get broken up by the terminal which doesn't care for word boundaries. Lines that are nonetheless
+	// wider than the terminal, e.g. with `--wrap 0`, are scrolled horizontally.
+	if (!wrap_width) {
 		wrap_width = console_width();
 	}
 
-	// Get target either from a word list, a quote list, or stdin
+	// Get target either from the session we spectate, the race we join, a word list, a quote list, or stdin
 	string target;
-	if (!word_list_name.empty()) {
-		auto words = get_word_list(word_list_name);
-		if (words.size() == 0) {
-			throw runtime_error{"No words found"};
+	bool from_list = false;
+	if (spectating) {
+#ifdef TTT_NETWORKING
+		spectate.emplace(spectate_address);
+		target = spectate->text();
+#endif
+	} else if (!join_address.empty()) {
+#ifdef TTT_NETWORKING
+		race.emplace(join_address);
+		target = race->text();
+#endif
+	} else if (!word_list_name.empty() || !quote_list_name.empty()) {
+		from_list = true;
+	} else if (memory_budget) {
+		// Leave room for the text to grow when it is normalized and wrapped, lest the string reallocate.
+		target = read_all(cin, 0.5);
+	} else {
+		target = string{istreambuf_iterator<char>(cin), istreambuf_iterator<char>()};
+	}
+
+	// The server does not type itself; everybody who wants to race joins it. Racers wrap the text to their own terminals.
+	// Spectators see the text exactly as the typist does and scroll lines that are too wide for their terminal.
+	TestRequest request = {word_list_name, n_words, quote_list_name, *wrap_width, hyphenation_name, ctx.widths};
+	if (!serve_address.empty() || spectating) {
+		request.wrap_width = 0;
+	}
+
+	optional<LayoutCache> layout_cache;
+	LayoutCacheKey layout_cache_key = {};
+	optional<Layout> cached_layout;
+	if (from_list) {
+		// Tests from word and quote lists come from the daemon, if one runs, which prepared them ahead of time.
+		optional<PreparedTest> test;
+#ifdef TTT_NETWORKING
+		test = request_test(daemon_address(), request);
+#endif
+		if (!test) {
+			test = ctx.tests.prepare(request);
 		}
 
-		uniform_int_distribution<> dis(0, words.size() - 1);
+		if (!test->attribution.empty()) {
+			cout << test->attribution << ": " << endl;
+		}
 
-		vector<string> selected_words;
-		for (size_t i = 0; i < n_words; i++) {
-			selected_words.push_back(words[dis(g_rd_gen)]);
+		target = std::move(test->text);
+	} else {
+		if (target.empty()) {
+			throw runtime_error{"No text provided"};
 		}
 
-		target = join(selected_words, " ");
-	} else if (!quote_list_name.empty()) {
-		json quotes = get_quote_list(quote_list_name);
-		if (quotes.size() == 0) {
-			throw runtime_error{"No quotes found"};
+		// Large texts from stdin are prepared once and mapped from the layout cache when they are typed again.
+		bool from_stdin = !spectating && join_address.empty() && serve_address.empty();
+		if (use_layout_cache && from_stdin && target.size() >= MIN_CACHED_TEXT_SIZE) {
+			if (auto dir = layout_cache_dir(); !dir.empty()) {
+				layout_cache.emplace(dir);
+				string_view patterns = request.hyphenation.empty() ? "" : ctx.tests.hyphenation_patterns(request.hyphenation);
+				layout_cache_key = ttt::layout_cache_key(target, request.wrap_width, patterns, ctx.widths);
+				cached_layout = layout_cache->load(layout_cache_key, ctx.widths);
+			}
 		}
 
-		uniform_int_distribution<> dis(0, quotes.size() - 1);
-		const json& quote = quotes[dis(g_rd_gen)];
+		if (cached_layout) {
+			// Already prepared
+		} else if (memory_budget) {
+			ctx.tests.prepare_text_in_place(target, request);
+		} else {
+			target = ctx.tests.prepare_text(target, request);
+		}
+	}
 
-		target = quote.value("text", "");
+#ifdef TTT_NETWORKING
+	if (!serve_address.empty()) {
+		cout << format("Serving race on {}", serve_address) << endl;
+		RaceServer{serve_address, std::move(target)}.run();
+		return 0;
+	}
+#endif
 
-		string attribution = quote.value("attribution", "");
-		if (attribution.empty()) {
-			attribution = "Unknown person";
+	bool from_cache = cached_layout.has_value();
+	TypingSession session = from_cache ? TypingSession{std::move(*cached_layout)} : TypingSession{std::move(target), ctx.widths};
+	const Layout& layout = session.layout();
+	if (layout_cache && !from_cache) {
+		try {
+			layout_cache->store(layout_cache_key, layout);
+		} catch (const exception&) {
+			// The cache merely saves time. Failing to fill it is no reason not to type.
 		}
+	}
+	Viewport viewport{layout, console_width()};
+	viewport.scroll_to(layout, 0, layout.column_of(0));
 
-		cout << attribution << ": " << endl;
-	} else {
-		target = string{istreambuf_iterator<char>(cin), istreambuf_iterator<char>()};
+#ifdef TTT_NETWORKING
+	if (!broadcast_address.empty()) {
+		broadcast.emplace(broadcast_address, string{layout.text});
 	}
+#endif
 
-	if (target.empty()) {
-		throw runtime_error{"No text provided"};
+	// Completed tests are recorded, such that later tests of the same text can race against them. Spectators merely watch.
+	ProgressIndex progress_index{layout.text};
+	optional<History> history;
+	if (auto dir = data_dir(); !dir.empty() && !spectating) {
+		history.emplace(dir);
 	}
 
-	target = nfd(target);
+	// Dwell and flight times are part of the recording, even if it is not saved.
+	optional<Recorder> recorder;
+	if ((history && record_history) || kitty_keyboard) {
+		recorder.emplace(progress_index);
+	}
+
+	optional<Recording> best = history ? history->best(progress_index.text_hash()) : nullopt;
+
+	// Ghosts replay the personal best, the most recent attempts, and any given recordings. Each recording races only once.
+	vector<Recording> ghost_recordings;
+	auto add_ghost = [&](Recording recording) {
+		for (const auto& other : ghost_recordings) {
+			if (other.finished_at == recording.finished_at) {
+				return;
+			}
+		}
+
+		ghost_recordings.push_back(std::move(recording));
+	};
 
-	if (wrap_width > 0) {
-		target = wrap_text(target, wrap_width);
+	if (!spectating) {
+		if (use_ghost && best) {
+			add_ghost(*best);
+		}
+
+		if (n_ghosts > 0 && history) {
+			auto recordings = history->load(progress_index.text_hash());
+			for (size_t i = recordings.size() - min(n_ghosts, recordings.size()); i < recordings.size(); i++) {
+				add_ghost(std::move(recordings[i]));
+			}
+		}
+
+		for (const auto& path : ghost_paths) {
+			Recording recording = load_recording(path);
+			if (recording.text_hash != progress_index.text_hash()) {
+				throw invalid_argument{format("{} is a recording of a different text", path)};
+			}
+
+			add_ghost(std::move(recording));
+		}
+
+		if ((use_ghost || n_ghosts > 0) && ghost_recordings.empty()) {
+			cout << "No recording of this text to race against yet." << endl;
+		}
+	}
+
+	optional<GhostReplay> ghosts;
+	if (!ghost_recordings.empty()) {
+		ghosts.emplace(std::move(ghost_recordings), layout, progress_index);
 	}
 
-	// Remove trailing whitespace from target text
-	target.erase(find_if(target.rbegin(), target.rend(), [](unsigned char ch) { return !isspace(ch); }).base(), target.end());
+	// Number of ghost carets covering each cell, or empty without ghosts
+	static const vector<uint16_t> NO_GHOST_CELLS;
+	const vector<uint16_t>& ghost_cells = ghosts ? ghosts->cells() : NO_GHOST_CELLS;
+
+#ifdef TTT_SHARED_STATS
+	optional<SharedStatsPublisher> stats_publisher;
+	if (shared_stats) {
+		stats_publisher.emplace();
+	}
+#else
+	if (shared_stats) {
+		throw invalid_argument{"Shared statistics are only supported on Linux"};
+	}
+#endif
+
+	optional<LatencyProbe> probe;
+	if (latency_probe && !spectating) {
+#ifdef _WIN32
+		throw invalid_argument{"The latency probe is not supported on Windows"};
+#else
+		probe.emplace();
+#endif
+	}
 
 	// Determine the interactive input file descriptor.
 	int input_fd;
@@ -731,152 +961,397 @@ int main(const vector<string>& args) {
 	}};
 #endif
 
-	// Split target into lines for display.
-	vector<string> target_lines;
-	{
-		size_t start = 0;
-		size_t found;
-		while ((found = target.find('\n', start)) != string::npos) {
-			target_lines.push_back(target.substr(start, found - start));
-			start = found + 1;
+	// The terminal settings object enables raw input mode and automatically reverts to default settings when destructed
+	TerminalSettings term(input_fd);
+
+#ifndef _WIN32
+	// Terminals report key releases only in the kitty keyboard protocol's progressive mode, in which every key press arrives
+	// as an escape sequence that has to be decoded.
+	optional<KittyDecoder> kitty;
+	if (kitty_keyboard && !spectating && supports_kitty_keyboard(input_fd)) {
+		cout << KITTY_KEYBOARD_PUSH;
+		term.kitty_keyboard = true;
+		kitty.emplace();
+	}
+#endif
+
+	// Lines containing right-to-left text are reordered by us. Ask terminals that implement bidi themselves (ECMA-48 BDSM) to
+	// display them as is.
+	bool has_bidi = !layout.visual_order.empty();
+	if (has_bidi) {
+		cout << ANSI_BIDI_EXPLICIT;
+	}
+
+	ScopeGuard bidi_guard{[has_bidi] {
+		if (has_bidi) {
+			cout << ANSI_BIDI_IMPLICIT;
 		}
+	}};
 
-		target_lines.push_back(target.substr(start));
+	for (size_t i = 0; i < layout.lines.size(); i++) {
+		draw_line(layout, viewport, i, session.input(), ghost_cells);
+		if (i < layout.lines.size() - 1) {
+			cout << "\n";
+		}
 	}
 
-	// The terminal settings object enables raw input mode and automatically reverts to default settings when destructed
-	TerminalSettings term(input_fd);
+	// Lines below the text, separated by an empty line
+	size_t n_footer_lines = 0;
 
-	string user_input;
-	draw_state(target_lines, user_input);
-	bool timing_started = false;
-	chrono::steady_clock::time_point start_time, end_time;
-	char c;
+	// Moves the cursor to the last line of the footer, such that subsequent output appears below it
+	auto leave_footer = [&]() {
+		if (n_footer_lines > 0) {
+			cout << ANSI_RESTORE_CURSOR << move_cursor_down(layout.lines.size() - 1 + n_footer_lines);
+		}
+	};
+
+#ifdef TTT_NETWORKING
+	auto draw_race_footer = [&]() {
+		leave_footer();
+		draw_race_status(*race, viewport.width);
+		move_cursor(layout, viewport, session.input().size());
+	};
+
+	if (race) {
+		n_footer_lines = 2;
+		cout << "\n\n";
+		draw_race_status(*race, viewport.width);
+	}
+#endif
 
 	// Move cursor up to the beginning of the printed block and save as restore point.
-	if (target_lines.size() > 1) {
-		cout << move_cursor_up(target_lines.size() - 1);
+	if (layout.lines.size() + n_footer_lines > 1) {
+		cout << move_cursor_up(layout.lines.size() - 1 + n_footer_lines);
 	}
 
 	cout << ANSI_MOVE_CURSOR_TO_BEGINNING_OF_LINE;
 	cout << ANSI_SAVE_CURSOR;
+
+	// The first character is only at the beginning of the line if the line is read from left to right
+	move_cursor(layout, viewport, session.input().size());
 	cout.flush();
 
-	while (true) {
+	// Only the lines spanned by an edit need to be redrawn. This includes the cursor's line, should it have scrolled.
+	auto redraw = [&](TypingSession::FrameDiff diff) {
+		size_t cursor_pos = session.cursor();
+		size_t cursor_line = layout.line_of(cursor_pos);
+		if (viewport.scroll_to(layout, cursor_line, layout.column_of(cursor_pos))) {
+			diff.merge({cursor_line, cursor_line});
+		}
+
+		for (size_t i = diff.first_line; i <= diff.last_line; i++) {
+			cout << ANSI_RESTORE_CURSOR;
+			if (i > 0) {
+				cout << move_cursor_down(i);
+			}
+
+			draw_line(layout, viewport, i, session.input(), ghost_cells);
+		}
+
+		move_cursor(layout, viewport, session.input().size());
+	};
+
+	// Moves the ghosts to where their recordings were at the same time into the test and repaints only the cells they
+	// entered or left. Returns whether any did.
+	auto redraw_ghosts = [&]() {
+		const auto& changed = session.started() ? ghosts->advance((uint32_t)(session.seconds() * 1000)) : ghosts->rewind();
+		if (changed.empty()) {
+			return false;
+		}
+
+		for (size_t cell : changed) {
+			redraw_cell(layout, viewport, cell, session.input(), ghost_cells);
+		}
+
+		move_cursor(layout, viewport, session.input().size());
+		return true;
+	};
+
+	// Bytes to feed into the session along with the time at which they were typed. Usually a single keystroke, but spectators
+	// may receive many at once. In kitty keyboard mode, the first byte of each key press also carries its key, and key releases
+	// are entries of their own that are not fed into the session.
+	struct Keystroke {
+		char c;
+		TypingSession::Clock::time_point time;
+		uint32_t key = 0;
+		bool release = false;
+	};
+
+	vector<Keystroke> keys;
+	bool stream_ended = false;
+
+	// When the keystrokes of an iteration were read, or the epoch if none were
+	TypingSession::Clock::time_point input_time;
+
+	// Output passes through the overlay's byte counter for as long as it is shown.
+	optional<DebugOverlay> overlay;
+	if (debug_overlay) {
+		overlay.emplace();
+		cout.rdbuf(&overlay->output);
+	}
+
+	ScopeGuard overlay_guard{[&overlay] {
+		if (overlay) {
+			cout.rdbuf(overlay->output.target());
+		}
+	}};
+
+	auto report_round_trips = [&]() {
+		if (!probe || probe->histogram().count() == 0) {
+			return;
+		}
+
+		const auto& histogram = probe->histogram();
+		cout << format(
+			"Terminal round trip over {} frames: p50 {:.2f} ms, p90 {:.2f} ms, p99 {:.2f} ms, max {:.2f} ms",
+			histogram.count(),
+			histogram.percentile(0.5) / 1000.0,
+			histogram.percentile(0.9) / 1000.0,
+			histogram.percentile(0.99) / 1000.0,
+			histogram.max() / 1000.0
+		) << endl;
+	};
+
+#ifndef _WIN32
+	// Treats `c` as typed by the user at `time`
+	auto add_input = [&](char c, TypingSession::Clock::time_point time) {
+		if (!kitty) {
+			// Spectators can only leave.
+			if (!spectating || c == 27) {
+				keys.push_back({c, time});
+			}
+
+			return;
+		}
+
+		auto event = kitty->feed(c);
+		if (!event) {
+			return;
+		}
+
+		if (event->type == KeyEvent::Type::Release) {
+			keys.push_back({0, time, event->key, true});
+			return;
+		}
+
+		string_view text = event->text();
+		for (size_t j = 0; j < text.size(); j++) {
+			// Ctrl+C arrives as a key event rather than interrupting ttt, so it cancels the test like Esc.
+			keys.push_back({text[j] == 3 ? (char)27 : text[j], time, j == 0 && event->type == KeyEvent::Type::Press ? event->key : 0});
+		}
+	};
+
+	auto drain_replies = [&]() {
+		auto deadline = TypingSession::Clock::now() + chrono::milliseconds{PROBE_DRAIN_MS};
+		while (probe && probe->waiting() && TypingSession::Clock::now() < deadline) {
+			pollfd pfd = {input_fd, POLLIN, 0};
+			char c;
+			if (poll(&pfd, 1, 10) > 0 && read(input_fd, &c, 1) == 1) {
+				probe->feed(c, TypingSession::Clock::now());
+			}
+		}
+	};
+#endif
+
+	while (!session.complete()) {
+		keys.clear();
+		input_time = {};
+
 #ifdef _WIN32
+		char c;
 		DWORD n;
-		if (!ReadConsoleA(GetStdHandle(STD_INPUT_HANDLE), &c, 1, &n, NULL)) {
-			continue;
+		if (ReadConsoleA(GetStdHandle(STD_INPUT_HANDLE), &c, 1, &n, NULL) && n > 0) {
+			input_time = TypingSession::Clock::now();
+			keys.push_back({c, input_time});
 		}
 #else
-		ssize_t n = read(input_fd, &c, 1);
-#endif
+		// Wait for either a keystroke or news from the network, if any
+		int network_fd = -1;
+#	ifdef TTT_NETWORKING
+		if (race) {
+			network_fd = race->fd();
+		} else if (spectate) {
+			network_fd = spectate->fd();
+		}
+#	endif
 
-		if (n <= 0) {
-			continue;
+		// Ghosts move on their own and are hence redrawn periodically until they finish.
+		int timeout = -1;
+		if (ghosts && session.started() && !ghosts->finished()) {
+			timeout = GHOST_TICK_MS;
 		}
 
-		if (!timing_started) {
-			start_time = chrono::steady_clock::now();
-			timing_started = true;
+		if (probe && probe->holding()) {
+			timeout = ESC_TIMEOUT_MS;
 		}
 
-		if (c == 27) { // Close on esc
-			term.restore();
-			cout << "\n\nCancelled.\n";
-			return 0;
-		} else if (c == 127) { // Backspace
-			if (!user_input.empty()) {
-				size_t prev = prev_char_pos(user_input, user_input.length());
-				user_input.erase(prev);
+		if (overlay && overlay->dirty) {
+			auto elapsed = chrono::duration_cast<chrono::milliseconds>(TypingSession::Clock::now() - overlay->drawn_at).count();
+			int remaining = (int)max<int64_t>(OVERLAY_INTERVAL_MS - elapsed, 0);
+			timeout = timeout < 0 ? remaining : min(timeout, remaining);
+		}
+
+		array<pollfd, 2> fds = {{{input_fd, POLLIN, 0}, {network_fd, POLLIN, 0}}};
+		int n_ready = poll(fds.data(), fds.size(), timeout);
+		if (n_ready < 0) {
+			continue;
+		}
+
+		if (fds[0].revents & POLLIN) {
+			// Without the kitty keyboard protocol, each byte is handled as soon as it arrives. With it, whole escape sequences
+			// arrive at once and are decoded together.
+			char buffer[64];
+			ssize_t n = read(input_fd, buffer, kitty ? sizeof(buffer) : 1);
+			auto time = TypingSession::Clock::now();
+			input_time = time;
+			for (ssize_t i = 0; i < n; i++) {
+				for (char c : probe ? probe->feed(buffer[i], time) : string_view{&buffer[i], 1}) {
+					add_input(c, time);
+				}
 			}
-		} else if (c == 18) { // Ctrl-R (reset test)
-			timing_started = false;
-			user_input.clear();
-		} else if (c == 23 || c == 8) { // Ctrl-W or Ctrl+Backspace (delete word)
-			// Delete any trailing whitespace first.
-			while (!user_input.empty() && isspace(user_input.back())) {
-				user_input.pop_back();
+		} else if (n_ready == 0 && probe && probe->holding()) {
+			for (char c : probe->flush()) {
+				add_input(c, TypingSession::Clock::now());
 			}
+		}
 
-			// Then delete characters until the previous whitespace.
-			while (!user_input.empty() && !isspace(user_input.back())) {
-				user_input.pop_back();
-			}
-		} else if (target[user_input.size()] == '\n' && isspace(c)) { // Let the user press space instead of newline
-			user_input.push_back('\n');
-
-			// Determine current line index by counting newline characters.
-			int current_line = 0;
-			for (char ch : user_input) {
-				if (ch == '\n') {
-					++current_line;
+#	ifdef TTT_NETWORKING
+		if (fds[1].revents != 0) {
+			if (race) {
+				race->receive();
+				draw_race_footer();
+				cout.flush();
+			} else if (spectate) {
+				stream_ended = !spectate->receive();
+				while (auto frame = spectate->next()) {
+					spectate_time += chrono::milliseconds{frame->delay_ms};
+					keys.push_back({frame->c, spectate_time});
 				}
 			}
+		}
+#	endif
+#endif
 
-			// If there is a subsequent line in target_lines, inject its leading whitespace.
-			if ((size_t)current_line < target_lines.size()) {
-				string prefix;
-				for (char ch : target_lines[current_line]) {
-					if (ch == ' ' || ch == '\t') {
-						prefix.push_back(ch);
-					} else {
-						break;
-					}
+		TypingSession::FrameDiff diff = {1, 0};
+		for (const auto& [c, time, key, release] : keys) {
+			if (release) {
+				if (recorder) {
+					recorder->release(session, key, time);
 				}
 
-				user_input += prefix;
+				continue;
 			}
-		} else {
-			if (isspace(c)) {
-				c = ' ';
+
+			// Ctrl+L repaints the whole text, e.g. after another program garbled the screen
+			if (c == 12) {
+				diff.merge({0, layout.lines.size() - 1});
+				continue;
 			}
 
-			user_input.push_back(c);
+			diff.merge(session.feed(c, time));
+
+#ifdef TTT_NETWORKING
+			if (broadcast) {
+				broadcast->publish(c, time);
+			}
+#endif
+
+#ifdef TTT_SHARED_STATS
+			if (stats_publisher) {
+				stats_publisher->publish(session, time);
+			}
+#endif
+
+			if (recorder) {
+				recorder->record(session, c, time, key);
+			}
+
+			if (session.cancelled()) {
+#ifndef _WIN32
+				drain_replies();
+#endif
+				term.restore();
+				leave_footer();
+				cout << "\n\nCancelled.\n";
+				report_round_trips();
+				return 0;
+			}
+
+			if (session.complete()) {
+				break;
+			}
 		}
 
-		cout << ANSI_RESTORE_CURSOR;
-		size_t total_expected = draw_state(target_lines, user_input);
+		size_t frame_begin = overlay ? overlay->output.count() : 0;
+		if (!diff.empty()) {
+			redraw(diff);
 
-		cout << ANSI_RESTORE_CURSOR;
-		move_cursor(user_input);
+#ifdef TTT_NETWORKING
+			if (race) {
+				race->report(RaceProgress::of(session));
+				draw_race_footer();
+			}
+#endif
+		}
 
-		// Check if typing is complete.
-		if (nfd(user_input).size() >= total_expected) {
-			break;
+		bool ghost_moved = ghosts && redraw_ghosts();
+		if (!diff.empty() || ghost_moved) {
+			size_t frame_size = overlay ? overlay->output.count() - frame_begin : 0;
+			if (probe) {
+				cout << LatencyProbe::REQUEST;
+				probe->sent(TypingSession::Clock::now());
+			}
+
+			cout.flush();
+
+			if (overlay && input_time != TypingSession::Clock::time_point{} && !diff.empty()) {
+				overlay->latency_ns.record(chrono::duration_cast<chrono::nanoseconds>(TypingSession::Clock::now() - input_time).count());
+				overlay->frame_bytes.record(frame_size);
+				overlay->dirty = true;
+			}
 		}
-	}
 
-	user_input = nfd(user_input);
+		// Drawn only after the frame was written and measured, such that the overlay does not measure itself
+		if (overlay && overlay->dirty && TypingSession::Clock::now() - overlay->drawn_at >= chrono::milliseconds{OVERLAY_INTERVAL_MS}) {
+			draw_debug_overlay(*overlay, console_width());
+			move_cursor(layout, viewport, session.input().size());
+			cout.flush();
 
-	end_time = chrono::steady_clock::now();
-	term.restore(); // Restore the original terminal settings
-	double seconds = chrono::duration_cast<chrono::duration<double>>(end_time - start_time).count();
-	double minutes = seconds / 60.0;
-	double wpm = (target.size() / 5.0) / minutes;
+			overlay->drawn_at = TypingSession::Clock::now();
+			overlay->dirty = false;
+		}
 
-	size_t n_correct_chars = 0;
-	for (size_t i = 0; i < target.size(); i++) {
-		if (target[i] == user_input[i]) {
-			++n_correct_chars;
+		if (stream_ended && !session.complete()) {
+			term.restore();
+			leave_footer();
+			cout << "\n\nThe session ended.\n";
+			return 0;
 		}
 	}
 
-	double accuracy = (static_cast<double>(n_correct_chars) / target.size()) * 100.0;
-
-	set<string> misspelled = find_misspelled_words(target, user_input);
+#ifndef _WIN32
+	drain_replies();
+#endif
+	term.restore(); // Restore the original terminal settings
+	leave_footer();
 
-	int minutes_int = seconds / 60;
-	int sec_int = static_cast<int>(seconds) % 60;
+	auto stats = session.stats();
+	int minutes_int = stats.seconds / 60;
+	int sec_int = static_cast<int>(stats.seconds) % 60;
 
 	cout << std::format(
-		"\n\nTime: {}:{:02}, WPM: {:.0f}, Accuracy: {:.2f}% {}\n", minutes_int, sec_int, wpm, accuracy, accuracy == 100 ? "🎉" : ""
+		"\n\nTime: {}:{:02}, WPM: {:.0f}, Accuracy: {:.2f}% {}\n",
+		minutes_int,
+		sec_int,
+		stats.wpm,
+		stats.accuracy,
+		stats.accuracy == 100 ? "🎉" : ""
 	);
 
-	if (!misspelled.empty()) {
+	if (!stats.misspelled_words.empty()) {
 		cout << "Misspelled words: ";
 		bool first = true;
-		for (const auto& word : misspelled) {
+		for (const auto& word : stats.misspelled_words) {
 			if (!first) {
 				cout << ", ";
 			}
@@ -887,6 +1362,43 @@ int main(const vector<string>& args) {
 		cout << endl;
 	}
 
+	if (best) {
+		if (stats.wpm > best->wpm) {
+			cout << format("New personal best! Previous: {:.0f} WPM", best->wpm) << endl;
+		} else {
+			cout << format("Personal best: {:.0f} WPM", best->wpm) << endl;
+		}
+	}
+
+	optional<Recording> recording = recorder ? optional{recorder->finish(session)} : nullopt;
+	if (auto dwell = recording ? recording->mean_dwell_ms() : nullopt) {
+		cout << format("Mean dwell time: {:.0f} ms", *dwell);
+		if (auto flight = recording->mean_flight_ms()) {
+			cout << format(", flight time: {:.0f} ms", *flight);
+		}
+
+		cout << endl;
+	}
+
+	report_round_trips();
+
+	// The test is over either way, so failing to record it, e.g. because the disk is full, is merely worth a warning.
+	if (recording && history && record_history) {
+		try {
+			history->save(*recording, stats.misspelled_words);
+		} catch (const exception& e) {
+			cerr << format("Warning: could not record this test: {}", e.what()) << endl;
+		}
+	}
+
+#ifdef TTT_NETWORKING
+	if (race) {
+		auto standings = race->standings();
+		size_t place = find(standings.begin(), standings.end(), race->id()) - standings.begin() + 1;
+		cout << format("Place: {} of {}", place, standings.size()) << endl;
+	}
+#endif
+
 	return 0;
 }
 
@@ -0,0 +1,318 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+// ttt-memory-bench: measures the peak memory (resident set size) of each stage through which a text from stdin goes before it
+// can be typed, on synthetic corpora of increasing size, both as ttt prepares it by default and with `--memory-budget`. Fails
+// if the budgeted preparation of the text needs more than a given multiple of its size, or if the process as a whole, once
+// the session is ready to be typed, needs more than another.
+
+#include "corpus.h"
+#include "history.h"
+#include "session.h"
+#include "text.h"
+
+#include <json/json.hpp>
+
+#include <malloc.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+using namespace nlohmann;
+
+namespace ttt {
+
+using Clock = chrono::steady_clock;
+
+constexpr int WRAP_WIDTH = 80;
+
+// Buffers of fixed size, like the chunks that are normalized and wrapped at a time, weigh heavily on small texts. They are
+// allowed on top of the budget, such that the budget is about how memory grows with the size of the text.
+constexpr size_t FIXED_ALLOWANCE = 1'000'000;
+
+const vector<Corpus> CORPORA = {Corpus::Ascii, Corpus::Latin, Corpus::Cjk};
+
+// The stages through which a text goes before it can be typed, in order. The session stage lays out the text and sets up
+// what ttt needs to record it.
+const vector<string> STAGES = {"read", "nfd", "wrap", "session"};
+
+// Stages that only concern the text. The layout holds several bytes per character on top, which are budgeted separately.
+constexpr size_t TEXT_STAGES = 3;
+
+struct MemoryUsage {
+	size_t current = 0, peak = 0;
+};
+
+MemoryUsage memory_usage() {
+	ifstream status{"/proc/self/status"};
+	if (!status) {
+		throw runtime_error{"Could not read /proc/self/status"};
+	}
+
+	MemoryUsage result;
+	string line;
+	while (getline(status, line)) {
+		auto kilobytes = [&]() { return stoull(line.substr(line.find(':') + 1)) * 1024; };
+		if (line.starts_with("VmRSS:")) {
+			result.current = kilobytes();
+		} else if (line.starts_with("VmHWM:")) {
+			result.peak = kilobytes();
+		}
+	}
+
+	return result;
+}
+
+// Returns freed memory to the system and makes the peak start over from the current resident set size
+void reset_peak() {
+#ifdef __GLIBC__
+	malloc_trim(0);
+#endif
+
+	ofstream clear_refs{"/proc/self/clear_refs"};
+	if (!(clear_refs << "5" << flush)) {
+		throw runtime_error{"Could not reset the peak resident set size (Linux 4.0 or later is required)"};
+	}
+}
+
+struct StageResult {
+	size_t peak;    // Bytes above what the process used before reading the text
+	double seconds;
+};
+
+// Prepares the text in `path` like ttt does, either by default or with `--memory-budget`, and measures each stage. The
+// prepared text is returned through `hash`, such that both ways can be checked to agree.
+vector<StageResult> measure(const string& path, bool memory_budget, size_t& hash) {
+	static const WidthContext widths;
+
+	vector<StageResult> result;
+	reset_peak();
+	size_t base = memory_usage().current;
+
+	auto stage = [&](const auto& fun) {
+		reset_peak();
+		auto start = Clock::now();
+		fun();
+		double seconds = chrono::duration<double>(Clock::now() - start).count();
+		size_t peak = memory_usage().peak;
+		result.push_back({peak > base ? peak - base : 0, seconds});
+	};
+
+	auto trim = [](string& text) {
+		text.erase(find_if(text.rbegin(), text.rend(), [](unsigned char ch) { return !isspace(ch); }).base(), text.end());
+	};
+
+	string text;
+	optional<TypingSession> session;
+	optional<ProgressIndex> progress_index;
+	optional<Recorder> recorder;
+	if (memory_budget) {
+		stage([&]() {
+			ifstream in{path, ios::binary};
+			text = read_all(in, 0.5);
+		});
+		stage([&]() { nfd_in_place(text); });
+		stage([&]() {
+			wrap_text_in_place(text, WRAP_WIDTH, widths);
+			trim(text);
+		});
+	} else {
+		stage([&]() {
+			ifstream in{path, ios::binary};
+			text = string{istreambuf_iterator<char>(in), istreambuf_iterator<char>()};
+		});
+		stage([&]() { text = nfd(text); });
+		stage([&]() {
+			text = wrap_text(text, WRAP_WIDTH, widths);
+			trim(text);
+		});
+	}
+
+	hash = std::hash<string>{}(text);
+	stage([&]() {
+		session.emplace(std::move(text), widths);
+		progress_index.emplace(session->layout().text);
+		recorder.emplace(*progress_index);
+	});
+
+	return result;
+}
+
+void print_help() {
+	cout << "Usage: ttt-memory-bench [OPTIONS]\n"
+		 << "Measures the peak memory of reading, normalizing, wrapping, and laying out synthetic texts of increasing size, as ttt\n"
+		 << "prepares them by default and with --memory-budget. Memory is given as a multiple of the size of the text.\n"
+		 << "\n"
+		 << "Options:\n"
+		 << "  -h, --help                  Show this help message and exit\n"
+		 << "  --json                      Print the results as JSON\n"
+		 << "  --corpus NAME               Only measure this corpus (ascii, latin, or cjk)\n"
+		 << "  --min-size SIZE             Smallest corpus (default: 1M)\n"
+		 << "  --max-size SIZE             Largest corpus, e.g. 1G (default: 100M). Smaller sizes are 10 times apart.\n"
+		 << "  --max-factor FACTOR         Fail if preparing the text with --memory-budget needs more than FACTOR times its size,\n"
+		 << "                              plus 1 MB for buffers of fixed size (default: 1.2)\n"
+		 << "  --max-session-factor FACTOR Fail if the process with --memory-budget peaks at more than FACTOR times the size of the\n"
+		 << "                              text, plus 1 MB, by the time the session is ready to be typed (default: 18)\n";
+	cout.flush();
+}
+
+int main(const vector<string>& args) {
+	bool print_json = false;
+	vector<Corpus> corpora = CORPORA;
+	size_t min_size = 1'000'000, max_size = 100'000'000;
+	double max_factor = 1.2, max_session_factor = 18;
+	for (size_t i = 1; i < args.size(); i++) {
+		const string& arg = args[i];
+		if (arg == "-h" || arg == "--help") {
+			print_help();
+			return 0;
+		} else if (arg == "--json") {
+			print_json = true;
+		} else if (arg == "--corpus") {
+			const string& name = option_value(args, i);
+			auto it = find_if(CORPORA.begin(), CORPORA.end(), [&](Corpus c) { return corpus_name(c) == name; });
+			if (it == CORPORA.end()) {
+				throw invalid_argument{format("Unknown corpus {}", name)};
+			}
+
+			corpora = {*it};
+		} else if (arg == "--min-size") {
+			min_size = option_number(args, i, parse_size);
+		} else if (arg == "--max-size") {
+			max_size = option_number(args, i, parse_size);
+		} else if (arg == "--max-factor") {
+			max_factor = option_number(args, i, [](const string& s) { return stod(s); });
+		} else if (arg == "--max-session-factor") {
+			max_session_factor = option_number(args, i, [](const string& s) { return stod(s); });
+		} else {
+			throw invalid_argument{format("Unknown option {}", arg)};
+		}
+	}
+
+	if (min_size == 0 || min_size > max_size) {
+		throw invalid_argument{"--min-size must be positive and at most --max-size"};
+	}
+
+	// The text is read from a file, like ttt reads it from stdin, such that it is not held in memory before it is measured
+	filesystem::path path = filesystem::temp_directory_path() / format("ttt-memory-bench-{}", getpid());
+
+	json results = json::array();
+	vector<string> failures;
+	for (Corpus corpus : corpora) {
+		for (size_t size = min_size; size <= max_size; size *= 10) {
+			size_t n_bytes;
+			{
+				string text = make_corpus(corpus, size);
+				n_bytes = text.size();
+				ofstream{path, ios::binary}.write(text.data(), text.size());
+			}
+
+			json modes = json::object();
+			size_t hashes[2];
+			for (bool memory_budget : {false, true}) {
+				string mode = memory_budget ? "memory-budget" : "default";
+				vector<StageResult> stages = measure(path.string(), memory_budget, hashes[memory_budget]);
+
+				// Each stage starts measuring from what the earlier ones left behind, so the highest of them is the peak of the process
+				size_t text_peak = 0, peak = 0;
+				json stages_json = json::object();
+				for (size_t i = 0; i < STAGES.size(); i++) {
+					if (i < TEXT_STAGES) {
+						text_peak = max(text_peak, stages[i].peak);
+					}
+
+					peak = max(peak, stages[i].peak);
+
+					stages_json[STAGES[i]] = {
+						{"peak_bytes", stages[i].peak},
+						{"factor", (double)stages[i].peak / n_bytes},
+						{"seconds", stages[i].seconds},
+					};
+				}
+
+				if (memory_budget && text_peak > max_factor * n_bytes + FIXED_ALLOWANCE) {
+					failures.push_back(format(
+						"preparing {} bytes of {} needs {:.2f} times its size, above the allowed {:.2f}",
+						n_bytes,
+						corpus_name(corpus),
+						(double)text_peak / n_bytes,
+						max_factor
+					));
+				}
+
+				if (memory_budget && peak > max_session_factor * n_bytes + FIXED_ALLOWANCE) {
+					failures.push_back(format(
+						"a session of {} bytes of {} needs {:.2f} times its size, above the allowed {:.2f}",
+						n_bytes,
+						corpus_name(corpus),
+						(double)peak / n_bytes,
+						max_session_factor
+					));
+				}
+
+				modes[mode] = {
+					{"stages", stages_json},
+					{"text_peak_bytes", text_peak},
+					{"text_factor", (double)text_peak / n_bytes},
+					{"peak_bytes", peak},
+					{"factor", (double)peak / n_bytes},
+				};
+
+				if (!print_json) {
+					cout << format("{:<8} {:>10} {:<13}", corpus_name(corpus), n_bytes, mode);
+					for (size_t i = 0; i < STAGES.size(); i++) {
+						cout << format("  {} {:>5.2f}x {:>7.1f} ms", STAGES[i], (double)stages[i].peak / n_bytes, stages[i].seconds * 1e3);
+					}
+
+					cout << format("  text {:>5.2f}x  total {:>5.2f}x", (double)text_peak / n_bytes, (double)peak / n_bytes) << endl;
+				}
+			}
+
+			if (hashes[0] != hashes[1]) {
+				failures.push_back(format("preparing {} bytes of {} with a memory budget yields a different text", n_bytes, corpus_name(corpus)));
+			}
+
+			results.push_back({
+				{"corpus", string{corpus_name(corpus)}},
+				{"bytes", n_bytes},
+				{"modes", modes},
+			});
+		}
+	}
+
+	filesystem::remove(path);
+
+	if (print_json) {
+		cout << json{{"results", results}, {"max_factor", max_factor}, {"max_session_factor", max_session_factor}, {"failures", failures}}.dump(1, '\t') << endl;
+	}
+
+	for (const auto& failure : failures) {
+		cerr << format("ttt-memory-bench: {}", failure) << endl;
+	}
+
+	return failures.empty() ? 0 : 1;
+}
+
+} // namespace ttt
+
+int main(int argc, char* argv[]) {
+	try {
+		return ttt::main({argv, argv + argc});
+	} catch (const exception& e) {
+		cerr << format("ttt-memory-bench: {}", e.what()) << endl;
+		return 1;
+	}
+}
@@ -0,0 +1,279 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+// ttt-microbench: measures the throughput of the Unicode and text primitives on synthetic corpora of various kinds and sizes,
+// optionally as JSON such that runs can be compared by scripts.
+
+#include "corpus.h"
+#include "layout.h"
+#include "layout_cache.h"
+#include "session.h"
+#include "text.h"
+
+#include <json/json.hpp>
+
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <format>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace nlohmann;
+
+namespace ttt {
+
+using Clock = chrono::steady_clock;
+
+// Results are accumulated here, lest the compiler optimize the benchmarked calls away
+volatile size_t g_sink = 0;
+
+// Texts above this size are not turned into typing sessions, whose layouts take dozens of bytes per character
+constexpr size_t MAX_SESSION_SIZE = 10'000'000;
+
+struct Benchmark {
+	string name;
+
+	// Prepares whatever the benchmark needs besides `text`, outside of the measurement, and returns a function that runs the
+	// benchmark once and returns the number of calls it made to the function under test
+	function<function<size_t()>(const string& text)> prepare;
+
+	size_t max_size = SIZE_MAX;
+};
+
+vector<Benchmark> benchmarks() {
+	static const WidthContext widths;
+
+	return {
+		{"utf8_char_length",
+		 [](const string& text) {
+			 return [&text]() {
+				 size_t n = 0, sum = 0;
+				 for (size_t i = 0; i < text.size(); i += utf8_char_length(text[i]), ++n) {
+					 sum += i;
+				 }
+
+				 g_sink = g_sink + sum;
+				 return n;
+			 };
+		 }},
+		{"next_char_pos",
+		 [](const string& text) {
+			 return [&text]() {
+				 size_t n = 0;
+				 for (size_t pos = 0; pos < text.size(); pos = next_char_pos(text, pos)) {
+					 ++n;
+				 }
+
+				 g_sink = g_sink + n;
+				 return n;
+			 };
+		 }},
+		{"prev_char_pos",
+		 [](const string& text) {
+			 return [&text]() {
+				 size_t n = 0;
+				 for (size_t pos = text.size(); pos > 0; pos = prev_char_pos(text, pos)) {
+					 ++n;
+				 }
+
+				 g_sink = g_sink + n;
+				 return n;
+			 };
+		 }},
+		{"char_width",
+		 [](const string& text) {
+			 return [&text]() {
+				 size_t n = 0, sum = 0;
+				 for (size_t pos = 0; pos < text.size(); pos = next_char_pos(text, pos), ++n) {
+					 sum += widths.char_width(decode_char(text, pos));
+				 }
+
+				 g_sink = g_sink + sum;
+				 return n;
+			 };
+		 }},
+		{"find_grapheme_cluster_end",
+		 [](const string& text) {
+			 return [&text]() {
+				 size_t n = 0;
+				 for (size_t pos = 0; pos < text.size(); pos = find_grapheme_cluster_end(text, pos)) {
+					 ++n;
+				 }
+
+				 g_sink = g_sink + n;
+				 return n;
+			 };
+		 }},
+		{"cluster_width",
+		 [](const string& text) {
+			 return [&text]() {
+				 size_t n = 0, sum = 0;
+				 for (size_t pos = 0; pos < text.size(); ++n) {
+					 size_t end = find_grapheme_cluster_end(text, pos);
+					 sum += widths.cluster_width(string_view{text}.substr(pos, end - pos));
+					 pos = end;
+				 }
+
+				 g_sink = g_sink + sum;
+				 return n;
+			 };
+		 }},
+		{"nfd",
+		 [](const string& text) {
+			 return [&text]() {
+				 g_sink = g_sink + nfd(text).size();
+				 return (size_t)1;
+			 };
+		 }},
+		{"wrap_text",
+		 [](const string& text) {
+			 return [&text]() {
+				 g_sink = g_sink + wrap_text(text, 80, widths).size();
+				 return (size_t)1;
+			 };
+		 }},
+		{"hash_bytes",
+		 [](const string& text) {
+			 return [&text]() {
+				 g_sink = g_sink + hash_bytes(text);
+				 return (size_t)1;
+			 };
+		 }},
+		{"for_each_word_segment",
+		 [](const string& text) {
+			 return [&text]() {
+				 size_t n = 0;
+				 for_each_word_segment(text, [&](size_t, size_t) { ++n; });
+				 g_sink = g_sink + n;
+				 return n;
+			 };
+		 }},
+		{"misspelled_words",
+		 [](const string& text) {
+			 // Type the text character by character like a user would, mistyping every 97th character, such that some words of
+			 // every line are misspelled. The session injects indentation after newlines, so its input is followed rather than
+			 // the text.
+			 auto session = make_shared<TypingSession>(nfd(text));
+			 string_view target = session->layout().text;
+			 for (size_t n = 0; !session->complete(); ++n) {
+				 size_t pos = session->input().size();
+				 if (n % 97 == 0 && isalpha((unsigned char)target[pos])) {
+					 session->feed('#');
+					 continue;
+				 }
+
+				 for (size_t end = next_char_pos(target, pos); pos < end; ++pos) {
+					 session->feed(target[pos]);
+				 }
+			 }
+
+			 return [session]() {
+				 g_sink = g_sink + session->stats().misspelled_words.size();
+				 return (size_t)1;
+			 };
+		 },
+		 MAX_SESSION_SIZE},
+	};
+}
+
+void print_help() {
+	cout << "Usage: ttt-microbench [OPTIONS]\n"
+		 << "Measures the throughput of ttt's Unicode and text primitives on synthetic corpora.\n"
+		 << "\n"
+		 << "Options:\n"
+		 << "  -h, --help                  Show this help message and exit\n"
+		 << "  --json                      Print the results as JSON\n"
+		 << "  --filter SUBSTRING          Only run benchmarks whose name or corpus contains SUBSTRING\n"
+		 << "  --max-size SIZE             Largest corpus, e.g. 100M (default: 1M). Sizes go from 100 bytes up in factors of 100.\n"
+		 << "  --min-time SECONDS          Repeat each benchmark for at least this long (default: 0.2)\n";
+	cout.flush();
+}
+
+int main(const vector<string>& args) {
+	bool print_json = false;
+	string filter;
+	size_t max_size = 1'000'000;
+	double min_time = 0.2;
+	for (size_t i = 1; i < args.size(); i++) {
+		const string& arg = args[i];
+		if (arg == "-h" || arg == "--help") {
+			print_help();
+			return 0;
+		} else if (arg == "--json") {
+			print_json = true;
+		} else if (arg == "--filter") {
+			filter = option_value(args, i);
+		} else if (arg == "--max-size") {
+			max_size = option_number(args, i, parse_size);
+		} else if (arg == "--min-time") {
+			min_time = option_number(args, i, [](const string& s) { return stod(s); });
+		} else {
+			throw invalid_argument{format("Unknown option {}", arg)};
+		}
+	}
+
+	json results = json::array();
+	for (size_t size = 100; size <= max_size; size *= 100) {
+		for (Corpus corpus : ALL_CORPORA) {
+			string text = make_corpus(corpus, size);
+			for (const auto& benchmark : benchmarks()) {
+				string name = format("{}/{}/{}", benchmark.name, corpus_name(corpus), size);
+				if (size > benchmark.max_size || name.find(filter) == string::npos) {
+					continue;
+				}
+
+				auto run = benchmark.prepare(text);
+
+				// Repeat until the total time dwarfs the clock's resolution
+				size_t n_iterations = 0, n_calls = 0;
+				auto begin = Clock::now();
+				double seconds = 0;
+				do {
+					n_calls += run();
+					++n_iterations;
+					seconds = chrono::duration<double>(Clock::now() - begin).count();
+				} while (seconds < min_time);
+
+				double mb_per_s = text.size() * n_iterations / seconds / 1e6;
+				double ns_per_call = seconds * 1e9 / max(n_calls, (size_t)1);
+				if (print_json) {
+					results.push_back({
+						{"benchmark", benchmark.name},
+						{"corpus", string{corpus_name(corpus)}},
+						{"bytes", text.size()},
+						{"iterations", n_iterations},
+						{"calls", n_calls / n_iterations},
+						{"seconds", seconds},
+						{"mb_per_s", mb_per_s},
+						{"ns_per_call", ns_per_call},
+					});
+				} else {
+					cout << format("{:<48} {:>10.1f} MB/s {:>14.1f} ns/call", name, mb_per_s, ns_per_call) << endl;
+				}
+			}
+		}
+	}
+
+	if (print_json) {
+		cout << json{{"results", results}}.dump(1, '\t') << endl;
+	}
+
+	return 0;
+}
+
+} // namespace ttt
+
+int main(int argc, char* argv[]) {
+	try {
+		return ttt::main({argv, argv + argc});
+	} catch (const exception& e) {
+		cerr << format("ttt-microbench: {}", e.what()) << endl;
+		return 1;
+	}
+}
@@ -0,0 +1,174 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+#include "net.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <limits>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace ttt {
+
+void UniqueFd::reset(int fd) {
+	if (mFd >= 0) {
+		close(mFd);
+	}
+
+	mFd = fd;
+}
+
+// Parses an address of the form [HOST:]PORT. Returns false if `address` is not of that form and hence a socket path.
+bool parse_tcp_address(const string& address, sockaddr_in& result) {
+	size_t colon = address.rfind(':');
+	string host = colon == string::npos ? "127.0.0.1" : address.substr(0, colon);
+	string port = colon == string::npos ? address : address.substr(colon + 1);
+	if (port.empty() || port.size() > 5 || !all_of(port.begin(), port.end(), [](char c) { return isdigit((unsigned char)c); })) {
+		return false;
+	}
+
+	if (stoul(port) > 65535) {
+		throw invalid_argument{format("Invalid port '{}'", port)};
+	}
+
+	if (host == "localhost") {
+		host = "127.0.0.1";
+	}
+
+	result = {};
+	result.sin_family = AF_INET;
+	result.sin_port = htons((uint16_t)stoul(port));
+	if (inet_pton(AF_INET, host.c_str(), &result.sin_addr) != 1) {
+		throw invalid_argument{format("Invalid host '{}'", host)};
+	}
+
+	// Neither races nor broadcasts authenticate anybody, so they must not be reachable from other machines.
+	if ((ntohl(result.sin_addr.s_addr) >> 24) != 127) {
+		throw invalid_argument{format("Host '{}' is not a loopback address", host)};
+	}
+
+	return true;
+}
+
+sockaddr_un unix_address(const string& path) {
+	sockaddr_un result = {};
+	result.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(result.sun_path)) {
+		throw invalid_argument{format("Socket path '{}' is too long", path)};
+	}
+
+	memcpy(result.sun_path, path.c_str(), path.size() + 1);
+	return result;
+}
+
+UniqueFd listen_socket(const string& address) {
+	sockaddr_in tcp_address;
+	if (parse_tcp_address(address, tcp_address)) {
+		UniqueFd fd{socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+		int one = 1;
+		if (!fd || setsockopt(fd.get(), SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+			bind(fd.get(), (const sockaddr*)&tcp_address, sizeof(tcp_address)) != 0 || listen(fd.get(), SOMAXCONN) != 0) {
+			throw runtime_error{format("Could not listen on {}: {}", address, strerror(errno))};
+		}
+
+		return fd;
+	}
+
+	sockaddr_un path_address = unix_address(address);
+
+	// Remove the socket of a previous server that is no longer running. A socket that still accepts connections is left alone
+	// and makes bind() fail below. Anything other than a socket is never removed.
+	struct stat status;
+	if (lstat(address.c_str(), &status) == 0) {
+		if (!S_ISSOCK(status.st_mode)) {
+			throw runtime_error{format("Could not listen on {}: address in use and not a socket", address)};
+		}
+
+		UniqueFd probe{socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+		if (probe && connect(probe.get(), (const sockaddr*)&path_address, sizeof(path_address)) != 0 && errno == ECONNREFUSED) {
+			unlink(address.c_str());
+		}
+	}
+
+	UniqueFd fd{socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+	if (!fd || bind(fd.get(), (const sockaddr*)&path_address, sizeof(path_address)) != 0 || listen(fd.get(), SOMAXCONN) != 0) {
+		throw runtime_error{format("Could not listen on {}: {}", address, strerror(errno))};
+	}
+
+	return fd;
+}
+
+UniqueFd connect_socket(const string& address) {
+	sockaddr_in tcp_address;
+	if (parse_tcp_address(address, tcp_address)) {
+		UniqueFd fd{socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+		if (!fd || connect(fd.get(), (const sockaddr*)&tcp_address, sizeof(tcp_address)) != 0) {
+			throw runtime_error{format("Could not connect to {}: {}", address, strerror(errno))};
+		}
+
+		// Messages are small and latency matters more than throughput.
+		int one = 1;
+		setsockopt(fd.get(), IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		return fd;
+	}
+
+	sockaddr_un path_address = unix_address(address);
+	UniqueFd fd{socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+	if (!fd || connect(fd.get(), (const sockaddr*)&path_address, sizeof(path_address)) != 0) {
+		throw runtime_error{format("Could not connect to {}: {}", address, strerror(errno))};
+	}
+
+	return fd;
+}
+
+bool is_same_user(int fd) {
+	ucred credentials;
+	socklen_t size = sizeof(credentials);
+	return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &size) == 0 && credentials.uid == getuid();
+}
+
+void set_nonblocking(int fd) {
+	int flags = fcntl(fd, F_GETFL);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0) {
+		throw runtime_error{format("Could not make socket non-blocking: {}", strerror(errno))};
+	}
+}
+
+int remaining_ms(chrono::steady_clock::time_point deadline) {
+	auto remaining = chrono::ceil<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count();
+	return (int)clamp(remaining, (decltype(remaining))0, (decltype(remaining))numeric_limits<int>::max());
+}
+
+void send_all(int fd, string_view data, int timeout_ms) {
+	auto deadline = chrono::steady_clock::now() + chrono::milliseconds{max(timeout_ms, 0)};
+	while (!data.empty()) {
+		ssize_t n = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+		if (n >= 0) {
+			data.remove_prefix(n);
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			pollfd pfd = {fd, POLLOUT, 0};
+			if (poll(&pfd, 1, timeout_ms < 0 ? -1 : remaining_ms(deadline)) == 0) {
+				throw runtime_error{"Could not send: timed out"};
+			}
+		} else if (errno != EINTR) {
+			throw runtime_error{format("Could not send: {}", strerror(errno))};
+		}
+	}
+}
+
+} // namespace ttt
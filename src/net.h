@@ -0,0 +1,80 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+// Sockets and the little-endian encoding shared by ttt's binary protocols.
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace ttt {
+
+// Owns a file descriptor and closes it upon destruction
+class UniqueFd {
+public:
+	UniqueFd() = default;
+	explicit UniqueFd(int fd) : mFd{fd} {}
+	UniqueFd(const UniqueFd& other) = delete;
+	UniqueFd& operator=(const UniqueFd& other) = delete;
+	UniqueFd(UniqueFd&& other) : mFd{std::exchange(other.mFd, -1)} {}
+	UniqueFd& operator=(UniqueFd&& other) {
+		reset(std::exchange(other.mFd, -1));
+		return *this;
+	}
+	~UniqueFd() { reset(); }
+
+	int get() const { return mFd; }
+	explicit operator bool() const { return mFd >= 0; }
+
+	void reset(int fd = -1);
+
+private:
+	int mFd = -1;
+};
+
+// Addresses of the form [HOST:]PORT denote TCP sockets, where HOST must be a loopback address and defaults to 127.0.0.1.
+// Everything else is the path of a Unix domain socket.
+UniqueFd listen_socket(const std::string& address);
+UniqueFd connect_socket(const std::string& address);
+
+void set_nonblocking(int fd);
+
+// Whether the process at the other end of the Unix domain socket `fd` runs as the same user as this one
+bool is_same_user(int fd);
+
+// Sends all of `data`, waiting for the socket to become writable if necessary. Throws if that takes longer than `timeout_ms`
+// in total, unless it is negative.
+void send_all(int fd, std::string_view data, int timeout_ms = -1);
+
+// Milliseconds left until `deadline`, or 0 if it passed
+int remaining_ms(std::chrono::steady_clock::time_point deadline);
+
+template <typename T> void put_le(std::string& out, T value) {
+	for (size_t i = 0; i < sizeof(T); i++) {
+		out.push_back((char)(uint8_t)(value >> (8 * i)));
+	}
+}
+
+// Consumes little-endian integers from the front of a buffer. Callers check `has()` before reading.
+struct ByteReader {
+	std::string_view data;
+
+	bool has(size_t n) const { return data.size() >= n; }
+
+	template <typename T> T get() {
+		T value = 0;
+		for (size_t i = 0; i < sizeof(T); i++) {
+			value |= (T)((T)(uint8_t)data[i] << (8 * i));
+		}
+
+		data.remove_prefix(sizeof(T));
+		return value;
+	}
+};
+
+} // namespace ttt
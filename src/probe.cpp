@@ -0,0 +1,52 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+#include "probe.h"
+
+using namespace std;
+
+namespace ttt {
+
+void LatencyProbe::sent(Clock::time_point time) {
+	if (mNOutstanding == MAX_OUTSTANDING) {
+		mFirst = (mFirst + 1) % MAX_OUTSTANDING;
+		--mNOutstanding;
+	}
+
+	mOutstanding[(mFirst + mNOutstanding++) % MAX_OUTSTANDING] = time;
+}
+
+string_view LatencyProbe::feed(char c, Clock::time_point time) {
+	if (mSize == 0 && (c != 27 || mNOutstanding == 0)) {
+		mReply[0] = c;
+		return {mReply.data(), 1};
+	}
+
+	mReply[mSize++] = c;
+
+	// ESC [ ? followed by digits and semicolons and terminated by c
+	bool is_reply = mSize == 1 || (mSize == 2 && c == '[') || (mSize == 3 && c == '?') ||
+		(mSize > 3 && ((c >= '0' && c <= '9') || c == ';' || c == 'c'));
+	if (!is_reply || (mSize == mReply.size() && c != 'c')) {
+		return flush();
+	}
+
+	if (c == 'c') {
+		mSize = 0;
+		if (mNOutstanding > 0) {
+			mHistogram.record(chrono::duration_cast<chrono::microseconds>(time - mOutstanding[mFirst]).count());
+			mFirst = (mFirst + 1) % MAX_OUTSTANDING;
+			--mNOutstanding;
+		}
+	}
+
+	return {};
+}
+
+string_view LatencyProbe::flush() {
+	string_view result{mReply.data(), mSize};
+	mSize = 0;
+	return result;
+}
+
+} // namespace ttt
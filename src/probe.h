@@ -0,0 +1,57 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+#pragma once
+
+#include "histogram.h"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <string_view>
+
+namespace ttt {
+
+// Measures how long the terminal takes to process ttt's output. A request for the terminal's primary device attributes (DA1)
+// is appended to each frame; terminals answer it only once they have processed everything before it, so the time until the
+// reply arrives on the input is the terminal's latency on top of ttt's own. Replies arrive interleaved with keystrokes and are
+// filtered out of the input here.
+class LatencyProbe {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	// Replies look like ESC [ ? 62 ; 22 c
+	static constexpr std::string_view REQUEST = "\033[c";
+
+	// Notes that REQUEST was written at `time`
+	void sent(Clock::time_point time);
+
+	// Consumes one byte of input, returning the bytes that are not part of a reply and should hence be treated as keystrokes.
+	// An Esc is held back while it might begin a reply, until the next byte or `flush()` tells it apart.
+	std::string_view feed(char c, Clock::time_point time);
+
+	// Whether an Esc is held back
+	bool holding() const { return mSize > 0; }
+
+	// Whether replies are outstanding
+	bool waiting() const { return mNOutstanding > 0; }
+
+	// Returns the bytes held back, e.g. after no reply followed an Esc for a while
+	std::string_view flush();
+
+	// Round trips in microseconds
+	const LogHistogram& histogram() const { return mHistogram; }
+
+private:
+	// Requests whose reply is outstanding, oldest first. Terminals that never reply eventually overwrite the oldest ones.
+	static constexpr size_t MAX_OUTSTANDING = 64;
+	std::array<Clock::time_point, MAX_OUTSTANDING> mOutstanding;
+	size_t mFirst = 0, mNOutstanding = 0;
+
+	std::array<char, 32> mReply;
+	size_t mSize = 0;
+
+	LogHistogram mHistogram;
+};
+
+} // namespace ttt
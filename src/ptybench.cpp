@@ -0,0 +1,547 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+// ttt-pty-bench: runs the real ttt binary under a pseudo-terminal, types texts of increasing size into it like a synthetic
+// typist would, and measures what a terminal would see: how long each keystroke takes to produce its first byte of output,
+// how many bytes each keystroke produces, and how much CPU time ttt spends overall. Optionally, the output is applied to a model
+// of the terminal's screen, which is checked after every keystroke against a full repaint.
+
+#include "corpus.h"
+#include "histogram.h"
+#include "layout.h"
+#include "session.h"
+#include "text.h"
+#include "typist.h"
+#include "vt.h"
+
+#include <json/json.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#	include <util.h>
+#else
+#	include <pty.h>
+#endif
+
+using namespace std;
+using namespace nlohmann;
+
+namespace ttt {
+
+using Clock = chrono::steady_clock;
+
+// ttt is ready for input once its output has been quiet for this long after it started drawing
+constexpr int STARTUP_QUIET_MS = 200;
+
+// Keystrokes that produce no output within this time are counted as unanswered
+constexpr int RESPONSE_TIMEOUT_MS = 1000;
+
+// A repaint is complete once the output has been quiet for this long
+constexpr int REPAINT_QUIET_MS = 20;
+
+constexpr int WRAP_WIDTH = 80;
+
+// ttt running under a pseudo-terminal, reading the target text from a file on its stdin and keystrokes from the terminal
+class PtyProcess {
+public:
+	PtyProcess(const string& binary, const vector<string>& args, const filesystem::path& text_file, const filesystem::path& data_dir, winsize size) {
+		mPid = forkpty(&mFd, nullptr, nullptr, &size);
+		if (mPid < 0) {
+			throw runtime_error{format("forkpty failed: {}", strerror(errno))};
+		}
+
+		if (mPid == 0) {
+			// ttt reads its text from stdin if that is not a terminal, and keystrokes from its controlling terminal, which is the
+			// pseudo-terminal.
+			int fd = open(text_file.c_str(), O_RDONLY);
+			if (fd < 0 || dup2(fd, STDIN_FILENO) < 0) {
+				_exit(127);
+			}
+
+			close(fd);
+			setenv("XDG_DATA_HOME", data_dir.c_str(), 1);
+			setenv("XDG_CACHE_HOME", data_dir.c_str(), 1);
+			setenv("TERM", "xterm-256color", 1);
+
+			vector<char*> argv;
+			argv.push_back(const_cast<char*>(binary.c_str()));
+			for (const auto& arg : args) {
+				argv.push_back(const_cast<char*>(arg.c_str()));
+			}
+
+			argv.push_back(nullptr);
+			execv(binary.c_str(), argv.data());
+			_exit(127);
+		}
+	}
+
+	~PtyProcess() {
+		if (mPid > 0) {
+			kill(mPid, SIGKILL);
+			waitpid(mPid, nullptr, 0);
+		}
+
+		close(mFd);
+	}
+
+	PtyProcess(const PtyProcess&) = delete;
+	PtyProcess& operator=(const PtyProcess&) = delete;
+
+	void write(string_view bytes) {
+		while (!bytes.empty()) {
+			ssize_t n = ::write(mFd, bytes.data(), bytes.size());
+			if (n < 0 && errno != EINTR) {
+				throw runtime_error{format("Failed to write to ttt: {}", strerror(errno))};
+			}
+
+			bytes.remove_prefix(max<ssize_t>(n, 0));
+		}
+	}
+
+	// Waits up to `timeout_ms` (or indefinitely if negative) for output and appends whatever is available to `output`. Returns
+	// the number of bytes read, or nullopt once ttt closed the terminal.
+	optional<size_t> read(string& output, int timeout_ms) {
+		pollfd fd = {mFd, POLLIN, 0};
+		int n_ready = poll(&fd, 1, timeout_ms);
+		if (n_ready < 0) {
+			return errno == EINTR ? optional{(size_t)0} : nullopt;
+		} else if (n_ready == 0) {
+			return 0;
+		}
+
+		array<char, 65536> buffer;
+		ssize_t n = ::read(mFd, buffer.data(), buffer.size());
+		if (n <= 0) {
+			// Linux reports EIO once the other side of the terminal is closed
+			return n < 0 && errno == EINTR ? optional{(size_t)0} : nullopt;
+		}
+
+		output.append(buffer.data(), n);
+		return n;
+	}
+
+	// Waits for ttt to exit and returns the CPU time it used in seconds
+	double wait() {
+		int status;
+		rusage usage;
+		if (wait4(mPid, &status, 0, &usage) < 0) {
+			throw runtime_error{format("Failed to wait for ttt: {}", strerror(errno))};
+		}
+
+		mPid = -1;
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			throw runtime_error{"ttt did not exit cleanly"};
+		}
+
+		auto seconds = [](timeval t) { return t.tv_sec + t.tv_usec * 1e-6; };
+		return seconds(usage.ru_utime) + seconds(usage.ru_stime);
+	}
+
+private:
+	pid_t mPid = -1;
+	int mFd = -1;
+};
+
+struct RunResults {
+	size_t bytes = 0;
+	double first_output_seconds = 0; // Until ttt wrote anything
+	double ready_seconds = 0;        // Until ttt finished drawing the test
+	size_t startup_bytes = 0;
+
+	size_t n_keystrokes = 0;
+	size_t n_unanswered = 0;
+	LogHistogram latency_us; // From each keystroke to the first byte of output it caused
+	LogHistogram output_bytes; // Written in response to each keystroke
+
+	double cpu_seconds = 0;
+	double wall_seconds = 0;
+
+	// Screens that were checked against a full repaint, and how many of them differed from it
+	size_t n_verified = 0;
+	size_t n_mismatches = 0;
+	std::string first_mismatch;
+};
+
+RunResults run(
+	const string& binary,
+	const vector<string>& ttt_args,
+	const string& text,
+	const TypistSettings& settings,
+	size_t max_keystrokes,
+	bool verify,
+	bool warm_cache,
+	winsize size,
+	const filesystem::path& work_dir
+) {
+	filesystem::path text_file = work_dir / "text.txt";
+	ofstream{text_file, ios::binary} << text;
+
+	vector<string> args = {"-w", to_string(WRAP_WIDTH), "--no-history"};
+	args.insert(args.end(), ttt_args.begin(), ttt_args.end());
+
+	// ttt prepares the text the same way, so the model session tells the typist what comes next
+	static const WidthContext widths;
+	string target = wrap_text(nfd(text), WRAP_WIDTH, widths);
+	trim_trailing_whitespace(target);
+	TypingSession model{std::move(target), widths};
+	SyntheticTypist typist{settings, 0};
+
+	// With a warm cache, ttt is started and cancelled once beforehand, such that the measured run loads the layout that the
+	// first one stored
+	if (warm_cache) {
+		PtyProcess primer{binary, args, text_file, work_dir / "data", size};
+		string ignored;
+		while (primer.read(ignored, ignored.empty() ? -1 : STARTUP_QUIET_MS).value_or(0) > 0) {}
+		primer.write("\033");
+		while (primer.read(ignored, -1)) {}
+		primer.wait();
+	}
+
+	RunResults results;
+	results.bytes = text.size();
+
+	string output;
+	auto begin = Clock::now();
+	PtyProcess ttt{binary, args, text_file, work_dir / "data", size};
+	auto since_begin = [&]() { return chrono::duration<double>(Clock::now() - begin).count(); };
+
+	while (output.empty()) {
+		if (!ttt.read(output, -1)) {
+			throw runtime_error{"ttt exited before drawing anything"};
+		}
+	}
+
+	results.first_output_seconds = since_begin();
+	results.ready_seconds = results.first_output_seconds;
+	while (true) {
+		auto n = ttt.read(output, STARTUP_QUIET_MS);
+		if (!n) {
+			throw runtime_error{format("ttt exited during startup: {}", output)};
+		} else if (*n == 0) {
+			break;
+		}
+
+		results.ready_seconds = since_begin();
+	}
+
+	results.startup_bytes = output.size();
+
+	// The screen can only be checked if all of the text fits onto it, because ttt moves the cursor relative to the first line,
+	// which would otherwise have scrolled out of view.
+	optional<VtScreen> screen;
+	if (verify && model.layout().lines.size() < size.ws_row) {
+		screen.emplace(size.ws_col, size.ws_row, widths);
+	}
+
+	// Applies the output to the screen and checks that repainting the whole text with Ctrl+L changes nothing, i.e. that
+	// the partial redraws of the keystrokes so far left the screen as if it had been drawn from scratch
+	auto verify_screen = [&]() {
+		if (!screen) {
+			return;
+		}
+
+		screen->feed(output);
+		VtScreen before = *screen;
+
+		// A repaint places the cursor the same way, so at the end of a line, where lines that mix directions may end on either
+		// side, it is checked to be next to the line's last character or at its edge
+		string misplaced_cursor;
+		const Layout& layout = model.layout();
+		size_t pos = model.cursor(), i = layout.line_of(pos);
+		const auto& line = layout.lines[i];
+		if (pos == line.end && line.cells_end > line.cells_begin && line.width < size.ws_col) {
+			const auto& last = layout.cells[line.cells_end - 1];
+			size_t col = screen->cursor_col();
+			if (col != line.width && col != last.column + last.width && !(col == 0 && last.column == 0)) {
+				misplaced_cursor = format("cursor at column {} at the end of line {}, whose last character is at column {}", col, i, last.column);
+			}
+		}
+
+		string repaint;
+		ttt.write("\x0c");
+		while (ttt.read(repaint, repaint.empty() ? RESPONSE_TIMEOUT_MS : REPAINT_QUIET_MS).value_or(0) > 0) {}
+
+		screen->feed(repaint);
+		++results.n_verified;
+		string difference = before.first_difference(*screen);
+		if (difference.empty()) {
+			difference = misplaced_cursor;
+		}
+
+		if (!difference.empty() && results.n_mismatches++ == 0) {
+			results.first_mismatch = format("after {} keystrokes, at {}", results.n_keystrokes, difference);
+		}
+	};
+
+	// Bytes that begin a multi-byte character are not answered until the character is complete
+	size_t pending_bytes = 0;
+
+	auto due = Clock::now();
+	while (results.n_keystrokes < max_keystrokes && !model.complete()) {
+		auto keystroke = typist.next(model);
+		due += chrono::duration_cast<Clock::duration>(chrono::duration<double>{keystroke.delay});
+
+		// Whatever arrives until the keystroke is due still belongs to the previous one
+		for (auto now = Clock::now(); now < due; now = Clock::now()) {
+			auto remaining = chrono::duration_cast<chrono::milliseconds>(due - now).count();
+			if (!ttt.read(output, (int)max<int64_t>(remaining, 1))) {
+				throw runtime_error{"ttt exited while typing"};
+			}
+		}
+
+		if (results.n_keystrokes > 0) {
+			results.output_bytes.record(output.size());
+		}
+
+		verify_screen();
+		output.clear();
+		model.feed(keystroke.c);
+		auto sent = Clock::now();
+		ttt.write({&keystroke.c, 1});
+		++results.n_keystrokes;
+
+		pending_bytes = pending_bytes > 0 ? pending_bytes - 1 : utf8_char_length(keystroke.c) - 1;
+		if (pending_bytes > 0) {
+			continue;
+		}
+
+		while (output.empty() && Clock::now() - sent < chrono::milliseconds{RESPONSE_TIMEOUT_MS}) {
+			if (!ttt.read(output, RESPONSE_TIMEOUT_MS)) {
+				throw runtime_error{"ttt exited while typing"};
+			}
+		}
+
+		if (output.empty()) {
+			++results.n_unanswered;
+		} else {
+			results.latency_us.record(chrono::duration_cast<chrono::microseconds>(Clock::now() - sent).count());
+		}
+
+		// Don't fall behind the schedule because of slow responses
+		due = max(due, Clock::now());
+	}
+
+	// Collect the last keystroke's output, then cancel or let ttt print its results, and read until it exits
+	while (ttt.read(output, STARTUP_QUIET_MS).value_or(0) > 0) {}
+	results.output_bytes.record(output.size());
+
+	if (!model.complete()) {
+		verify_screen();
+		ttt.write("\033");
+	}
+
+	while (ttt.read(output, -1)) {}
+
+	results.cpu_seconds = ttt.wait();
+	results.wall_seconds = since_begin();
+	return results;
+}
+
+void print_help() {
+	cout << "Usage: ttt-pty-bench [OPTIONS] [-- TTT_ARGS...]\n"
+		 << "Types synthetic texts of increasing size into ttt running under a pseudo-terminal and measures its latency,\n"
+		 << "output, and CPU time.\n"
+		 << "\n"
+		 << "Options:\n"
+		 << "  -h, --help                  Show this help message and exit\n"
+		 << "  --ttt PATH                  The ttt binary to run (default: the one built alongside)\n"
+		 << "  --json                      Print the results as JSON\n"
+		 << "  --corpus NAME               Kind of text: ascii, long-words, latin, cjk, emoji, code, or rtl (default: ascii)\n"
+		 << "  --max-size SIZE             Largest text, e.g. 10M (default: 1M). Sizes go from 1K up in factors of 10.\n"
+		 << "  --keystrokes N              Keystrokes to type into each text (default: 300)\n"
+		 << "  --wpm WPM                   Typing speed (default: 600)\n"
+		 << "  --errors RATE               Probability of mistyping a letter (default: 0.02)\n"
+		 << "  --size COLSxROWS            Size of the terminal (default: 120x40)\n"
+		 << "  --verify                    Check after every keystroke that the screen looks as if ttt had repainted all of it\n"
+		 << "  --warm-cache                Start ttt once before each measured run, such that it loads large texts from its cache\n"
+		 << "\n"
+		 << "Arguments after -- are passed on to ttt.\n";
+	cout.flush();
+}
+
+int main(const vector<string>& args) {
+	string binary = TTT_BINARY;
+	bool print_json = false;
+	bool verify = false;
+	bool warm_cache = false;
+	Corpus corpus = Corpus::Ascii;
+	size_t max_size = 1'000'000;
+	size_t max_keystrokes = 300;
+	TypistSettings settings = {.wpm = 600};
+	winsize size = {};
+	size.ws_row = 40;
+	size.ws_col = 120;
+	vector<string> ttt_args;
+
+	for (size_t i = 1; i < args.size(); i++) {
+		const string& arg = args[i];
+		if (arg == "-h" || arg == "--help") {
+			print_help();
+			return 0;
+		} else if (arg == "--ttt") {
+			binary = option_value(args, i);
+		} else if (arg == "--json") {
+			print_json = true;
+		} else if (arg == "--corpus") {
+			const string& name = option_value(args, i);
+			auto it = find_if(ALL_CORPORA.begin(), ALL_CORPORA.end(), [&](Corpus c) { return corpus_name(c) == name; });
+			if (it == ALL_CORPORA.end()) {
+				throw invalid_argument{format("Unknown corpus {}", name)};
+			}
+
+			corpus = *it;
+		} else if (arg == "--max-size") {
+			max_size = option_number(args, i, parse_size);
+		} else if (arg == "--keystrokes") {
+			max_keystrokes = option_number(args, i, [](const string& s) { return stoul(s); });
+		} else if (arg == "--wpm") {
+			settings.wpm = option_number(args, i, [](const string& s) { return stod(s); });
+		} else if (arg == "--errors") {
+			settings.error_rate = option_number(args, i, [](const string& s) { return stod(s); });
+		} else if (arg == "--size") {
+			size = option_number(args, i, [](const string& s) {
+				size_t x = s.find('x');
+				if (x == string::npos) {
+					throw invalid_argument{"Expected COLSxROWS"};
+				}
+
+				winsize result = {};
+				result.ws_row = (unsigned short)stoul(s.substr(x + 1));
+				result.ws_col = (unsigned short)stoul(s.substr(0, x));
+				return result;
+			});
+		} else if (arg == "--verify") {
+			verify = true;
+		} else if (arg == "--warm-cache") {
+			warm_cache = true;
+		} else if (arg == "--") {
+			ttt_args.assign(args.begin() + i + 1, args.end());
+			break;
+		} else {
+			throw invalid_argument{format("Unknown option {}", arg)};
+		}
+	}
+
+	if (settings.wpm <= 0) {
+		throw invalid_argument{"Typing speed must be positive"};
+	}
+
+	// Each run gets a fresh data directory, such that neither the user's history nor earlier runs affect it
+	filesystem::path work_dir = filesystem::temp_directory_path() / format("ttt-pty-bench-{}", getpid());
+	filesystem::create_directories(work_dir);
+	struct Cleanup {
+		filesystem::path dir;
+		~Cleanup() { filesystem::remove_all(dir); }
+	} cleanup{work_dir};
+
+	json results = json::array();
+	size_t n_mismatches = 0;
+	for (size_t text_size = 1000; text_size <= max_size; text_size *= 10) {
+		filesystem::remove_all(work_dir / "data");
+		RunResults r = run(binary, ttt_args, make_corpus(corpus, text_size), settings, max_keystrokes, verify, warm_cache, size, work_dir);
+		n_mismatches += r.n_mismatches;
+		if (!r.first_mismatch.empty()) {
+			cerr << format("ttt-pty-bench: {}/{}: the screen differs from a full repaint {}", corpus_name(corpus), r.bytes, r.first_mismatch) << endl;
+		}
+
+		if (print_json) {
+			results.push_back({
+				{"corpus", string{corpus_name(corpus)}},
+				{"bytes", r.bytes},
+				{"first_output_ms", r.first_output_seconds * 1e3},
+				{"ready_ms", r.ready_seconds * 1e3},
+				{"startup_output_bytes", r.startup_bytes},
+				{"keystrokes", r.n_keystrokes},
+				{"unanswered", r.n_unanswered},
+				{"latency_us",
+				 {
+					 {"mean", r.latency_us.mean()},
+					 {"p50", r.latency_us.percentile(0.5)},
+					 {"p90", r.latency_us.percentile(0.9)},
+					 {"p99", r.latency_us.percentile(0.99)},
+					 {"max", r.latency_us.max()},
+				 }},
+				{"output_bytes_per_keystroke",
+				 {
+					 {"mean", r.output_bytes.mean()},
+					 {"p50", r.output_bytes.percentile(0.5)},
+					 {"max", r.output_bytes.max()},
+				 }},
+				{"cpu_ms", r.cpu_seconds * 1e3},
+				{"wall_ms", r.wall_seconds * 1e3},
+				{"verified_screens", r.n_verified},
+				{"mismatched_screens", r.n_mismatches},
+			});
+		} else {
+			cout << format("{}/{}", corpus_name(corpus), r.bytes) << "\n";
+			cout << format(
+				"  Startup: first output after {:.1f} ms, ready after {:.1f} ms and {} bytes",
+				r.first_output_seconds * 1e3,
+				r.ready_seconds * 1e3,
+				r.startup_bytes
+			) << "\n";
+			cout << format(
+				"  Keystrokes: {} ({} unanswered), latency (us): mean {:.0f}, p50 {}, p90 {}, p99 {}, max {}",
+				r.n_keystrokes,
+				r.n_unanswered,
+				r.latency_us.mean(),
+				r.latency_us.percentile(0.5),
+				r.latency_us.percentile(0.9),
+				r.latency_us.percentile(0.99),
+				r.latency_us.max()
+			) << "\n";
+			cout << format(
+				"  Output per keystroke (bytes): mean {:.1f}, p50 {}, max {}",
+				r.output_bytes.mean(),
+				r.output_bytes.percentile(0.5),
+				r.output_bytes.max()
+			) << "\n";
+			cout << format("  CPU: {:.1f} ms in {:.2f} s", r.cpu_seconds * 1e3, r.wall_seconds) << endl;
+			if (verify) {
+				cout << (r.n_verified > 0 ? format("  Screen: {} of {} differed from a full repaint", r.n_mismatches, r.n_verified)
+										  : "  Screen: not verified, because the text does not fit onto it")
+					 << endl;
+			}
+		}
+	}
+
+	if (print_json) {
+		cout << json{{"results", results}}.dump(1, '\t') << endl;
+	}
+
+	return n_mismatches > 0 ? 1 : 0;
+}
+
+} // namespace ttt
+
+int main(int argc, char* argv[]) {
+	try {
+		return ttt::main({argv, argv + argc});
+	} catch (const exception& e) {
+		cerr << format("ttt-pty-bench: {}", e.what()) << endl;
+		return 1;
+	}
+}
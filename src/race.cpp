@@ -0,0 +1,442 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+#include "race.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <limits>
+#include <stdexcept>
+#include <tuple>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace ttt {
+
+enum RaceMessage : uint8_t {
+	RACE_WELCOME = 1,
+	RACE_TICK = 2,
+};
+
+constexpr size_t RACE_REPORT_SIZE = 8;
+constexpr size_t RACE_UPDATE_SIZE = 12;
+
+// Racers whose unsent ticks exceed this size are too slow to keep up and get disconnected. The welcome does not count
+// towards it, because it carries the whole text.
+constexpr size_t MAX_PENDING_OUTPUT = 1 << 20;
+
+// epoll tags of the sockets that are not racers. Racer ids start at 1.
+constexpr uint64_t LISTEN_TAG = 0;
+constexpr uint64_t TIMER_TAG = numeric_limits<uint64_t>::max();
+
+RaceProgress RaceProgress::of(const TypingSession& session) {
+	RaceProgress result;
+	result.progress = (uint16_t)(session.cursor() * COMPLETE / max(session.layout().text.size(), (size_t)1));
+	result.errors = (uint16_t)min(session.errors(), (size_t)numeric_limits<uint16_t>::max());
+	result.time_ms = (uint32_t)(session.seconds() * 1000);
+	return result;
+}
+
+void put_progress(string& out, uint32_t id, const RaceProgress& progress) {
+	put_le(out, id);
+	put_le(out, progress.progress);
+	put_le(out, progress.errors);
+	put_le(out, progress.time_ms);
+}
+
+RaceServer::RaceServer(const string& address, string text, chrono::milliseconds tick) : mText{std::move(text)} {
+	mListen = listen_socket(address);
+	set_nonblocking(mListen.get());
+
+	mEpoll = UniqueFd{epoll_create1(EPOLL_CLOEXEC)};
+	mTimer = UniqueFd{timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)};
+	if (!mEpoll || !mTimer) {
+		throw runtime_error{format("Could not set up event loop: {}", strerror(errno))};
+	}
+
+	auto ns = chrono::duration_cast<chrono::nanoseconds>(tick).count();
+	timespec interval = {(time_t)(ns / 1000000000), (long)(ns % 1000000000)};
+	itimerspec spec = {interval, interval};
+	timerfd_settime(mTimer.get(), 0, &spec, nullptr);
+
+	epoll_event listen_event = {EPOLLIN, {.u64 = LISTEN_TAG}};
+	epoll_event timer_event = {EPOLLIN, {.u64 = TIMER_TAG}};
+	epoll_ctl(mEpoll.get(), EPOLL_CTL_ADD, mListen.get(), &listen_event);
+	epoll_ctl(mEpoll.get(), EPOLL_CTL_ADD, mTimer.get(), &timer_event);
+}
+
+void RaceServer::run() {
+	array<epoll_event, 256> events;
+	while (true) {
+		int n = epoll_wait(mEpoll.get(), events.data(), (int)events.size(), -1);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			throw runtime_error{format("epoll_wait failed: {}", strerror(errno))};
+		}
+
+		for (int i = 0; i < n; i++) {
+			uint64_t tag = events[i].data.u64;
+			if (tag == LISTEN_TAG) {
+				accept_racers();
+			} else if (tag == TIMER_TAG) {
+				uint64_t expirations;
+				if (read(mTimer.get(), &expirations, sizeof(expirations)) == sizeof(expirations)) {
+					broadcast_tick();
+				}
+
+				if (!mAccepting) {
+					mAccepting = true;
+					epoll_event listen_event = {EPOLLIN, {.u64 = LISTEN_TAG}};
+					epoll_ctl(mEpoll.get(), EPOLL_CTL_MOD, mListen.get(), &listen_event);
+				}
+			} else {
+				// The racer may have been disconnected by an earlier event of this batch.
+				uint32_t id = (uint32_t)tag;
+				if (!connected(id)) {
+					continue;
+				}
+
+				if (events[i].events & EPOLLOUT) {
+					flush(id);
+				}
+
+				// Flushing disconnects racers whose connection broke, which removes those that did not finish.
+				if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && connected(id)) {
+					receive(id);
+				}
+			}
+		}
+	}
+}
+
+void RaceServer::accept_racers() {
+	while (true) {
+		int fd = accept4(mListen.get(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+
+			// Running out of file descriptors must not bring the race down. The pending connection keeps the listening socket
+			// readable, so it stops being watched until the next tick rather than waking the loop over and over.
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				mAccepting = false;
+				epoll_event listen_event = {0, {.u64 = LISTEN_TAG}};
+				epoll_ctl(mEpoll.get(), EPOLL_CTL_MOD, mListen.get(), &listen_event);
+			}
+
+			return;
+		}
+
+		// Fails harmlessly on Unix domain sockets
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		uint32_t id = mNextId++;
+		Racer& racer = mRacers[id];
+		racer.fd = UniqueFd{fd};
+
+		epoll_event event = {EPOLLIN, {.u64 = id}};
+		epoll_ctl(mEpoll.get(), EPOLL_CTL_ADD, fd, &event);
+
+		// Welcome the racer with the text and the current standings.
+		racer.out.push_back((char)RACE_WELCOME);
+		put_le(racer.out, id);
+		put_le(racer.out, (uint32_t)mText.size());
+		racer.out += mText;
+
+		racer.out.push_back((char)RACE_TICK);
+		put_le(racer.out, (uint32_t)(mRacers.size() - 1));
+		for (const auto& [other_id, other] : mRacers) {
+			if (other_id != id) {
+				put_progress(racer.out, other_id, other.progress);
+			}
+		}
+
+		put_le(racer.out, (uint32_t)0);
+		racer.welcome_left = racer.out.size();
+		flush(id);
+	}
+}
+
+bool RaceServer::connected(uint32_t id) const {
+	auto it = mRacers.find(id);
+	return it != mRacers.end() && it->second.fd;
+}
+
+void RaceServer::receive(uint32_t id) {
+	if (!connected(id)) {
+		return;
+	}
+
+	Racer& racer = mRacers.at(id);
+
+	bool closed = false;
+	char buffer[4096];
+	while (true) {
+		ssize_t n = read(racer.fd.get(), buffer, sizeof(buffer));
+		if (n > 0) {
+			racer.in.append(buffer, n);
+		} else if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break;
+		} else {
+			closed = true;
+			break;
+		}
+	}
+
+	// Only the latest of several reports matters. It is processed even if the racer disconnected right after sending it,
+	// which is what racers do once they finish.
+	size_t n_reports = racer.in.size() / RACE_REPORT_SIZE;
+	if (n_reports > 0) {
+		ByteReader reader{string_view{racer.in}.substr((n_reports - 1) * RACE_REPORT_SIZE)};
+		racer.progress.progress = reader.get<uint16_t>();
+		racer.progress.errors = reader.get<uint16_t>();
+		racer.progress.time_ms = reader.get<uint32_t>();
+		racer.in.erase(0, n_reports * RACE_REPORT_SIZE);
+
+		if (!racer.dirty) {
+			racer.dirty = true;
+			mDirty.push_back(id);
+		}
+	}
+
+	if (closed) {
+		disconnect(id);
+	}
+}
+
+void RaceServer::flush(uint32_t id) {
+	if (!connected(id)) {
+		return;
+	}
+
+	Racer& racer = mRacers.at(id);
+	while (!racer.out.empty()) {
+		ssize_t n = send(racer.fd.get(), racer.out.data(), racer.out.size(), MSG_NOSIGNAL);
+		if (n > 0) {
+			racer.out.erase(0, n);
+			racer.welcome_left -= min((size_t)n, racer.welcome_left);
+		} else if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break;
+		} else {
+			disconnect(id);
+			return;
+		}
+	}
+
+	if (racer.out.size() - racer.welcome_left > MAX_PENDING_OUTPUT) {
+		disconnect(id);
+		return;
+	}
+
+	// Only wait for writability while there is something left to write.
+	bool writing = !racer.out.empty();
+	if (writing != racer.writing) {
+		racer.writing = writing;
+		epoll_event event = {(uint32_t)(writing ? EPOLLIN | EPOLLOUT : EPOLLIN), {.u64 = id}};
+		epoll_ctl(mEpoll.get(), EPOLL_CTL_MOD, racer.fd.get(), &event);
+	}
+}
+
+void RaceServer::disconnect(uint32_t id) {
+	if (!connected(id)) {
+		return;
+	}
+
+	Racer& racer = mRacers.at(id);
+	epoll_ctl(mEpoll.get(), EPOLL_CTL_DEL, racer.fd.get(), nullptr);
+	racer.fd.reset();
+	racer.in.clear();
+	racer.out.clear();
+	racer.welcome_left = 0;
+
+	// Finished racers keep their place in the standings.
+	if (racer.progress.complete()) {
+		return;
+	}
+
+	if (racer.dirty) {
+		mDirty.erase(find(mDirty.begin(), mDirty.end(), id));
+	}
+
+	mRacers.erase(id);
+	mLeft.push_back(id);
+}
+
+void RaceServer::broadcast_tick() {
+	if (mDirty.empty() && mLeft.empty()) {
+		return;
+	}
+
+	// Encode the tick once and share it among all racers.
+	string message;
+	message.push_back((char)RACE_TICK);
+	put_le(message, (uint32_t)mDirty.size());
+	for (uint32_t id : mDirty) {
+		Racer& racer = mRacers.at(id);
+		put_progress(message, id, racer.progress);
+		racer.dirty = false;
+	}
+
+	put_le(message, (uint32_t)mLeft.size());
+	for (uint32_t id : mLeft) {
+		put_le(message, id);
+	}
+
+	mDirty.clear();
+	mLeft.clear();
+
+	vector<uint32_t> ids;
+	for (const auto& [id, racer] : mRacers) {
+		if (racer.fd) {
+			ids.push_back(id);
+		}
+	}
+
+	// Flushing may disconnect racers and thereby modify `mRacers`, hence the copy of the ids.
+	for (uint32_t id : ids) {
+		auto it = mRacers.find(id);
+		if (it != mRacers.end() && it->second.fd) {
+			it->second.out += message;
+			flush(id);
+		}
+	}
+}
+
+RaceClient::RaceClient(const string& address) : mFd{connect_socket(address)} {
+	char buffer[4096];
+	while (!mWelcomed) {
+		ssize_t n = read(mFd.get(), buffer, sizeof(buffer));
+		if (n <= 0) {
+			throw runtime_error{format("Could not join race at {}", address)};
+		}
+
+		mIn.append(buffer, n);
+		while (parse_message()) {}
+	}
+
+	set_nonblocking(mFd.get());
+}
+
+void RaceClient::report(const RaceProgress& progress) {
+	mRacers[mId] = progress;
+
+	string frame;
+	put_le(frame, progress.progress);
+	put_le(frame, progress.errors);
+	put_le(frame, progress.time_ms);
+	send_all(mFd.get(), frame);
+}
+
+void RaceClient::receive() {
+	char buffer[4096];
+	while (true) {
+		ssize_t n = read(mFd.get(), buffer, sizeof(buffer));
+		if (n > 0) {
+			mIn.append(buffer, n);
+		} else if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break;
+		} else {
+			throw runtime_error{"Lost connection to the race server"};
+		}
+	}
+
+	while (parse_message()) {}
+}
+
+bool RaceClient::parse_message() {
+	ByteReader reader{mIn};
+	if (!reader.has(1)) {
+		return false;
+	}
+
+	uint8_t type = reader.get<uint8_t>();
+	if (type == RACE_WELCOME) {
+		if (!reader.has(8)) {
+			return false;
+		}
+
+		uint32_t id = reader.get<uint32_t>();
+		uint32_t text_size = reader.get<uint32_t>();
+		if (!reader.has(text_size)) {
+			return false;
+		}
+
+		mId = id;
+		mText = reader.data.substr(0, text_size);
+		mRacers[id] = {};
+		mWelcomed = true;
+		reader.data.remove_prefix(text_size);
+	} else if (type == RACE_TICK) {
+		if (!reader.has(4)) {
+			return false;
+		}
+
+		uint32_t n_updates = reader.get<uint32_t>();
+		if (!reader.has((size_t)n_updates * RACE_UPDATE_SIZE + 4)) {
+			return false;
+		}
+
+		ByteReader left_reader{reader.data.substr((size_t)n_updates * RACE_UPDATE_SIZE)};
+		uint32_t n_left = left_reader.get<uint32_t>();
+		if (!left_reader.has((size_t)n_left * 4)) {
+			return false;
+		}
+
+		for (uint32_t i = 0; i < n_updates; i++) {
+			uint32_t id = reader.get<uint32_t>();
+			RaceProgress& progress = mRacers[id];
+			progress.progress = reader.get<uint16_t>();
+			progress.errors = reader.get<uint16_t>();
+			progress.time_ms = reader.get<uint32_t>();
+		}
+
+		for (uint32_t i = 0; i < n_left; i++) {
+			mRacers.erase(left_reader.get<uint32_t>());
+		}
+
+		reader = left_reader;
+	} else {
+		throw runtime_error{format("Unknown race message type {}", type)};
+	}
+
+	mIn.erase(0, mIn.size() - reader.data.size());
+	return true;
+}
+
+vector<uint32_t> RaceClient::standings() const {
+	vector<uint32_t> result;
+	for (const auto& [id, progress] : mRacers) {
+		result.push_back(id);
+	}
+
+	auto key = [&](uint32_t id) {
+		const RaceProgress& progress = mRacers.at(id);
+		return make_tuple(!progress.complete(), progress.complete() ? progress.time_ms : 0u, -(int)progress.progress, id);
+	};
+
+	sort(result.begin(), result.end(), [&](uint32_t a, uint32_t b) { return key(a) < key(b); });
+	return result;
+}
+
+} // namespace ttt
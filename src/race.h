@@ -0,0 +1,112 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+// Races of several typists on the same text. A headless server (`ttt --serve`) hands the text to everybody who joins
+// (`ttt --join`) and broadcasts their progress.
+//
+// The protocol is binary and all integers are little endian:
+// - Upon connecting, the server sends WELCOME: u8 type, u32 racer id, u32 text size, the text in NFD.
+// - Racers report their progress in fixed-size frames: u16 progress, u16 errors, u32 time. Progress is the typed fraction
+//   of the text in units of 1/65535, such that racers with different wrap widths agree, and time is in milliseconds since
+//   the racer's first keystroke.
+// - Once per tick, the server sends a single TICK to everybody: u8 type, u32 n, n times (u32 id, u16 progress, u16 errors,
+//   u32 time), u32 m, m times u32 id of a racer that left. Only racers that reported since the previous tick are included.
+//   Reports are thereby coalesced, so the server's load depends on the tick rate rather than on how fast everybody types.
+
+#pragma once
+
+#include "net.h"
+#include "session.h"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ttt {
+
+struct RaceProgress {
+	static constexpr uint16_t COMPLETE = 65535;
+
+	uint16_t progress = 0;
+	uint16_t errors = 0;
+	uint32_t time_ms = 0;
+
+	bool complete() const { return progress == COMPLETE; }
+
+	static RaceProgress of(const TypingSession& session);
+};
+
+// Single-threaded epoll server that runs one race. Racers who finish remain in the standings after they disconnect.
+class RaceServer {
+public:
+	RaceServer(const std::string& address, std::string text, std::chrono::milliseconds tick = std::chrono::milliseconds{50});
+
+	// Serves racers until an error occurs
+	void run();
+
+private:
+	struct Racer {
+		UniqueFd fd;
+		std::string in, out;
+		size_t welcome_left = 0; // How many bytes at the front of `out` belong to the welcome, which is exempt from the output cap
+		RaceProgress progress;
+		bool dirty = false;   // Whether the racer reported since the previous tick
+		bool writing = false; // Whether the racer's socket is watched for writability because `out` did not fit into it
+	};
+
+	void accept_racers();
+
+	// Whether racer `id` is still connected. Racers that did not finish are forgotten once they disconnect.
+	bool connected(uint32_t id) const;
+
+	// These do nothing for racers that are no longer connected.
+	void receive(uint32_t id);
+	void flush(uint32_t id);
+	void disconnect(uint32_t id);
+	void broadcast_tick();
+
+	UniqueFd mListen, mEpoll, mTimer;
+	bool mAccepting = true; // Whether new racers are accepted, which pauses until the next tick when file descriptors run out
+	std::string mText;
+
+	std::unordered_map<uint32_t, Racer> mRacers;
+	std::vector<uint32_t> mDirty, mLeft;
+	uint32_t mNextId = 1;
+};
+
+class RaceClient {
+public:
+	// Connects to the server at `address` and waits for its welcome
+	RaceClient(const std::string& address);
+
+	int fd() const { return mFd.get(); }
+	uint32_t id() const { return mId; }
+	const std::string& text() const { return mText; }
+
+	// The latest known progress of each racer, including ourselves
+	const std::unordered_map<uint32_t, RaceProgress>& racers() const { return mRacers; }
+
+	void report(const RaceProgress& progress);
+
+	// Processes the messages the server has sent so far. Throws if the server went away.
+	void receive();
+
+	// Racer ids from first to last place: finished racers by time, then everybody else by progress
+	std::vector<uint32_t> standings() const;
+
+private:
+	// Consumes the first message of `mIn` if it has been received completely
+	bool parse_message();
+
+	UniqueFd mFd;
+	std::string mIn;
+
+	bool mWelcomed = false;
+	uint32_t mId = 0;
+	std::string mText;
+	std::unordered_map<uint32_t, RaceProgress> mRacers;
+};
+
+} // namespace ttt
@@ -0,0 +1,224 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+#include "rollups.h"
+
+#include "history.h"
+
+#include <algorithm>
+#include <bit>
+#include <format>
+#include <fstream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace ttt {
+
+constexpr int64_t MS_PER_DAY = 24 * 60 * 60 * 1000;
+constexpr uint32_t MAX_WORD_SIZE = 1 << 16;
+
+int32_t Rollups::day_of(int64_t ms) { return (int32_t)(ms >= 0 ? ms / MS_PER_DAY : (ms + 1) / MS_PER_DAY - 1); }
+
+uint32_t Rollups::KeyLatency::percentile_ms(double p) const {
+	uint64_t target = (uint64_t)(p * count);
+	uint64_t seen = 0;
+	for (size_t i = 0; i < buckets.size(); i++) {
+		seen += buckets[i];
+		if (seen > target) {
+			return 1u << i;
+		}
+	}
+
+	return 1u << (buckets.size() - 1);
+}
+
+// The file starts with this header and continues, all native-endian, with `n_days` times (i32 day, u32 histogram[N_WPM_BINS]),
+// N_KEYS times `KeyLatency`, u32 number of heavy hitters and as many times (u32 count, u32 error, u32 size, the word).
+struct RollupsHeader {
+	static constexpr uint32_t MAGIC = 0x41545454; // "TTTA"
+	static constexpr uint32_t VERSION = 1;
+
+	uint32_t magic;
+	uint32_t version;
+	uint32_t n_days;
+	uint32_t reserved;
+};
+
+Rollups Rollups::load(const filesystem::path& path) {
+	Rollups result;
+
+	ifstream in{path, ios::binary};
+	if (!in) {
+		return result;
+	}
+
+	auto read = [&](void* dst, size_t size) {
+		if (!in.read((char*)dst, size)) {
+			throw runtime_error{format("{} is damaged", path.string())};
+		}
+	};
+
+	RollupsHeader header;
+	read(&header, sizeof(header));
+	if (header.magic != RollupsHeader::MAGIC || header.version != RollupsHeader::VERSION) {
+		throw runtime_error{format("{} is damaged", path.string())};
+	}
+
+	for (uint32_t i = 0; i < header.n_days; i++) {
+		int32_t day;
+		read(&day, sizeof(day));
+		read(result.mDays[day].data(), N_WPM_BINS * sizeof(uint32_t));
+	}
+
+	for (auto& key : result.mKeys) {
+		read(&key.count, sizeof(key.count));
+		read(&key.sum_ms, sizeof(key.sum_ms));
+		read(key.buckets.data(), key.buckets.size() * sizeof(uint32_t));
+	}
+
+	uint32_t n_heavy_hitters;
+	read(&n_heavy_hitters, sizeof(n_heavy_hitters));
+	for (uint32_t i = 0; i < min(n_heavy_hitters, (uint32_t)N_HEAVY_HITTERS); i++) {
+		HeavyHitter hitter;
+		uint32_t size;
+		read(&hitter.count, sizeof(hitter.count));
+		read(&hitter.error, sizeof(hitter.error));
+		read(&size, sizeof(size));
+		if (size > MAX_WORD_SIZE) {
+			throw runtime_error{format("{} is damaged", path.string())};
+		}
+
+		hitter.item.resize(size);
+		read(hitter.item.data(), size);
+		result.mHeavyHitters.push_back(std::move(hitter));
+	}
+
+	return result;
+}
+
+void Rollups::save(const filesystem::path& path) const {
+	// Readers such as `tttd` must never see a partially written file, so it is replaced atomically.
+	filesystem::create_directories(path.parent_path());
+	auto tmp_path = path;
+	tmp_path += ".tmp";
+
+	{
+		ofstream out{tmp_path, ios::binary};
+		auto write = [&](const void* src, size_t size) { out.write((const char*)src, size); };
+
+		RollupsHeader header = {RollupsHeader::MAGIC, RollupsHeader::VERSION, (uint32_t)mDays.size(), 0};
+		write(&header, sizeof(header));
+
+		for (const auto& [day, histogram] : mDays) {
+			write(&day, sizeof(day));
+			write(histogram.data(), histogram.size() * sizeof(uint32_t));
+		}
+
+		for (const auto& key : mKeys) {
+			write(&key.count, sizeof(key.count));
+			write(&key.sum_ms, sizeof(key.sum_ms));
+			write(key.buckets.data(), key.buckets.size() * sizeof(uint32_t));
+		}
+
+		uint32_t n_heavy_hitters = (uint32_t)mHeavyHitters.size();
+		write(&n_heavy_hitters, sizeof(n_heavy_hitters));
+		for (const auto& hitter : mHeavyHitters) {
+			uint32_t size = (uint32_t)hitter.item.size();
+			write(&hitter.count, sizeof(hitter.count));
+			write(&hitter.error, sizeof(hitter.error));
+			write(&size, sizeof(size));
+			write(hitter.item.data(), size);
+		}
+
+		if (!out) {
+			throw runtime_error{format("Could not write {}", tmp_path.string())};
+		}
+	}
+
+	filesystem::rename(tmp_path, path);
+}
+
+void Rollups::add(const Recording& recording, const set<string>& misspelled_words) {
+	size_t bin = min((size_t)max(recording.wpm, 0.0), N_WPM_BINS - 1);
+	++mDays[day_of(recording.finished_at)][bin];
+
+	for (size_t i = 1; i < recording.keys.size(); i++) {
+		uint8_t key = (uint8_t)recording.keys[i];
+		if (key >= N_KEYS) {
+			continue;
+		}
+
+		uint32_t latency_ms = recording.times_ms[i] - recording.times_ms[i - 1];
+		KeyLatency& stats = mKeys[key];
+		++stats.count;
+		stats.sum_ms += latency_ms;
+		++stats.buckets[min((size_t)bit_width(latency_ms), N_LATENCY_BUCKETS - 1)];
+	}
+
+	// Space-Saving: words that are not tracked yet replace the least frequent one and inherit its count as their error.
+	for (const auto& word : misspelled_words) {
+		auto it = find_if(mHeavyHitters.begin(), mHeavyHitters.end(), [&](const HeavyHitter& hitter) { return hitter.item == word; });
+		if (it != mHeavyHitters.end()) {
+			++it->count;
+		} else if (mHeavyHitters.size() < N_HEAVY_HITTERS) {
+			mHeavyHitters.push_back({word, 1, 0});
+		} else {
+			auto min_it = min_element(mHeavyHitters.begin(), mHeavyHitters.end(), [](const HeavyHitter& a, const HeavyHitter& b) {
+				return a.count < b.count;
+			});
+
+			*min_it = {word, min_it->count + 1, min_it->count};
+		}
+	}
+}
+
+uint64_t Rollups::n_tests(int64_t from_ms, int64_t to_ms) const {
+	uint64_t result = 0;
+	for_each_day(from_ms, to_ms, [&](const array<uint32_t, N_WPM_BINS>& histogram) {
+		for (uint32_t count : histogram) {
+			result += count;
+		}
+	});
+
+	return result;
+}
+
+vector<double> Rollups::wpm_percentiles(int64_t from_ms, int64_t to_ms, const vector<double>& percentiles) const {
+	array<uint64_t, N_WPM_BINS> histogram = {};
+	uint64_t total = 0;
+	for_each_day(from_ms, to_ms, [&](const array<uint32_t, N_WPM_BINS>& day) {
+		for (size_t i = 0; i < N_WPM_BINS; i++) {
+			histogram[i] += day[i];
+			total += day[i];
+		}
+	});
+
+	vector<double> result;
+	if (total == 0) {
+		return result;
+	}
+
+	for (double p : percentiles) {
+		// Tests are assumed to be spread evenly across each bin.
+		double target = clamp(p, 0.0, 1.0) * total;
+		double seen = 0;
+		size_t i = 0;
+		while (i + 1 < N_WPM_BINS && seen + histogram[i] < target) {
+			seen += histogram[i++];
+		}
+
+		result.push_back(i + (histogram[i] > 0 ? (target - seen) / histogram[i] : 0.0));
+	}
+
+	return result;
+}
+
+vector<Rollups::HeavyHitter> Rollups::heavy_hitters(size_t k) const {
+	vector<HeavyHitter> result = mHeavyHitters;
+	sort(result.begin(), result.end(), [](const HeavyHitter& a, const HeavyHitter& b) { return a.count > b.count; });
+	result.resize(min(k, result.size()));
+	return result;
+}
+
+} // namespace ttt
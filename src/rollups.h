@@ -0,0 +1,83 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace ttt {
+
+struct Recording;
+
+// Aggregates over all recorded tests, updated whenever a test is recorded, such that statistics over the whole history can be
+// queried without reading every recording. All queries take time independent of the number of tests.
+class Rollups {
+public:
+	static constexpr size_t N_WPM_BINS = 256;        // One per WPM; faster tests count towards the last
+	static constexpr size_t N_KEYS = 128;            // ASCII
+	static constexpr size_t N_LATENCY_BUCKETS = 17;  // Bucket i holds latencies of [2^(i-1), 2^i) ms; the last also all slower ones
+	static constexpr size_t N_HEAVY_HITTERS = 64;    // Capacity of the sketch of misspelled words
+
+	struct KeyLatency {
+		uint64_t count = 0;
+		uint64_t sum_ms = 0;
+		std::array<uint32_t, N_LATENCY_BUCKETS> buckets = {};
+
+		// Upper bound of the bucket that contains the `p`th quantile
+		uint32_t percentile_ms(double p) const;
+	};
+
+	struct HeavyHitter {
+		std::string item;
+		uint32_t count; // Overestimates the true count by at most `error`
+		uint32_t error;
+	};
+
+	// Reads rollups from `path`, or returns empty ones if it does not exist. Throws if it is damaged.
+	static Rollups load(const std::filesystem::path& path);
+	void save(const std::filesystem::path& path) const;
+
+	void add(const Recording& recording, const std::set<std::string>& misspelled_words);
+
+	// Number of tests finished within [from_ms, to_ms), in milliseconds since the Unix epoch. Resolution is one day (UTC).
+	uint64_t n_tests(int64_t from_ms, int64_t to_ms) const;
+
+	// WPM at each of `percentiles` (in [0, 1]) among the tests finished within [from_ms, to_ms), or empty if there are none
+	std::vector<double> wpm_percentiles(int64_t from_ms, int64_t to_ms, const std::vector<double>& percentiles) const;
+
+	// Time between pressing the previous key and each ASCII key
+	const std::array<KeyLatency, N_KEYS>& key_latencies() const { return mKeys; }
+
+	// The (at most) `k` most frequently misspelled words, most frequent first. Tracked by the Space-Saving algorithm, which
+	// finds every word that accounts for more than 1/N_HEAVY_HITTERS of all misspellings in constant space.
+	std::vector<HeavyHitter> heavy_hitters(size_t k) const;
+
+private:
+	template <typename F> void for_each_day(int64_t from_ms, int64_t to_ms, F callback) const {
+		if (from_ms >= to_ms) {
+			return;
+		}
+
+		int32_t last_day = day_of(to_ms - 1);
+		for (auto it = mDays.lower_bound(day_of(from_ms)); it != mDays.end() && it->first <= last_day; ++it) {
+			callback(it->second);
+		}
+	}
+
+	static int32_t day_of(int64_t ms);
+
+	// Per-day histograms of WPM, by days since the Unix epoch
+	std::map<int32_t, std::array<uint32_t, N_WPM_BINS>> mDays;
+	std::array<KeyLatency, N_KEYS> mKeys = {};
+	std::vector<HeavyHitter> mHeavyHitters;
+};
+
+} // namespace ttt
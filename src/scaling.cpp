@@ -0,0 +1,215 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+// ttt-scaling: times the preparation of large texts (NFD, wrapping, line splitting, and layout) on synthetic corpora of
+// increasing size and fails if the time of any stage grows superlinearly with the size of the text.
+
+#include "corpus.h"
+#include "layout.h"
+#include "text.h"
+
+#include <json/json.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <format>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+using namespace nlohmann;
+
+namespace ttt {
+
+using Clock = chrono::steady_clock;
+
+// Results are accumulated here, lest the compiler optimize the timed stages away
+volatile size_t g_sink = 0;
+
+constexpr int WRAP_WIDTH = 80;
+
+const vector<Corpus> CORPORA = {Corpus::Ascii, Corpus::LongWords, Corpus::Cjk, Corpus::Code};
+
+// The stages through which a text goes before it can be typed, in order. Each takes the output of the previous one.
+const vector<string> STAGES = {"nfd", "wrap_text", "lines", "layout"};
+
+// Splits the wrapped text into its lines like the layout does before laying out each of them
+vector<string_view> split_lines(const string& text) {
+	vector<string_view> result;
+	for (size_t begin = 0; begin <= text.size();) {
+		size_t end = min(text.find('\n', begin), text.size());
+		result.emplace_back(string_view{text}.substr(begin, end - begin));
+		begin = end + 1;
+	}
+
+	return result;
+}
+
+// Returns the seconds that each stage takes on `text`, the fastest of as many repetitions as fit into `min_time`
+vector<double> time_stages(const string& text, double min_time) {
+	static const WidthContext widths;
+
+	vector<double> result(STAGES.size(), INFINITY);
+	auto begin = Clock::now();
+	do {
+		auto time = [&, stage = (size_t)0](const auto& fun) mutable {
+			auto start = Clock::now();
+			auto output = fun();
+			result[stage] = min(result[stage], chrono::duration<double>(Clock::now() - start).count());
+			++stage;
+			return output;
+		};
+
+		string normalized = time([&]() { return nfd(text); });
+		string wrapped = time([&]() { return wrap_text(normalized, WRAP_WIDTH, widths); });
+		g_sink = g_sink + time([&]() { return split_lines(wrapped); }).size();
+
+		// The layout takes ownership of its text, which must hence be copied outside of the measurement
+		string copy = wrapped;
+		g_sink = g_sink + time([&]() { return Layout{std::move(copy), widths}; }).cells.size();
+	} while (chrono::duration<double>(Clock::now() - begin).count() < min_time);
+
+	return result;
+}
+
+// Least-squares fit of log(seconds) = log(c) + exponent * log(size); returns the exponent
+double fit_exponent(const vector<size_t>& sizes, const vector<double>& seconds) {
+	double n = sizes.size(), sx = 0, sy = 0, sxx = 0, sxy = 0;
+	for (size_t i = 0; i < sizes.size(); i++) {
+		double x = log((double)sizes[i]), y = log(seconds[i]);
+		sx += x;
+		sy += y;
+		sxx += x * x;
+		sxy += x * y;
+	}
+
+	return (n * sxy - sx * sy) / (n * sxx - sx * sx);
+}
+
+void print_help() {
+	cout << "Usage: ttt-scaling [OPTIONS]\n"
+		 << "Times NFD, wrapping, line splitting, and layout on synthetic corpora of increasing size and fails if any stage\n"
+		 << "scales superlinearly.\n"
+		 << "\n"
+		 << "Options:\n"
+		 << "  -h, --help                  Show this help message and exit\n"
+		 << "  --json                      Print the results as JSON\n"
+		 << "  --min-size SIZE             Smallest corpus (default: 10K)\n"
+		 << "  --max-size SIZE             Largest corpus, e.g. 64M (default: 4M). Smaller sizes are 4 times apart.\n"
+		 << "  --min-time SECONDS          Repeat each size for at least this long and keep the fastest time (default: 0.2)\n"
+		 << "  --max-exponent EXPONENT     Fail if time grows faster than size^EXPONENT (default: 1.5)\n";
+	cout.flush();
+}
+
+int main(const vector<string>& args) {
+	bool print_json = false;
+	size_t min_size = 10'000, max_size = 4'000'000;
+	double min_time = 0.2, max_exponent = 1.5;
+	for (size_t i = 1; i < args.size(); i++) {
+		const string& arg = args[i];
+		if (arg == "-h" || arg == "--help") {
+			print_help();
+			return 0;
+		} else if (arg == "--json") {
+			print_json = true;
+		} else if (arg == "--min-size") {
+			min_size = option_number(args, i, parse_size);
+		} else if (arg == "--max-size") {
+			max_size = option_number(args, i, parse_size);
+		} else if (arg == "--min-time") {
+			min_time = option_number(args, i, [](const string& s) { return stod(s); });
+		} else if (arg == "--max-exponent") {
+			max_exponent = option_number(args, i, [](const string& s) { return stod(s); });
+		} else {
+			throw invalid_argument{format("Unknown option {}", arg)};
+		}
+	}
+
+	if (min_size == 0 || min_size * 4 > max_size) {
+		throw invalid_argument{"At least two sizes are needed to fit the scaling: --max-size must be at least 4 times --min-size"};
+	}
+
+	// Sizes grow in factors of 4 up to exactly the largest one
+	vector<size_t> size_steps;
+	for (size_t size = max_size; size >= min_size; size /= 4) {
+		size_steps.insert(size_steps.begin(), size);
+	}
+
+	json results = json::array();
+	vector<string> failures;
+	for (Corpus corpus : CORPORA) {
+		vector<size_t> sizes;
+		vector<vector<double>> seconds(STAGES.size() + 1);
+		for (size_t size : size_steps) {
+			string text = make_corpus(corpus, size);
+			vector<double> stage_seconds = time_stages(text, min_time);
+
+			sizes.push_back(text.size());
+			double total = 0;
+			for (size_t i = 0; i < STAGES.size(); i++) {
+				seconds[i].push_back(stage_seconds[i]);
+				total += stage_seconds[i];
+			}
+
+			seconds.back().push_back(total);
+			if (!print_json) {
+				cout << format("{:<12} {:>10}", corpus_name(corpus), text.size());
+				for (size_t i = 0; i < STAGES.size(); i++) {
+					cout << format("  {} {:>9.2f} ms", STAGES[i], stage_seconds[i] * 1e3);
+				}
+
+				cout << format("  total {:>9.2f} ms ({:.1f} MB/s)", total * 1e3, text.size() / total / 1e6) << endl;
+			}
+		}
+
+		json stages = json::object();
+		for (size_t i = 0; i <= STAGES.size(); i++) {
+			string stage = i < STAGES.size() ? STAGES[i] : "total";
+			double exponent = fit_exponent(sizes, seconds[i]);
+			if (exponent > max_exponent) {
+				failures.push_back(format("{} on {} scales as size^{:.2f}", stage, corpus_name(corpus), exponent));
+			}
+
+			stages[stage] = {
+				{"seconds", seconds[i]},
+				{"exponent", exponent},
+			};
+
+			if (!print_json) {
+				cout << format("{:<12} {:<10} scales as size^{:.2f}", corpus_name(corpus), stage, exponent) << endl;
+			}
+		}
+
+		results.push_back({
+			{"corpus", string{corpus_name(corpus)}},
+			{"bytes", sizes},
+			{"stages", stages},
+		});
+	}
+
+	if (print_json) {
+		cout << json{{"results", results}, {"max_exponent", max_exponent}, {"failures", failures}}.dump(1, '\t') << endl;
+	}
+
+	for (const auto& failure : failures) {
+		cerr << format("ttt-scaling: {}, above the allowed size^{:.2f}", failure, max_exponent) << endl;
+	}
+
+	return failures.empty() ? 0 : 1;
+}
+
+} // namespace ttt
+
+int main(int argc, char* argv[]) {
+	try {
+		return ttt::main({argv, argv + argc});
+	} catch (const exception& e) {
+		cerr << format("ttt-scaling: {}", e.what()) << endl;
+		return 1;
+	}
+}
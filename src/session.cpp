@@ -0,0 +1,193 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+#include "session.h"
+#include "text.h"
+
+#include <cctype>
+
+using namespace std;
+
+namespace ttt {
+
+// Whether the combining marks of the character at the beginning of `typed` appear among those of the character at the
+// beginning of `target`, in the same order. Both are in NFD, so marks that were typed in any order are in canonical order.
+bool are_marks_of(string_view typed, string_view target) {
+	size_t j = next_char_pos(target, 0);
+	for (size_t i = next_char_pos(typed, 0); i < typed.size(); i = next_char_pos(typed, i)) {
+		char32_t mark = decode_char(typed, i);
+		while (j < target.size() && is_combining_char(target, j) && decode_char(target, j) != mark) {
+			j = next_char_pos(target, j);
+		}
+
+		if (j >= target.size() || !is_combining_char(target, j)) {
+			return false;
+		}
+
+		j = next_char_pos(target, j);
+	}
+
+	return true;
+}
+
+TypingSession::FrameDiff TypingSession::feed(char c, Clock::time_point time) {
+	if (!mStarted) {
+		mStartTime = time;
+		mStarted = true;
+	}
+
+	const Layout& layout = mLayout;
+	size_t prev_size = mInput.size();
+
+	if (c == 27) { // Esc
+		mCancelled = true;
+		return {1, 0};
+	} else if (c == 127) { // Backspace
+		// Line breaks within hyphenated words are typed automatically and are hence deleted along with the character before them.
+		if (mInput.ends_with(SOFT_HYPHEN_BREAK)) {
+			erase_input(mInput.size() - SOFT_HYPHEN_BREAK.size());
+		}
+
+		// Delete combining characters together with their base character.
+		size_t prev = prev_char_pos(mInput, mInput.length());
+		while (prev > 0 && is_combining_char(mInput, prev)) {
+			prev = prev_char_pos(mInput, prev);
+		}
+
+		erase_input(prev);
+	} else if (c == 18) { // Ctrl-R (reset test)
+		reset();
+	} else if (c == 23 || c == 8) { // Ctrl-W or Ctrl+Backspace (delete word)
+		// Jump back to the previous word boundary of the target text, making sure not to cut a typed character in half.
+		size_t stop = layout.prev_word_stop(mInput.size());
+		while (stop > 0 && is_utf8_continuation(mInput[stop])) {
+			stop--;
+		}
+
+		erase_input(stop);
+	} else if (mInput.size() < layout.text.size() && layout.text[mInput.size()] == '\n' && isspace(c)) {
+		// Let the user press space instead of newline
+		append_input("\n");
+
+		// If there is a subsequent line in the target, inject its leading whitespace.
+		string_view next_line = layout.line_text(layout.line_of(mInput.size()));
+		append_input(next_line.substr(0, next_line.find_first_not_of(" \t")));
+	} else {
+		if (isspace(c)) {
+			c = ' ';
+		}
+
+		mPending.push_back(c);
+		if (mPending.size() < (size_t)utf8_char_length(mPending[0])) {
+			return {1, 0};
+		}
+
+		string typed = nfd(mPending);
+		mPending.clear();
+
+		// Combining marks are in canonical order only if they are normalized together with the others on the same character,
+		// e.g. a + U+0301 + U+0323 becomes a + U+0323 + U+0301. Hence a mark is normalized anew along with its character.
+		size_t begin = mInput.size(), base = begin;
+		if (is_combining_char(typed, 0)) {
+			while (base > 0) {
+				base = prev_char_pos(mInput, base);
+				if (!is_combining_char(mInput, base)) {
+					break;
+				}
+			}
+		}
+
+		if (base < begin && !is_combining_char(mInput, base)) {
+			string sequence = nfd(mInput.substr(base) + typed);
+			erase_input(base);
+			append_input(sequence);
+
+			// A mark is only wrong if the text's character lacks it, besides the marks typed before
+			if (base >= layout.text.size() || !are_marks_of(string_view{mInput}.substr(base), layout.text.substr(base))) {
+				++mErrors;
+			}
+		} else {
+			append_input(typed);
+			if (begin >= layout.text.size() || layout.text.compare(begin, mInput.size() - begin, mInput, begin, mInput.size() - begin) != 0) {
+				++mErrors;
+			}
+		}
+
+		if (layout.text.compare(mInput.size(), SOFT_HYPHEN_BREAK.size(), SOFT_HYPHEN_BREAK) == 0) {
+			append_input(SOFT_HYPHEN_BREAK);
+		}
+	}
+
+	if (complete()) {
+		mEndTime = time;
+	}
+
+	// Only the lines spanned by the edit changed.
+	return {
+		layout.line_of(min({prev_size, mInput.size(), layout.text.size()})),
+		layout.line_of(min(max(prev_size, mInput.size()), layout.text.size())),
+	};
+}
+
+void TypingSession::reset() {
+	mStarted = false;
+	mInput.clear();
+	mPending.clear();
+	mErrors = 0;
+	mNCorrect = 0;
+}
+
+size_t TypingSession::count_correct(size_t begin, size_t end) const {
+	size_t n = 0;
+	for (size_t i = begin; i < min(end, mLayout.text.size()); i++) {
+		n += mLayout.text[i] == mInput[i];
+	}
+
+	return n;
+}
+
+void TypingSession::erase_input(size_t pos) {
+	mNCorrect -= count_correct(pos, mInput.size());
+	mInput.erase(pos);
+}
+
+void TypingSession::append_input(string_view str) {
+	size_t begin = mInput.size();
+	mInput += str;
+	mNCorrect += count_correct(begin, mInput.size());
+}
+
+double TypingSession::seconds(Clock::time_point time) const {
+	if (!mStarted) {
+		return 0;
+	}
+
+	return chrono::duration<double>((complete() ? mEndTime : time) - mStartTime).count();
+}
+
+double TypingSession::accuracy() const {
+	size_t n_typed = cursor();
+	return n_typed == 0 ? 100.0 : (static_cast<double>(mNCorrect) / n_typed) * 100.0;
+}
+
+TypingSession::Stats TypingSession::stats(Clock::time_point time) const {
+	const Layout& layout = mLayout;
+
+	Stats result = {};
+	result.seconds = seconds(time);
+	if (result.seconds > 0) {
+		result.wpm = (cursor() / 5.0) / (result.seconds / 60.0);
+	}
+
+	result.accuracy = accuracy();
+
+	for (const auto& [begin, end] : layout.words) {
+		if (mInput.size() < end || mInput.compare(begin, end - begin, layout.text, begin, end - begin) != 0) {
+			result.misspelled_words.insert(string{layout.text.substr(begin, end - begin)});
+		}
+	}
+
+	return result;
+}
+
+} // namespace ttt
@@ -0,0 +1,103 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+#pragma once
+
+#include "layout.h"
+
+#include <algorithm>
+#include <chrono>
+#include <set>
+#include <string>
+#include <string_view>
+
+namespace ttt {
+
+// A single typing test: the target text and what the user typed so far. Frontends feed the session the bytes the user types
+// and redraw the lines it reports as changed; the session itself performs no I/O.
+class TypingSession {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	// The lines [first_line, last_line] whose display changed due to an event
+	struct FrameDiff {
+		size_t first_line, last_line;
+		bool empty() const { return first_line > last_line; }
+
+		// Extends the range to also cover `other`
+		void merge(const FrameDiff& other) {
+			if (empty()) {
+				*this = other;
+			} else if (!other.empty()) {
+				first_line = std::min(first_line, other.first_line);
+				last_line = std::max(last_line, other.last_line);
+			}
+		}
+	};
+
+	struct Stats {
+		double seconds;
+		double wpm;
+		double accuracy; // Percentage of correctly typed bytes
+		std::set<std::string> misspelled_words;
+	};
+
+	TypingSession(std::string target, const WidthContext& widths = {}) : mLayout{std::move(target), widths} {}
+	TypingSession(Layout layout) : mLayout{std::move(layout)} {}
+
+	// Processes a byte typed by the user at `time`. Control characters trigger the corresponding shortcuts: Esc cancels the
+	// test, Ctrl+R resets it, and Backspace and Ctrl+W delete the previous character and word, respectively.
+	FrameDiff feed(char c, Clock::time_point time = Clock::now());
+
+	// Clears the user's input and stops the timer
+	void reset();
+
+	const Layout& layout() const { return mLayout; }
+
+	// The user's input in NFD, such that it can be compared bytewise with the target
+	const std::string& input() const { return mInput; }
+
+	// Byte offset within the target text at which the next character will be typed
+	size_t cursor() const { return std::min(mInput.size(), mLayout.text.size()); }
+
+	bool started() const { return mStarted; }
+	bool complete() const { return mInput.size() >= mLayout.text.size(); }
+	bool cancelled() const { return mCancelled; }
+
+	// Number of characters that were typed incorrectly, including those that have since been corrected
+	size_t errors() const { return mErrors; }
+
+	// Seconds since the first keystroke until `time` or, if the test is complete, until its completion
+	double seconds(Clock::time_point time = Clock::now()) const;
+
+	// Number of bytes up to the cursor that match the text, and those that do not
+	size_t correct() const { return mNCorrect; }
+	size_t incorrect() const { return cursor() - mNCorrect; }
+
+	// Percentage of correctly typed bytes. Constant time, such that it can be reported after every keystroke.
+	double accuracy() const;
+
+	// Statistics of the test at `time` or, if the test is complete, at the time of its completion
+	Stats stats(Clock::time_point time = Clock::now()) const;
+
+private:
+	// Number of bytes in [begin, end) of the input that match the text
+	size_t count_correct(size_t begin, size_t end) const;
+
+	// The input is only ever changed at its end, through these, which keep `mNCorrect` up to date
+	void erase_input(size_t pos);
+	void append_input(std::string_view str);
+
+	Layout mLayout;
+
+	std::string mInput;
+	std::string mPending; // Bytes of a partially received UTF-8 character
+
+	bool mStarted = false;
+	bool mCancelled = false;
+	size_t mErrors = 0;
+	size_t mNCorrect = 0; // Bytes of the input before the cursor that match the text
+	Clock::time_point mStartTime, mEndTime;
+};
+
+} // namespace ttt
@@ -0,0 +1,93 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+#include "shared_stats.h"
+
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <new>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace ttt {
+
+// How many names `SharedStatsPublisher` tries before giving up
+constexpr size_t MAX_NAME_ATTEMPTS = 100;
+
+SharedStatsPublisher::SharedStatsPublisher() {
+	// The segment is always created anew and readable only by the typist. A segment of the same name was left behind by a ttt
+	// that crashed or planted by somebody else; either way, it is not touched and the next free name is taken instead.
+	int fd = -1;
+	for (size_t i = 0; fd < 0; i++) {
+		mName = i == 0 ? format("/ttt-{}", getpid()) : format("/ttt-{}-{}", getpid(), i);
+		fd = shm_open(mName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+		if (fd < 0 && (errno != EEXIST || i >= MAX_NAME_ATTEMPTS)) {
+			throw runtime_error{format("Could not create shared memory /dev/shm{}: {}", mName, strerror(errno))};
+		}
+	}
+
+	if (ftruncate(fd, sizeof(SharedStats)) != 0) {
+		close(fd);
+		shm_unlink(mName.c_str());
+		throw runtime_error{format("Could not resize shared memory /dev/shm{}: {}", mName, strerror(errno))};
+	}
+
+	void* data = mmap(nullptr, sizeof(SharedStats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		shm_unlink(mName.c_str());
+		throw runtime_error{format("Could not map shared memory /dev/shm{}: {}", mName, strerror(errno))};
+	}
+
+	// The file is zero-filled, which is a valid state with sequence 0. The magic number is written last such that readers
+	// that check it see the version, too.
+	mStats = new (data) SharedStats{};
+	mStats->version = SharedStats::VERSION;
+	mStats->pid = (uint32_t)getpid();
+	atomic_thread_fence(memory_order_release);
+	mStats->magic = SharedStats::MAGIC;
+}
+
+SharedStatsPublisher::~SharedStatsPublisher() {
+	munmap(mStats, sizeof(SharedStats));
+	shm_unlink(mName.c_str());
+}
+
+void SharedStatsPublisher::publish(const TypingSession& session, TypingSession::Clock::time_point time) {
+	// Everything is computed before entering the critical section to keep it short.
+	double seconds = session.seconds(time);
+	double accuracy = session.accuracy();
+	double wpm = seconds > 0 ? (session.cursor() / 5.0) / (seconds / 60.0) : 0.0;
+	uint32_t state = session.cancelled() ? 3 : session.complete() ? 2 : session.started() ? 1 : 0;
+
+	uint32_t latency_us = 0;
+	if (mLastTime) {
+		latency_us = (uint32_t)min(chrono::duration_cast<chrono::microseconds>(time - *mLastTime).count(), (int64_t)UINT32_MAX);
+	}
+
+	mLastTime = time;
+
+	uint64_t sequence = mStats->sequence.load(memory_order_relaxed);
+	mStats->sequence.store(sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	mStats->state = state;
+	mStats->seconds = seconds;
+	mStats->wpm = wpm;
+	mStats->accuracy = accuracy;
+	mStats->errors = session.errors();
+	mStats->position = session.cursor();
+	mStats->text_size = session.layout().text.size();
+	mStats->latencies_us[mStats->n_keys % SharedStats::N_LATENCIES] = latency_us;
+	mStats->n_keys++;
+
+	mStats->sequence.store(sequence + 2, memory_order_release);
+}
+
+} // namespace ttt
@@ -0,0 +1,67 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+// Live statistics of a running test in shared memory (`ttt --shared-stats`), for overlays and dashboards that poll them.
+
+#pragma once
+
+#include "session.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace ttt {
+
+// Layout of the segment /dev/shm/ttt-<pid>, or /dev/shm/ttt-<pid>-<n> if that name was taken, which only the user running ttt
+// can read. All fields are native-endian and naturally aligned, such that readers in any language can map the file and
+// access them at fixed offsets.
+//
+// The segment is guarded by a seqlock: `sequence` is odd while the typist updates the other fields. Readers copy the
+// fields between two reads of `sequence` and retry unless both reads returned the same even value. Readers never write and
+// thus never delay the typist.
+struct SharedStats {
+	static constexpr uint32_t MAGIC = 0x53545454; // "TTTS"
+	static constexpr uint32_t VERSION = 1;
+	static constexpr size_t N_LATENCIES = 64;
+
+	uint32_t magic;
+	uint32_t version;
+	std::atomic<uint64_t> sequence;
+
+	uint32_t pid;
+	uint32_t state; // 0: not started, 1: typing, 2: complete, 3: cancelled
+	double seconds;
+	double wpm;
+	double accuracy;
+	uint64_t errors;
+	uint64_t position;                  // Bytes typed
+	uint64_t text_size;                 // Bytes in the text
+	uint64_t n_keys;                    // Keystrokes so far
+	uint32_t latencies_us[N_LATENCIES]; // Time since the previous keystroke (0 for the first); the latest is at (n_keys - 1) % N_LATENCIES
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+static_assert(sizeof(SharedStats) == 336, "The layout of SharedStats is part of its interface");
+
+// Creates the segment upon construction and removes it upon destruction
+class SharedStatsPublisher {
+public:
+	SharedStatsPublisher();
+	~SharedStatsPublisher();
+
+	SharedStatsPublisher(const SharedStatsPublisher& other) = delete;
+	SharedStatsPublisher& operator=(const SharedStatsPublisher& other) = delete;
+
+	// Updates the segment after a byte was fed into `session` at `time`
+	void publish(const TypingSession& session, TypingSession::Clock::time_point time);
+
+private:
+	std::string mName;
+	SharedStats* mStats = nullptr;
+	std::optional<TypingSession::Clock::time_point> mLastTime;
+};
+
+} // namespace ttt
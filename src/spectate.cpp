@@ -0,0 +1,307 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+#include "spectate.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace ttt {
+
+void RingBuffer::append(string_view data) {
+	// Only the last `capacity` bytes survive anyway.
+	if (data.size() > mData.size()) {
+		mHead += data.size() - mData.size();
+		data.remove_prefix(data.size() - mData.size());
+	}
+
+	size_t offset = mHead % mData.size();
+	size_t first = min(data.size(), mData.size() - offset);
+	memcpy(mData.data() + offset, data.data(), first);
+	memcpy(mData.data(), data.data() + first, data.size() - first);
+	mHead += data.size();
+}
+
+array<string_view, 2> RingBuffer::read(uint64_t pos) const {
+	size_t size = mHead - pos;
+	size_t offset = pos % mData.size();
+	size_t first = min(size, mData.size() - offset);
+	return {
+		string_view{mData.data() + offset, first},
+		string_view{mData.data(), size - first},
+	};
+}
+
+// epoll tags of the sockets that are not spectators
+constexpr uint64_t LISTEN_TAG = UINT64_MAX;
+constexpr uint64_t WAKE_TAG = UINT64_MAX - 1;
+
+// How long to stop accepting spectators after running out of file descriptors
+constexpr int ACCEPT_BACKOFF_MS = 100;
+
+SpectatorServer::SpectatorServer(const string& address, string text, size_t capacity) : mRing{capacity} {
+	put_le(mHeader, (uint32_t)text.size());
+	mHeader += text;
+
+	mListen = listen_socket(address);
+	set_nonblocking(mListen.get());
+
+	mEpoll = UniqueFd{epoll_create1(EPOLL_CLOEXEC)};
+	mWake = UniqueFd{eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)};
+	if (!mEpoll || !mWake) {
+		throw runtime_error{format("Could not set up event loop: {}", strerror(errno))};
+	}
+
+	epoll_event listen_event = {EPOLLIN, {.u64 = LISTEN_TAG}};
+	epoll_event wake_event = {EPOLLIN, {.u64 = WAKE_TAG}};
+	epoll_ctl(mEpoll.get(), EPOLL_CTL_ADD, mListen.get(), &listen_event);
+	epoll_ctl(mEpoll.get(), EPOLL_CTL_ADD, mWake.get(), &wake_event);
+
+	mThread = thread{[this] { run(); }};
+}
+
+SpectatorServer::~SpectatorServer() {
+	mStop = true;
+	wake();
+	mThread.join();
+}
+
+void SpectatorServer::wake() {
+	// Fails only if the counter would overflow, in which case the thread is woken up all the same.
+	uint64_t one = 1;
+	[[maybe_unused]] ssize_t n = write(mWake.get(), &one, sizeof(one));
+}
+
+void SpectatorServer::publish(char c, TypingSession::Clock::time_point time) {
+	{
+		lock_guard lock{mMutex};
+
+		uint64_t delay_ms = mLastTime ? chrono::duration_cast<chrono::milliseconds>(time - *mLastTime).count() : 0;
+		mLastTime = time;
+
+		// A reset makes everything before it irrelevant to spectators who join later.
+		if (c == 18) {
+			mSync = mPublished;
+		}
+
+		size_t size = mPending.size();
+		do {
+			mPending.push_back((char)((delay_ms & 0x7F) | (delay_ms >= 0x80 ? 0x80 : 0)));
+			delay_ms >>= 7;
+		} while (delay_ms > 0);
+
+		mPending.push_back(c);
+		mPublished += mPending.size() - size;
+	}
+
+	wake();
+}
+
+void SpectatorServer::run() {
+	array<epoll_event, 64> events;
+	while (true) {
+		int n = epoll_wait(mEpoll.get(), events.data(), (int)events.size(), mAccepting ? -1 : ACCEPT_BACKOFF_MS);
+		if (!mAccepting) {
+			mAccepting = true;
+			epoll_event listen_event = {EPOLLIN, {.u64 = LISTEN_TAG}};
+			epoll_ctl(mEpoll.get(), EPOLL_CTL_MOD, mListen.get(), &listen_event);
+		}
+
+		for (int i = 0; i < n; i++) {
+			uint64_t tag = events[i].data.u64;
+			if (tag == LISTEN_TAG) {
+				accept_spectators();
+			} else if (tag == WAKE_TAG) {
+				uint64_t count;
+				if (read(mWake.get(), &count, sizeof(count)) > 0) {
+					lock_guard lock{mMutex};
+					drain();
+				}
+			} else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+				for (auto& spectator : mSpectators) {
+					if (spectator.fd.get() == (int)tag) {
+						spectator.fd.reset();
+					}
+				}
+			}
+		}
+
+		// Remaining frames are sent on a best-effort basis once the session is over.
+		bool stop = mStop;
+		for (auto& spectator : mSpectators) {
+			if (spectator.fd) {
+				flush(spectator);
+			}
+		}
+
+		erase_if(mSpectators, [](const Spectator& spectator) { return !spectator.fd; });
+		if (stop) {
+			break;
+		}
+	}
+}
+
+void SpectatorServer::drain() {
+	// Frames are encoded once and then sent to everybody.
+	mRing.append(mPending);
+	mPending.clear();
+}
+
+void SpectatorServer::accept_spectators() {
+	while (true) {
+		int fd = accept4(mListen.get(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+
+			// The pending connection keeps the listening socket readable, so running out of file descriptors would otherwise
+			// wake the thread over and over.
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				mAccepting = false;
+				epoll_event listen_event = {0, {.u64 = LISTEN_TAG}};
+				epoll_ctl(mEpoll.get(), EPOLL_CTL_MOD, mListen.get(), &listen_event);
+			}
+
+			return;
+		}
+
+		uint64_t sync;
+		{
+			lock_guard lock{mMutex};
+			drain();
+			sync = mSync;
+		}
+
+		// Frames since the reset that were overwritten already cannot be replayed.
+		if (sync < mRing.tail()) {
+			close(fd);
+			continue;
+		}
+
+		// All spectators are flushed whenever the thread wakes up, so their events only need to identify the socket.
+		epoll_event event = {EPOLLRDHUP, {.u64 = (uint64_t)fd}};
+		epoll_ctl(mEpoll.get(), EPOLL_CTL_ADD, fd, &event);
+		mSpectators.push_back({UniqueFd{fd}, mHeader, sync});
+	}
+}
+
+void SpectatorServer::flush(Spectator& spectator) {
+	if (spectator.pos < mRing.tail()) {
+		spectator.fd.reset();
+		return;
+	}
+
+	while (true) {
+		auto views = mRing.read(spectator.pos);
+		array<iovec, 3> iov = {{
+			{spectator.header.data(), spectator.header.size()},
+			{(void*)views[0].data(), views[0].size()},
+			{(void*)views[1].data(), views[1].size()},
+		}};
+
+		size_t total = spectator.header.size() + views[0].size() + views[1].size();
+		if (total == 0) {
+			break;
+		}
+
+		msghdr message = {};
+		message.msg_iov = iov.data();
+		message.msg_iovlen = iov.size();
+		ssize_t n = sendmsg(spectator.fd.get(), &message, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break;
+		} else if (n < 0) {
+			spectator.fd.reset();
+			return;
+		}
+
+		size_t from_header = min((size_t)n, spectator.header.size());
+		spectator.header.erase(0, from_header);
+		spectator.pos += n - from_header;
+	}
+
+	bool writing = !spectator.header.empty() || spectator.pos < mRing.head();
+	if (writing != spectator.writing) {
+		spectator.writing = writing;
+		epoll_event event = {(uint32_t)(writing ? EPOLLRDHUP | EPOLLOUT : EPOLLRDHUP), {.u64 = (uint64_t)spectator.fd.get()}};
+		epoll_ctl(mEpoll.get(), EPOLL_CTL_MOD, spectator.fd.get(), &event);
+	}
+}
+
+SpectatorClient::SpectatorClient(const string& address) : mFd{connect_socket(address)} {
+	char buffer[4096];
+	while (true) {
+		ByteReader reader{mIn};
+		if (reader.has(4)) {
+			uint32_t size = reader.get<uint32_t>();
+			if (reader.has(size)) {
+				mText = reader.data.substr(0, size);
+				mPos = 4 + size;
+				break;
+			}
+		}
+
+		ssize_t n = read(mFd.get(), buffer, sizeof(buffer));
+		if (n <= 0) {
+			throw runtime_error{format("Could not spectate {}", address)};
+		}
+
+		mIn.append(buffer, n);
+	}
+
+	set_nonblocking(mFd.get());
+}
+
+bool SpectatorClient::receive() {
+	// Drop the frames that were consumed already.
+	mIn.erase(0, mPos);
+	mPos = 0;
+
+	char buffer[4096];
+	while (true) {
+		ssize_t n = read(mFd.get(), buffer, sizeof(buffer));
+		if (n > 0) {
+			mIn.append(buffer, n);
+		} else if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return true;
+		} else {
+			return false;
+		}
+	}
+}
+
+optional<SpectatorClient::Frame> SpectatorClient::next() {
+	uint64_t delay_ms = 0;
+	for (size_t i = mPos, shift = 0; i < mIn.size() && shift < 64; i++, shift += 7) {
+		uint8_t byte = (uint8_t)mIn[i];
+		delay_ms |= (uint64_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			if (i + 1 >= mIn.size()) {
+				return {};
+			}
+
+			mPos = i + 2;
+			return Frame{mIn[i + 1], (uint32_t)min(delay_ms, (uint64_t)UINT32_MAX)};
+		}
+	}
+
+	return {};
+}
+
+} // namespace ttt
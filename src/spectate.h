@@ -0,0 +1,120 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+// Live spectating of a typing session (`ttt --broadcast` and `ttt --spectate`). Rather than screen contents, the stream
+// carries the bytes the typist feeds into their session, such that spectators replay the session with their own terminal
+// width and nobody renders on anybody else's behalf.
+//
+// The stream starts with u32 text size and the (wrapped) text, followed by one frame per byte fed: the milliseconds since the
+// previous frame as a LEB128 varint, then the byte. Typical frames are hence two bytes long. Spectators who join late
+// receive all frames since the most recent reset of the session (Ctrl+R) and fast-forward through them.
+
+#pragma once
+
+#include "net.h"
+#include "session.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace ttt {
+
+// Byte queue of fixed capacity that any number of readers consume at their own pace. Positions are absolute, such that
+// readers can tell when data they have yet to read was overwritten.
+class RingBuffer {
+public:
+	RingBuffer(size_t capacity) : mData(capacity) {}
+
+	uint64_t head() const { return mHead; }
+	uint64_t tail() const { return mHead > mData.size() ? mHead - mData.size() : 0; }
+
+	void append(std::string_view data);
+
+	// The bytes from `pos`, which must not be older than `tail()`, up to the head. They are split into two views where the
+	// buffer wraps around.
+	std::array<std::string_view, 2> read(uint64_t pos) const;
+
+private:
+	std::vector<char> mData;
+	uint64_t mHead = 0;
+};
+
+// Serves the stream of a session to spectators from a background thread, such that slow spectators never hold up the typist.
+// Spectators who fall behind by more than the capacity of the ring buffer are disconnected.
+class SpectatorServer {
+public:
+	SpectatorServer(const std::string& address, std::string text, size_t capacity = 1 << 20);
+	~SpectatorServer();
+
+	// Adds a byte that was fed into the session at `time` to the stream
+	void publish(char c, TypingSession::Clock::time_point time);
+
+private:
+	struct Spectator {
+		UniqueFd fd;
+		std::string header; // Unsent part of the stream's header
+		uint64_t pos;       // Position of the next byte to send within the ring buffer
+		bool writing = false;
+	};
+
+	void wake();
+	void run();
+
+	// Moves the published frames into the ring buffer. Requires `mMutex` to be held.
+	void drain();
+	void accept_spectators();
+	void flush(Spectator& spectator);
+
+	std::string mHeader;
+	UniqueFd mListen, mEpoll, mWake;
+	std::thread mThread;
+	std::atomic<bool> mStop = false;
+	bool mAccepting = true; // Whether new spectators are accepted, which pauses for a moment when file descriptors run out
+
+	// Shared between the typist, who appends frames, and the thread, which moves them into the ring buffer
+	std::mutex mMutex;
+	std::string mPending;
+	uint64_t mPublished = 0; // Number of bytes published so far, i.e. the head of the ring buffer once it caught up
+	uint64_t mSync = 0;      // Position of the frame of the most recent reset
+	std::optional<TypingSession::Clock::time_point> mLastTime;
+
+	// Only accessed by the thread
+	RingBuffer mRing;
+	std::vector<Spectator> mSpectators;
+};
+
+// Receives the stream of a session
+class SpectatorClient {
+public:
+	struct Frame {
+		char c;
+		uint32_t delay_ms; // Since the previous frame
+	};
+
+	// Connects to the typist at `address` and waits for the header
+	SpectatorClient(const std::string& address);
+
+	int fd() const { return mFd.get(); }
+	const std::string& text() const { return mText; }
+
+	// Receives whatever the typist has sent so far. Returns false once the session ended.
+	bool receive();
+
+	// Returns the next frame that has been received completely, if any
+	std::optional<Frame> next();
+
+private:
+	UniqueFd mFd;
+	std::string mIn;
+	size_t mPos = 0;
+	std::string mText;
+};
+
+} // namespace ttt
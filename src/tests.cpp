@@ -0,0 +1,194 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+#include "tests.h"
+
+#include "layout.h"
+
+#include <cmrc/cmrc.hpp>
+
+#include <json/json.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <format>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+using namespace nlohmann;
+
+CMRC_DECLARE(ttt);
+
+namespace ttt {
+
+template <typename T> std::string join(const T& components, const std::string& delim) {
+	std::ostringstream s;
+	for (const auto& component : components) {
+		if (&components[0] != &component) {
+			s << delim;
+		}
+		s << component;
+	}
+
+	return s.str();
+}
+
+vector<string> split(string text, const string& delim) {
+	vector<string> result;
+	size_t begin = 0;
+	while (true) {
+		size_t end = text.find_first_of(delim, begin);
+		if (end == string::npos) {
+			result.emplace_back(text.substr(begin));
+			return result;
+		} else {
+			result.emplace_back(text.substr(begin, end - begin));
+			begin = end + 1;
+		}
+	}
+
+	return result;
+}
+
+string ls(const cmrc::embedded_filesystem& fs, const string& path) {
+	ostringstream result;
+	bool first = true;
+	for (const auto& entry : fs.iterate_directory(path)) {
+		if (!first) {
+			result << ", ";
+		}
+
+		first = false;
+		result << entry.filename();
+	}
+
+	return result.str();
+}
+
+const vector<string>& TestFactory::word_list(const string& name) {
+	if (auto it = mWordLists.find(name); it != mWordLists.end()) {
+		return it->second;
+	}
+
+	auto fs = cmrc::ttt::get_filesystem();
+	vector<string> words;
+	try {
+		auto words_file = fs.open(format("resources/words/{}", name));
+		words = split({words_file.cbegin(), words_file.cend()}, "\n");
+	} catch (...) { throw invalid_argument{format("Invalid word list name provided. Available lists: {}", ls(fs, "resources/words"))}; }
+
+	// Words are joined by spaces, which normalization never reorders across, so they can be normalized individually.
+	for (auto& word : words) {
+		word = nfd(word);
+	}
+
+	return mWordLists[name] = std::move(words);
+}
+
+const vector<TestFactory::Quote>& TestFactory::quote_list(const string& name) {
+	if (auto it = mQuoteLists.find(name); it != mQuoteLists.end()) {
+		return it->second;
+	}
+
+	auto fs = cmrc::ttt::get_filesystem();
+	json quotes;
+	try {
+		auto quotes_file = fs.open(format("resources/quotes/{}", name));
+		quotes = json::parse(quotes_file);
+	} catch (...) { throw invalid_argument{format("Invalid quote list name provided. Available lists: {}", ls(fs, "resources/quotes"))}; }
+
+	vector<Quote> result;
+	for (const json& quote : quotes) {
+		string attribution = quote.value("attribution", "");
+		if (attribution.empty()) {
+			attribution = "Unknown person";
+		}
+
+		result.push_back({nfd(quote.value("text", "")), std::move(attribution)});
+	}
+
+	return mQuoteLists[name] = std::move(result);
+}
+
+string_view TestFactory::hyphenation_patterns(const string& name) const {
+	auto fs = cmrc::ttt::get_filesystem();
+	try {
+		auto patterns_file = fs.open(format("resources/hyphenation/{}", name));
+		return {patterns_file.cbegin(), patterns_file.size()};
+	} catch (...) {
+		throw invalid_argument{format("Invalid hyphenation pattern name provided. Available patterns: {}", ls(fs, "resources/hyphenation"))};
+	}
+}
+
+const Hyphenator& TestFactory::hyphenator(const string& name) {
+	if (auto it = mHyphenators.find(name); it != mHyphenators.end()) {
+		return it->second;
+	}
+
+	return mHyphenators.emplace(name, Hyphenator{hyphenation_patterns(name)}).first->second;
+}
+
+PreparedTest TestFactory::prepare(const TestRequest& request) {
+	PreparedTest result;
+	if (!request.word_list.empty()) {
+		const auto& words = word_list(request.word_list);
+		if (words.size() == 0) {
+			throw runtime_error{"No words found"};
+		}
+
+		uniform_int_distribution<> dis(0, words.size() - 1);
+
+		vector<string> selected_words;
+		for (size_t i = 0; i < request.n_words; i++) {
+			selected_words.push_back(words[dis(mRng)]);
+		}
+
+		result.text = join(selected_words, " ");
+	} else {
+		const auto& quotes = quote_list(request.quote_list);
+		if (quotes.size() == 0) {
+			throw runtime_error{"No quotes found"};
+		}
+
+		uniform_int_distribution<> dis(0, quotes.size() - 1);
+		const Quote& quote = quotes[dis(mRng)];
+
+		result.text = quote.text;
+		result.attribution = quote.attribution;
+	}
+
+	if (result.text.empty()) {
+		throw runtime_error{"No text provided"};
+	}
+
+	result.text = wrap(std::move(result.text), request);
+	return result;
+}
+
+string TestFactory::prepare_text(const string& text, const TestRequest& request) { return wrap(nfd(text), request); }
+
+void TestFactory::prepare_text_in_place(string& text, const TestRequest& request) {
+	nfd_in_place(text);
+	if (request.wrap_width > 0) {
+		const Hyphenator* hyphenator = request.hyphenation.empty() ? nullptr : &this->hyphenator(request.hyphenation);
+		wrap_text_in_place(text, request.wrap_width, request.widths, hyphenator);
+	}
+
+	trim_trailing_whitespace(text);
+}
+
+string TestFactory::wrap(string text, const TestRequest& request) {
+	if (request.wrap_width > 0) {
+		if (!request.hyphenation.empty()) {
+			text = wrap_text(text, request.wrap_width, request.widths, &hyphenator(request.hyphenation));
+		} else {
+			text = wrap_text(text, request.wrap_width, request.widths);
+		}
+	}
+
+	trim_trailing_whitespace(text);
+	return text;
+}
+
+} // namespace ttt
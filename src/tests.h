@@ -0,0 +1,70 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+// Preparation of typing tests from the word lists, quotes and hyphenation patterns that ttt embeds. Shared by `ttt`, which
+// prepares its test in-process unless a daemon is running, and by `tttd`, which prepares tests ahead of time.
+
+#pragma once
+
+#include "hyphenation.h"
+#include "text.h"
+
+#include <cstddef>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace ttt {
+
+// Everything that determines a test, apart from randomness
+struct TestRequest {
+	std::string word_list; // Either a word list...
+	size_t n_words = 0;
+	std::string quote_list; // ...or a quote list
+	size_t wrap_width = 0;   // 0: no wrapping
+	std::string hyphenation; // Hyphenation patterns to use when wrapping, if any
+	WidthContext widths;
+};
+
+struct PreparedTest {
+	std::string text; // In NFD, wrapped, without trailing whitespace
+	std::string attribution;
+};
+
+// Prepares tests from embedded resources, each of which is parsed and normalized only once and then kept in memory
+class TestFactory {
+public:
+	// A test of random words or a random quote as described by `request`
+	PreparedTest prepare(const TestRequest& request);
+
+	// Normalizes and wraps `text` as described by `request`, ignoring its word and quote lists
+	std::string prepare_text(const std::string& text, const TestRequest& request);
+
+	// Like `prepare_text`, but in place, such that large texts need little memory beyond themselves
+	void prepare_text_in_place(std::string& text, const TestRequest& request);
+
+	// The compiled hyphenation patterns called `name`, as embedded in ttt
+	std::string_view hyphenation_patterns(const std::string& name) const;
+
+private:
+	struct Quote {
+		std::string text, attribution;
+	};
+
+	const std::vector<std::string>& word_list(const std::string& name);
+	const std::vector<Quote>& quote_list(const std::string& name);
+	const Hyphenator& hyphenator(const std::string& name);
+
+	std::string wrap(std::string text, const TestRequest& request);
+
+	std::mt19937 mRng{std::random_device{}()};
+
+	std::unordered_map<std::string, std::vector<std::string>> mWordLists;
+	std::unordered_map<std::string, std::vector<Quote>> mQuoteLists;
+	std::unordered_map<std::string, Hyphenator> mHyphenators;
+};
+
+} // namespace ttt
@@ -0,0 +1,587 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+#include "text.h"
+
+#include <unilib/uninorms.h>
+#include <unilib/utf.h>
+
+#include <wcwidth/wcwidth.h>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <deque>
+#include <iterator>
+
+using namespace std;
+
+namespace ttt {
+
+int utf8_char_length(unsigned char first_byte) {
+	if ((first_byte & 0x80) == 0) {
+		return 1;
+	}
+
+	if ((first_byte & 0xE0) == 0xC0) {
+		return 2;
+	}
+
+	if ((first_byte & 0xF0) == 0xE0) {
+		return 3;
+	}
+
+	if ((first_byte & 0xF8) == 0xF0) {
+		return 4;
+	}
+
+	return 1; // Invalid UTF-8 byte, treat as single byte
+}
+
+template <typename T, size_t N> T unicode_property(const UnicodeRange<T> (&ranges)[N], char32_t c, T fallback) {
+	auto it = upper_bound(begin(ranges), end(ranges), c, [](char32_t c, const auto& range) { return c < range.first; });
+	if (it == begin(ranges) || c > (--it)->last) {
+		return fallback;
+	}
+
+	return it->value;
+}
+
+template <size_t N> bool in_ranges(const CodePointRange (&ranges)[N], char32_t c) {
+	auto it = upper_bound(begin(ranges), end(ranges), c, [](char32_t c, const auto& range) { return c < range.first; });
+	return it != begin(ranges) && c <= (--it)->last;
+}
+
+WordBreak word_break(char32_t c) { return unicode_property(WORD_BREAK_RANGES, c, WordBreak::Other); }
+GraphemeBreak grapheme_break(char32_t c) { return unicode_property(GRAPHEME_BREAK_RANGES, c, GraphemeBreak::Other); }
+BidiClass bidi_class(char32_t c) { return unicode_property(BIDI_CLASS_RANGES, c, BidiClass::L); }
+
+char32_t decode_char(string_view str, size_t pos) {
+	string_view rest = str.substr(pos);
+	return unilib::utf::decode(rest);
+}
+
+bool is_combining_char(string_view str, size_t pos) {
+	if (pos >= str.length()) {
+		return false;
+	}
+
+	GraphemeBreak gb = grapheme_break(decode_char(str, pos));
+	return gb == GraphemeBreak::Extend || gb == GraphemeBreak::ZWJ || gb == GraphemeBreak::SpacingMark;
+}
+
+size_t find_grapheme_cluster_end(const string& str, size_t start) {
+	if (start >= str.length()) {
+		return start;
+	}
+
+	using enum GraphemeBreak;
+
+	size_t pos = start;
+	GraphemeBreak prev = grapheme_break(decode_char(str, pos));
+	pos += utf8_char_length(str[pos]);
+
+	// State for GB11 (emoji ZWJ sequences) and GB12/GB13 (pairs of regional indicators)
+	bool in_emoji = prev == ExtPict;
+	size_t n_regional_indicators = prev == Regional_Indicator ? 1 : 0;
+
+	for (; pos < str.length(); pos += utf8_char_length(str[pos])) {
+		GraphemeBreak next = grapheme_break(decode_char(str, pos));
+
+		bool join;
+		if (prev == CR && next == LF) {
+			join = true; // GB3
+		} else if (prev == CR || prev == LF || prev == Control || next == CR || next == LF || next == Control) {
+			join = false; // GB4, GB5
+		} else if (prev == L && (next == L || next == V || next == LV || next == LVT)) {
+			join = true; // GB6
+		} else if ((prev == LV || prev == V) && (next == V || next == T)) {
+			join = true; // GB7
+		} else if ((prev == LVT || prev == T) && next == T) {
+			join = true; // GB8
+		} else if (next == Extend || next == ZWJ || next == SpacingMark || prev == Prepend) {
+			join = true; // GB9, GB9a, GB9b
+		} else if (prev == ZWJ && next == ExtPict) {
+			join = in_emoji; // GB11
+		} else if (prev == Regional_Indicator && next == Regional_Indicator) {
+			join = n_regional_indicators % 2 == 1; // GB12, GB13
+		} else {
+			join = false; // GB999
+		}
+
+		if (!join) {
+			break;
+		}
+
+		if (next == Regional_Indicator) {
+			n_regional_indicators++;
+		}
+
+		in_emoji = next == ExtPict || (in_emoji && (next == Extend || next == ZWJ));
+		prev = next;
+	}
+
+	return pos;
+}
+
+int WidthContext::char_width(char32_t c) const {
+	if (c == '\t') {
+		return tab_width;
+	}
+
+	if (overrides.ambiguous >= 0 && in_ranges(EAST_ASIAN_AMBIGUOUS_RANGES, c)) {
+		return overrides.ambiguous;
+	}
+
+	if (overrides.emoji >= 0 && in_ranges(EMOJI_PRESENTATION_RANGES, c)) {
+		return overrides.emoji;
+	}
+
+	if (c >= 0x1F300) {
+		// Unicode range for emojis and other symbols
+		return 2;
+	}
+
+	int width = mk_wcwidth(c);
+	return width >= 0 ? width : 1;
+}
+
+size_t WidthContext::cluster_width(string_view cluster) const {
+	vector<char32_t> chars;
+	for (string_view rest = cluster; !rest.empty();) {
+		chars.push_back(unilib::utf::decode(rest));
+	}
+
+	if (chars.size() > 1) {
+		const auto& o = overrides;
+		auto has = [&](auto pred) { return any_of(chars.begin() + 1, chars.end(), pred); };
+		if (o.emoji_flag >= 0 && chars.size() == 2 && grapheme_break(chars[0]) == GraphemeBreak::Regional_Indicator) {
+			return o.emoji_flag;
+		} else if (o.emoji_zwj >= 0 && grapheme_break(chars[0]) == GraphemeBreak::ExtPict && has([](char32_t c) { return c == 0x200D; })) {
+			return o.emoji_zwj;
+		} else if (o.emoji_modifier >= 0 && has([](char32_t c) { return c >= 0x1F3FB && c <= 0x1F3FF; })) {
+			return o.emoji_modifier;
+		} else if (o.emoji_vs16 >= 0 && chars[1] == 0xFE0F) {
+			return o.emoji_vs16;
+		}
+	}
+
+	size_t width = 0;
+	for (char32_t c : chars) {
+		width += char_width(c);
+	}
+
+	return width;
+}
+
+size_t next_char_pos(string_view str, size_t pos) {
+	if (pos >= str.length()) {
+		return str.length();
+	}
+
+	return pos + utf8_char_length(str[pos]);
+}
+
+size_t prev_char_pos(const string& str, size_t pos) {
+	if (pos <= 0) {
+		return 0;
+	}
+
+	size_t prev = pos - 1;
+	while (prev > 0 && (str[prev] & 0xC0) == 0x80) {
+		prev--;
+	}
+
+	return prev;
+}
+
+string nfd(const string& str) {
+	u32string decoded;
+	unilib::utf::decode(str.c_str(), decoded);
+	unilib::uninorms::nfd(decoded);
+	string result;
+	unilib::utf::encode(decoded, result);
+	return result;
+}
+
+// Output held aside that makes the unread rest of the text move back to make room for it
+constexpr size_t MAX_PENDING_SIZE = 64 * 1024;
+
+void transform_in_place(
+	string& text, const function<size_t(const string&, size_t)>& chunk_end, const function<string(const string&)>& transform
+) {
+	// Output that does not fit into the consumed part of the text yet, starting at `pending_begin`
+	string pending;
+	size_t pending_begin = 0;
+
+	size_t read = 0, write = 0;
+	string chunk;
+	while (read < text.size()) {
+		size_t end = chunk_end(text, read);
+		chunk.assign(text, read, end - read);
+		pending += transform(chunk);
+		read = end;
+
+		// If the text grows, move the unread rest back by as much as the output is expected to outgrow it, judging from the
+		// growth so far. Within the capacity of `text`, this touches only as much memory as the text grows and, if the growth is
+		// even, happens just once.
+		size_t n_pending = pending.size() - pending_begin;
+		if (n_pending > read - write + MAX_PENDING_SIZE) {
+			size_t unread = text.size() - read;
+			size_t expected_growth = (size_t)((double)(write + n_pending - read) / read * unread);
+			size_t shift = n_pending - (read - write) + expected_growth;
+
+			text.resize(text.size() + shift);
+			copy_backward(text.begin() + read, text.begin() + read + unread, text.end());
+			read += shift;
+		}
+
+		size_t n = min(n_pending, read - write);
+		copy_n(pending.begin() + pending_begin, n, text.begin() + write);
+		write += n;
+		pending_begin += n;
+
+		// Drop the flushed prefix once it makes up most of the buffer, such that flushing takes amortized constant time
+		if (pending_begin > pending.size() / 2) {
+			pending.erase(0, pending_begin);
+			pending_begin = 0;
+		}
+	}
+
+	text.resize(write);
+	text.append(pending, pending_begin);
+}
+
+// Canonical reordering never crosses grapheme cluster boundaries, so chunks of about this size can be normalized independently
+constexpr size_t NFD_CHUNK_SIZE = 16 * 1024;
+
+void nfd_in_place(string& str) {
+	transform_in_place(
+		str,
+		[](const string& text, size_t begin) {
+			size_t end = min(begin + NFD_CHUNK_SIZE, text.size());
+			while (end < text.size() && (is_utf8_continuation(text[end]) || is_combining_char(text, end))) {
+				++end;
+			}
+
+			return end;
+		},
+		[](const string& chunk) { return nfd(chunk); }
+	);
+}
+
+void trim_trailing_whitespace(string& text) {
+	text.erase(find_if(text.rbegin(), text.rend(), [](unsigned char ch) { return !isspace(ch); }).base(), text.end());
+}
+
+string read_all(istream& in, double headroom) {
+	string result;
+	if (in.seekg(0, ios::end)) {
+		auto size = in.tellg();
+		if (size >= 0 && in.seekg(0, ios::beg)) {
+			result.reserve((size_t)size + (size_t)(size * headroom));
+			result.resize((size_t)size);
+			in.read(result.data(), size);
+			result.resize((size_t)in.gcount());
+			return result;
+		}
+	}
+
+	in.clear();
+	result.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+	return result;
+}
+
+// Pairs of word break classes between which UAX #29 never breaks, regardless of context (WB5, WB8-WB10, WB13-WB13b).
+// The context-dependent rules are handled in `for_each_word_segment`.
+constexpr auto WORD_JOINS = [] {
+	constexpr size_t n = (size_t)WordBreak::ExtPict + 1;
+	array<array<bool, n>, n> joins = {};
+	auto join = [&](initializer_list<WordBreak> lhs, initializer_list<WordBreak> rhs) {
+		for (auto a : lhs) {
+			for (auto b : rhs) {
+				joins[(size_t)a][(size_t)b] = true;
+			}
+		}
+	};
+
+	using enum WordBreak;
+	join({ALetter, Hebrew_Letter}, {ALetter, Hebrew_Letter, Numeric, ExtendNumLet});
+	join({Numeric}, {Numeric, ALetter, Hebrew_Letter, ExtendNumLet});
+	join({Katakana}, {Katakana, ExtendNumLet});
+	join({ExtendNumLet}, {ALetter, Hebrew_Letter, Numeric, Katakana, ExtendNumLet});
+	return joins;
+}();
+
+void for_each_word_segment(string_view text, const function<void(size_t, size_t)>& callback) {
+	using enum WordBreak;
+
+	// Characters are decoded as they are needed. Only those that were looked ahead at are buffered, which are the current
+	// one's ignorable successors and the character after them.
+	deque<pair<size_t, WordBreak>> ahead;
+	string_view rest = text;
+	auto decode_ahead = [&]() {
+		if (rest.empty()) {
+			return false;
+		}
+
+		size_t pos = text.size() - rest.size();
+		ahead.emplace_back(pos, word_break(unilib::utf::decode(rest)));
+		return true;
+	};
+
+	auto is_ignorable = [](WordBreak wb) { return wb == Extend || wb == Format || wb == ZWJ; };
+	auto is_hard_break = [](WordBreak wb) { return wb == CR || wb == LF || wb == Newline; };
+	auto is_ahletter = [](WordBreak wb) { return wb == ALetter || wb == Hebrew_Letter; };
+	auto is_midnumletq = [](WordBreak wb) { return wb == MidNumLet || wb == Single_Quote; };
+
+	// Class of the first non-ignorable character after the current one (WB4)
+	auto next_class = [&]() {
+		for (size_t i = 0;; i++) {
+			if (i == ahead.size() && !decode_ahead()) {
+				return Other;
+			}
+
+			if (!is_ignorable(ahead[i].second)) {
+				return ahead[i].second;
+			}
+		}
+	};
+
+	if (!decode_ahead()) {
+		return;
+	}
+
+	size_t segment_start = 0;
+
+	// Classes of the last two non-ignorable characters before the current position and the number of consecutive regional
+	// indicators ending at the last one.
+	WordBreak raw_prev = ahead.front().second, prev = raw_prev, prev_prev = Other;
+	size_t n_regional_indicators = prev == Regional_Indicator ? 1 : 0;
+	ahead.pop_front();
+
+	while (!ahead.empty() || decode_ahead()) {
+		auto [pos, cur] = ahead.front();
+		ahead.pop_front();
+
+		bool is_break;
+		if (raw_prev == CR && cur == LF) { // WB3
+			is_break = false;
+		} else if (is_hard_break(raw_prev) || is_hard_break(cur)) { // WB3a, WB3b
+			is_break = true;
+		} else if (raw_prev == ZWJ && cur == ExtPict) { // WB3c
+			is_break = false;
+		} else if (raw_prev == WSegSpace && cur == WSegSpace) { // WB3d
+			is_break = false;
+		} else if (is_ignorable(cur)) { // WB4
+			is_break = false;
+		} else if (WORD_JOINS[(size_t)prev][(size_t)cur]) {
+			is_break = false;
+		} else if (is_ahletter(prev) && (cur == MidLetter || is_midnumletq(cur)) && is_ahletter(next_class())) { // WB6
+			is_break = false;
+		} else if (is_ahletter(prev_prev) && (prev == MidLetter || is_midnumletq(prev)) && is_ahletter(cur)) { // WB7
+			is_break = false;
+		} else if (prev == Hebrew_Letter && cur == Single_Quote) { // WB7a
+			is_break = false;
+		} else if (prev == Hebrew_Letter && cur == Double_Quote && next_class() == Hebrew_Letter) { // WB7b
+			is_break = false;
+		} else if (prev_prev == Hebrew_Letter && prev == Double_Quote && cur == Hebrew_Letter) { // WB7c
+			is_break = false;
+		} else if (prev_prev == Numeric && (prev == MidNum || is_midnumletq(prev)) && cur == Numeric) { // WB11
+			is_break = false;
+		} else if (prev == Numeric && (cur == MidNum || is_midnumletq(cur)) && next_class() == Numeric) { // WB12
+			is_break = false;
+		} else if (prev == Regional_Indicator && cur == Regional_Indicator) { // WB15, WB16
+			is_break = n_regional_indicators % 2 == 0;
+		} else { // WB999
+			is_break = true;
+		}
+
+		if (is_break) {
+			callback(segment_start, pos);
+			segment_start = pos;
+		}
+
+		// Ignorable characters attach to whatever precedes them, unless that is a hard break (WB4).
+		if (!is_ignorable(cur) || is_hard_break(raw_prev)) {
+			n_regional_indicators = cur == Regional_Indicator ? n_regional_indicators + 1 : 0;
+			prev_prev = prev;
+			prev = cur;
+		}
+
+		raw_prev = cur;
+	}
+
+	callback(segment_start, text.size());
+}
+
+uint8_t resolve_bidi_levels(vector<BidiClass> types, vector<uint8_t>& levels) {
+	using enum BidiClass;
+
+	const vector<BidiClass> original = types;
+	size_t n = types.size();
+
+	// P2, P3
+	uint8_t paragraph_level = 0;
+	for (auto type : types) {
+		if (type == L || type == R || type == AL) {
+			paragraph_level = type == L ? 0 : 1;
+			break;
+		}
+	}
+
+	BidiClass embedding_direction = paragraph_level == 0 ? L : R;
+	auto is_neutral = [](BidiClass type) { return type == B || type == S || type == WS || type == ON; };
+	for (auto& type : types) {
+		if (type == BN || type >= LRE) {
+			type = ON;
+		}
+	}
+
+	// W1-W3
+	BidiClass last_strong = embedding_direction;
+	for (size_t i = 0; i < n; i++) {
+		if (types[i] == NSM) {
+			types[i] = i == 0 ? embedding_direction : types[i - 1];
+		}
+
+		if (types[i] == L || types[i] == R || types[i] == AL) {
+			last_strong = types[i];
+		} else if (types[i] == EN && last_strong == AL) {
+			types[i] = AN;
+		}
+	}
+
+	for (auto& type : types) {
+		if (type == AL) {
+			type = R;
+		}
+	}
+
+	// W4
+	for (size_t i = 1; i + 1 < n; i++) {
+		if (types[i - 1] == EN && types[i + 1] == EN && (types[i] == ES || types[i] == CS)) {
+			types[i] = EN;
+		} else if (types[i - 1] == AN && types[i + 1] == AN && types[i] == CS) {
+			types[i] = AN;
+		}
+	}
+
+	// W5, W6
+	for (size_t i = 0; i < n;) {
+		if (types[i] != ET) {
+			i++;
+			continue;
+		}
+
+		size_t end = i;
+		while (end < n && types[end] == ET) {
+			end++;
+		}
+
+		bool next_to_number = (i > 0 && types[i - 1] == EN) || (end < n && types[end] == EN);
+		fill(types.begin() + i, types.begin() + end, next_to_number ? EN : ON);
+		i = end;
+	}
+
+	for (auto& type : types) {
+		if (type == ES || type == CS) {
+			type = ON;
+		}
+	}
+
+	// W7
+	last_strong = embedding_direction;
+	for (auto& type : types) {
+		if (type == L || type == R) {
+			last_strong = type;
+		} else if (type == EN && last_strong == L) {
+			type = L;
+		}
+	}
+
+	// N1, N2
+	auto strong_direction = [](BidiClass type) { return type == L ? L : R; };
+	for (size_t i = 0; i < n;) {
+		if (!is_neutral(types[i])) {
+			i++;
+			continue;
+		}
+
+		size_t end = i;
+		while (end < n && is_neutral(types[end])) {
+			end++;
+		}
+
+		BidiClass before = i == 0 ? embedding_direction : strong_direction(types[i - 1]);
+		BidiClass after = end == n ? embedding_direction : strong_direction(types[end]);
+		fill(types.begin() + i, types.begin() + end, before == after ? before : embedding_direction);
+		i = end;
+	}
+
+	// I1, I2
+	levels.resize(n);
+	for (size_t i = 0; i < n; i++) {
+		if (paragraph_level % 2 == 0) {
+			levels[i] = paragraph_level + (types[i] == R ? 1 : (types[i] == AN || types[i] == EN ? 2 : 0));
+		} else {
+			levels[i] = paragraph_level + (types[i] == L || types[i] == EN || types[i] == AN ? 1 : 0);
+		}
+	}
+
+	// L1: segment separators and trailing whitespace, as well as whitespace preceding either, are reset to the paragraph level.
+	bool trailing = true;
+	for (size_t i = n; i-- > 0;) {
+		BidiClass type = original[i];
+		if (type == S || type == B) {
+			levels[i] = paragraph_level;
+			trailing = true;
+		} else if (trailing && (type == WS || type == BN || type >= LRE)) {
+			levels[i] = paragraph_level;
+		} else {
+			trailing = false;
+		}
+	}
+
+	return paragraph_level;
+}
+
+vector<uint32_t> reorder_bidi_levels(const vector<uint8_t>& levels) {
+	vector<uint32_t> order(levels.size());
+	for (size_t i = 0; i < order.size(); i++) {
+		order[i] = (uint32_t)i;
+	}
+
+	if (levels.empty()) {
+		return order;
+	}
+
+	uint8_t max_level = *max_element(levels.begin(), levels.end());
+	uint8_t min_odd_level = max_level + 1;
+	for (auto level : levels) {
+		if (level % 2 == 1) {
+			min_odd_level = min(min_odd_level, level);
+		}
+	}
+
+	for (int level = max_level; level >= min_odd_level; level--) {
+		for (size_t i = 0; i < order.size();) {
+			if (levels[order[i]] < level) {
+				i++;
+				continue;
+			}
+
+			size_t end = i;
+			while (end < order.size() && levels[order[end]] >= level) {
+				end++;
+			}
+
+			reverse(order.begin() + i, order.begin() + end);
+			i = end;
+		}
+	}
+
+	return order;
+}
+
+} // namespace ttt
@@ -0,0 +1,107 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+// Unicode text handling: UTF-8, grapheme clusters and their display widths, word boundaries, and bidirectional text.
+
+#pragma once
+
+#include "unicode_tables.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ttt {
+
+// Returns the number of bytes in a UTF-8 character based on its first byte
+int utf8_char_length(unsigned char first_byte);
+
+// Check if this byte is a continuation byte in UTF-8
+inline bool is_utf8_continuation(unsigned char byte) { return (byte & 0xC0) == 0x80; }
+
+// Get the next UTF-8 character position
+size_t next_char_pos(std::string_view str, size_t pos);
+
+// Get the previous UTF-8 character position
+size_t prev_char_pos(const std::string& str, size_t pos);
+
+// Decodes the UTF-8 character starting at `pos`
+char32_t decode_char(std::string_view str, size_t pos);
+
+WordBreak word_break(char32_t c);
+GraphemeBreak grapheme_break(char32_t c);
+BidiClass bidi_class(char32_t c);
+
+// Check if this byte starts a combining character
+bool is_combining_char(std::string_view str, size_t pos);
+
+// Find the end of the current extended grapheme cluster as defined by UAX #29
+size_t find_grapheme_cluster_end(const std::string& str, size_t start);
+
+// Display widths that deviate from wcwidth, as measured by `--calibrate` for the terminal at hand. -1 means unknown, in which
+// case a guess is made.
+struct WidthOverrides {
+	int ambiguous = -1;      // East Asian Ambiguous characters such as ±
+	int emoji = -1;          // Emoji_Presentation characters such as 😀
+	int emoji_vs16 = -1;     // Text characters followed by VARIATION SELECTOR-16 such as ❤️
+	int emoji_zwj = -1;      // Emoji ZWJ sequences such as 👨‍👩‍👧
+	int emoji_flag = -1;     // Pairs of regional indicators such as 🇩🇪
+	int emoji_modifier = -1; // Emoji followed by a skin tone modifier such as 👍🏽
+
+	bool operator==(const WidthOverrides&) const = default;
+};
+
+// Everything that determines how wide text is displayed. Each session carries its own, such that sessions with different
+// settings can coexist within one process.
+struct WidthContext {
+	size_t tab_width = 4;
+	WidthOverrides overrides;
+
+	// Get the display width of a single character
+	int char_width(char32_t c) const;
+
+	// Get the display width of a grapheme cluster. Terminals disagree on the width of emoji sequences, so these use the
+	// calibrated widths if available and otherwise the sum of their characters' widths.
+	size_t cluster_width(std::string_view cluster) const;
+};
+
+std::string nfd(const std::string& str);
+
+// Replaces `text` chunk by chunk with what `transform` makes of each chunk, where `chunk_end(text, begin)` returns the end of the
+// chunk that starts at `begin`. The output overwrites input that was already consumed and, where it grows, the unread rest
+// moves back into the capacity of `text`, so little memory is needed beyond the text itself.
+void transform_in_place(
+	std::string& text,
+	const std::function<size_t(const std::string&, size_t)>& chunk_end,
+	const std::function<std::string(const std::string&)>& transform
+);
+
+// Like `nfd`, but in place and in chunks that end at grapheme cluster boundaries. Reserve some capacity beyond the size of
+// `str`, lest decompositions that grow the text have to reallocate it. Reserved memory that is not written to costs address
+// space, but not physical memory.
+void nfd_in_place(std::string& str);
+
+// Removes the whitespace at the end of `text`, which nobody could tell they have to type.
+void trim_trailing_whitespace(std::string& text);
+
+// Reads all of `in` into a string. If `in` is seekable, the string is allocated once with `headroom` bytes of capacity per
+// byte of text to spare, e.g. for normalizing it in place; otherwise, it grows as needed.
+std::string read_all(std::istream& in, double headroom = 0);
+
+// Splits `text` into segments at the default word boundaries of UAX #29 and calls `callback(begin, end)` with the byte range
+// of each segment. Every byte of `text` belongs to exactly one segment.
+void for_each_word_segment(std::string_view text, const std::function<void(size_t, size_t)>& callback);
+
+// Resolves the embedding level of each character of a single line according to the implicit rules of UAX #9 and returns the
+// paragraph level. Every line is its own paragraph. Explicit embeddings, overrides, and isolates (X1-X10) are not supported;
+// their formatting characters are treated like other neutrals.
+uint8_t resolve_bidi_levels(std::vector<BidiClass> types, std::vector<uint8_t>& levels);
+
+// Returns the visual order of characters with the given embedding levels, i.e. the logical index of each visual position (L2).
+std::vector<uint32_t> reorder_bidi_levels(const std::vector<uint8_t>& levels);
+
+} // namespace ttt
@@ -0,0 +1,185 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+// tttd: resident daemon that keeps ttt's word lists, quotes and hyphenation patterns parsed in memory and prepares the next
+// test of each kind ahead of time. `ttt` asks it for its test and falls back to preparing the test itself if it does not run.
+// It also answers queries about the history from the rollups that `ttt` maintains, reloading them whenever they change.
+
+#include "daemon.h"
+#include "history.h"
+#include "net.h"
+#include "tests.h"
+
+#include <cerrno>
+#include <chrono>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/socket.h>
+
+using namespace std;
+
+namespace ttt {
+
+// Clients who do not send their request or take the response within this time are dropped, lest they block everybody else
+constexpr int REQUEST_TIMEOUT_MS = 1000;
+
+// How long to wait before accepting clients again after running out of file descriptors
+constexpr auto ACCEPT_BACKOFF = chrono::milliseconds{100};
+
+// Upper bound on the number of distinct requests for which a test is kept ready
+constexpr size_t MAX_PREPARED = 64;
+
+void print_help() {
+	cout << "Usage: tttd [OPTIONS]\n"
+		 << "Keeps ttt's resources and the next tests in memory, such that ttt starts faster.\n"
+		 << "\n"
+		 << "Options:\n"
+		 << "  -h, --help                  Show this help message and exit\n"
+		 << "  --socket PATH               Listen on PATH (default: $TTTD_SOCKET, else $XDG_RUNTIME_DIR/tttd.sock)\n"
+		 << "\n"
+		 << "ttt looks for the daemon at the default path. scripts/ttt-query.py queries its statistics of the history.\n"
+		 << "Without $TTTD_SOCKET and $XDG_RUNTIME_DIR, there is no default path, lest the socket lie in a directory that other\n"
+		 << "users can write to. Either way, the daemon only serves clients of the user that runs it.\n";
+	cout.flush();
+}
+
+int main(const vector<string>& args) {
+	string address = daemon_address();
+	for (size_t i = 1; i < args.size(); i++) {
+		const string& arg = args[i];
+		if (arg == "-h" || arg == "--help") {
+			print_help();
+			return 0;
+		} else if (arg == "--socket" && i + 1 < args.size()) {
+			address = args[++i];
+		} else {
+			throw invalid_argument{format("Unknown option {}", arg)};
+		}
+	}
+
+	if (address.empty()) {
+		throw invalid_argument{"Neither $TTTD_SOCKET nor $XDG_RUNTIME_DIR is set; pass --socket PATH"};
+	}
+
+	TestFactory factory;
+
+	optional<History> history;
+	if (auto dir = data_dir(); !dir.empty()) {
+		history.emplace(dir);
+	}
+
+	// Reloaded whenever ttt replaced the file since the previous query
+	optional<Rollups> rollups;
+	filesystem::file_time_type rollups_time;
+	auto current_rollups = [&]() -> const Rollups& {
+		error_code ec;
+		auto time = filesystem::last_write_time(history->rollups_path(), ec);
+		if (!rollups || time != rollups_time) {
+			rollups = history->rollups();
+			rollups_time = time;
+		}
+
+		return *rollups;
+	};
+
+	// The next test for each request that was made so far, keyed by the encoded request
+	unordered_map<string, PreparedTest> prepared;
+
+	UniqueFd listen = listen_socket(address);
+	cout << format("Listening on {}", address) << endl;
+
+	// Requests are small and answered from memory, so clients are served one after another.
+	while (true) {
+		// Tests and the history are private to the user
+		// Clients are non-blocking, such that neither receiving nor sending can wait for longer than the timeout.
+		UniqueFd client{accept4(listen.get(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)};
+		if (!client) {
+			// The pending connection remains, so retrying right away would spin until a file descriptor frees up.
+			if (errno != EINTR && errno != ECONNABORTED) {
+				this_thread::sleep_for(ACCEPT_BACKOFF);
+			}
+
+			continue;
+		}
+
+		if (!is_same_user(client.get())) {
+			continue;
+		}
+
+		auto payload = receive_frame(client.get(), REQUEST_TIMEOUT_MS);
+		if (!payload) {
+			continue;
+		}
+
+		if (is_query(*payload)) {
+			string response;
+			if (!history) {
+				response = encode_error_response("No history: neither $XDG_DATA_HOME nor $HOME is set");
+			} else {
+				try {
+					auto answer = answer_query(*payload, current_rollups());
+					response = answer ? *answer : encode_error_response("Malformed query");
+				} catch (const exception& e) { response = encode_error_response(e.what()); }
+			}
+
+			try {
+				send_all(client.get(), frame(response), REQUEST_TIMEOUT_MS);
+			} catch (const runtime_error&) {}
+
+			continue;
+		}
+
+		auto request = decode_test_request(*payload);
+		if (!request) {
+			continue;
+		}
+
+		string response;
+		if (auto it = prepared.find(*payload); it != prepared.end()) {
+			response = encode_test_response(it->second);
+			prepared.erase(it);
+		} else {
+			try {
+				response = encode_test_response(factory.prepare(*request));
+			} catch (const exception& e) { response = encode_error_response(e.what()); }
+		}
+
+		try {
+			send_all(client.get(), frame(response), REQUEST_TIMEOUT_MS);
+		} catch (const runtime_error&) {
+			// The client gave up waiting and prepares its test itself.
+		}
+
+		client.reset();
+
+		// Prepare the next test of this kind while nobody waits for it.
+		if (prepared.size() >= MAX_PREPARED) {
+			prepared.clear();
+		}
+
+		try {
+			prepared.emplace(std::move(*payload), factory.prepare(*request));
+		} catch (const exception&) {
+			// Invalid requests are answered with an error every time.
+		}
+	}
+}
+
+} // namespace ttt
+
+int main(int argc, char* argv[]) {
+	try {
+		return ttt::main({argv, argv + argc});
+	} catch (const exception& e) {
+		cerr << format("tttd: {}", e.what()) << endl;
+		return 1;
+	}
+}
@@ -0,0 +1,81 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+#include "text.h"
+#include "typist.h"
+
+#include <cctype>
+#include <cmath>
+#include <numbers>
+
+using namespace std;
+
+namespace ttt {
+
+uint64_t splitmix64(uint64_t x) {
+	x += 0x9E3779B97F4A7C15ull;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+	return x ^ (x >> 31);
+}
+
+SyntheticTypist::SyntheticTypist(const TypistSettings& settings, uint64_t seed) : mSettings{settings}, mSeed{seed}, mRng{seed} {
+	// A word is five keystrokes. The median of each keystroke's latency is shifted such that the mean of the log-normal
+	// distributions matches the desired speed.
+	double mean_delay = 60.0 / (5.0 * settings.wpm);
+	mMu = log(mean_delay) - (settings.sigma * settings.sigma + settings.bigram_sigma * settings.bigram_sigma) / 2;
+}
+
+SyntheticTypist::Keystroke SyntheticTypist::next(const TypingSession& session) {
+	string_view text = session.layout().text;
+	const string& input = session.input();
+
+	// Remaining bytes of a multi-byte character are typed at once.
+	if (!mQueue.empty()) {
+		char c = mQueue.front();
+		mQueue.erase(0, 1);
+		return {c, 0};
+	}
+
+	if (mErrorPos != SIZE_MAX && mNoticeIn == 0) {
+		if (input.size() > mErrorPos) {
+			return keystroke(127);
+		}
+
+		mErrorPos = SIZE_MAX;
+	}
+
+	if (mNoticeIn > 0) {
+		--mNoticeIn;
+	}
+
+	size_t pos = input.size();
+	char c = text[pos];
+	if (isalpha((unsigned char)c) && uniform_real_distribution<>{}(mRng) < mSettings.error_rate) {
+		char wrong = (char)('a' + uniform_int_distribution<>{0, 24}(mRng));
+		c = wrong >= tolower((unsigned char)c) ? wrong + 1 : wrong;
+		if (mErrorPos == SIZE_MAX && uniform_real_distribution<>{}(mRng) < mSettings.correction_rate) {
+			mErrorPos = pos;
+			mNoticeIn = geometric_distribution<size_t>{0.5}(mRng);
+		}
+	} else if (size_t length = utf8_char_length((unsigned char)c); length > 1) {
+		mQueue = text.substr(pos + 1, length - 1);
+	}
+
+	return keystroke(c);
+}
+
+SyntheticTypist::Keystroke SyntheticTypist::keystroke(char c) {
+	// How fast this typist is at the bigram is fixed by the seed, whereas the latency of each keystroke is random.
+	uint64_t hash = splitmix64(mSeed ^ ((uint64_t)(uint8_t)mPrev << 8 | (uint8_t)c));
+	mPrev = c;
+
+	uint64_t hash2 = splitmix64(hash);
+	double u1 = ((hash >> 11) + 1) * 0x1.0p-53;
+	double u2 = (hash2 >> 11) * 0x1.0p-53;
+	double z = sqrt(-2 * log(u1)) * cos(2 * numbers::pi * u2);
+
+	return {c, lognormal_distribution<>{mMu + mSettings.bigram_sigma * z, mSettings.sigma}(mRng)};
+}
+
+} // namespace ttt
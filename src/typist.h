@@ -0,0 +1,54 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+#pragma once
+
+#include "session.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+
+namespace ttt {
+
+struct TypistSettings {
+	double wpm = 60;
+	double error_rate = 0.02;      // Probability of mistyping a letter
+	double correction_rate = 0.9;  // Probability of noticing and correcting a mistake
+	double sigma = 0.35;           // Spread of the latency of each keystroke
+	double bigram_sigma = 0.3;     // Spread of how much faster or slower than average the typist is at each bigram
+};
+
+// A synthetic typist for load tests and benchmarks. The latency between two keystrokes is log-normally distributed around a
+// median that depends on the pair of keys, such that each typist is consistently fast at some bigrams and slow at others,
+// while the mean latency matches the configured speed. Mistyped letters are noticed a few keystrokes later, if at all, and
+// then corrected by backspacing.
+class SyntheticTypist {
+public:
+	struct Keystroke {
+		char c;
+		double delay; // Seconds since the previous keystroke
+	};
+
+	SyntheticTypist(const TypistSettings& settings, uint64_t seed);
+
+	// Returns the next keystroke that this typist makes in `session`, which must not be complete yet
+	Keystroke next(const TypingSession& session);
+
+private:
+	// Types `c` after a delay that depends on the previously typed character
+	Keystroke keystroke(char c);
+
+	TypistSettings mSettings;
+	uint64_t mSeed;
+	std::mt19937_64 mRng;
+	double mMu;
+
+	char mPrev = ' ';
+	std::string mQueue;          // Remaining bytes of a multi-byte character
+	size_t mErrorPos = SIZE_MAX; // Input size at which the first mistake that is going to be corrected was made
+	size_t mNoticeIn = 0;        // Keystrokes until that mistake is noticed
+};
+
+} // namespace ttt
@@ -0,0 +1,491 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+#include "vt.h"
+
+#include <algorithm>
+#include <format>
+
+using namespace std;
+
+namespace ttt {
+
+constexpr size_t TAB_STOP = 8;
+
+VtScreen::VtScreen(size_t cols, size_t rows, const WidthContext& widths) :
+	mCols{max(cols, (size_t)1)}, mRows{max(rows, (size_t)1)}, mWidths{widths}, mBottom{mRows - 1} {
+	mCells.assign(mCols * mRows, blank());
+	mOtherCells = mCells;
+}
+
+void VtScreen::feed(string_view bytes) {
+	for (char c : bytes) {
+		switch (mState) {
+			case State::Ground:
+				if (!mUtf8.empty() && !is_utf8_continuation(c)) {
+					// An incomplete character is dropped like terminals replace it
+					mUtf8.clear();
+				}
+
+				if ((unsigned char)c >= 0x80) {
+					// Stray continuation bytes are dropped, too
+					if (!mUtf8.empty() || !is_utf8_continuation(c)) {
+						mUtf8 += c;
+						if (mUtf8.size() >= (size_t)utf8_char_length(mUtf8[0])) {
+							print(decode_char(mUtf8, 0), mUtf8);
+							mUtf8.clear();
+						}
+					}
+				} else if (c == 27) {
+					mState = State::Escape;
+					mSequence.clear();
+				} else if ((unsigned char)c < 0x20) {
+					control(c);
+				} else if (c != 0x7F) {
+					print(c, {&c, 1});
+				}
+
+				break;
+			case State::Escape: escape(c); break;
+			case State::EscapeIntermediate: mState = State::Ground; break;
+			case State::Csi:
+				if (c >= 0x40 && c <= 0x7E) {
+					mState = State::Ground;
+					csi(c);
+				} else if (c == 27) {
+					mState = State::Escape;
+					mSequence.clear();
+				} else if ((unsigned char)c >= 0x20) {
+					mSequence += c;
+				} else {
+					control(c);
+				}
+
+				break;
+			case State::String:
+				// OSC, DCS, and friends end with BEL or ST (ESC \)
+				if (c == 7) {
+					mState = State::Ground;
+				} else if (c == 27) {
+					mState = State::StringEscape;
+				}
+
+				break;
+			case State::StringEscape: mState = c == '\\' ? State::Ground : State::String; break;
+		}
+	}
+}
+
+void VtScreen::print(char32_t c, string_view text) {
+	int width = mWidths.char_width(c);
+	if (width <= 0) {
+		if (mLastRow < mRows) {
+			at(mLastRow, mLastCol).text += text;
+		}
+
+		return;
+	}
+
+	width = min(width, (int)mCols);
+	if (mWrapPending || mCol + width > mCols) {
+		if (mAutowrap) {
+			mCol = 0;
+			line_feed();
+		} else {
+			mCol = mCols - width;
+		}
+	}
+
+	mWrapPending = false;
+
+	// Overwriting half of a wide character erases its other half
+	if (at(mRow, mCol).text.empty() && mCol > 0) {
+		at(mRow, mCol - 1) = blank();
+	}
+
+	size_t end = mCol + width;
+	if (end < mCols && at(mRow, end).text.empty()) {
+		at(mRow, end) = blank();
+	}
+
+	at(mRow, mCol) = {string{text}, mAttrs};
+	for (size_t i = mCol + 1; i < end; i++) {
+		at(mRow, i) = {"", mAttrs};
+	}
+
+	mLastRow = mRow;
+	mLastCol = mCol;
+
+	if (end >= mCols) {
+		mCol = mCols - 1;
+		mWrapPending = mAutowrap;
+	} else {
+		mCol = end;
+	}
+}
+
+void VtScreen::control(char c) {
+	switch (c) {
+		case '\b':
+			mWrapPending = false;
+			mCol = mCol > 0 ? mCol - 1 : 0;
+			break;
+		case '\t':
+			mWrapPending = false;
+			mCol = min((mCol / TAB_STOP + 1) * TAB_STOP, mCols - 1);
+			break;
+		case '\n':
+		case '\v':
+		case '\f': line_feed(); break;
+		case '\r':
+			mWrapPending = false;
+			mCol = 0;
+			break;
+		default: break;
+	}
+}
+
+void VtScreen::escape(char c) {
+	mState = State::Ground;
+	switch (c) {
+		case '[': mState = State::Csi; break;
+		case ']':
+		case 'P':
+		case 'X':
+		case '^':
+		case '_': mState = State::String; break;
+		case '(':
+		case ')':
+		case '*':
+		case '+':
+		case '#':
+		case '%':
+		case ' ': mState = State::EscapeIntermediate; break;
+		case '7': mSaved = {mRow, mCol, mAttrs}; break;
+		case '8':
+			move_to(mSaved.row, mSaved.col);
+			mAttrs = mSaved.attrs;
+			break;
+		case 'D': line_feed(); break;
+		case 'E':
+			mCol = 0;
+			line_feed();
+			break;
+		case 'M': reverse_line_feed(); break;
+		case 'c': *this = VtScreen{mCols, mRows, mWidths}; break;
+		default: break;
+	}
+}
+
+void VtScreen::csi(char final_byte) {
+	// A leading ?, >, <, or = marks private sequences; intermediates (0x20-0x2F) select variants that are not modeled.
+	char prefix = !mSequence.empty() && mSequence[0] >= '<' && mSequence[0] <= '?' ? mSequence[0] : 0;
+	if (any_of(mSequence.begin(), mSequence.end(), [](char c) { return c >= 0x20 && c <= 0x2F; })) {
+		return;
+	}
+
+	vector<int> params;
+	int value = -1;
+	for (char c : string_view{mSequence}.substr(prefix ? 1 : 0)) {
+		if (c >= '0' && c <= '9') {
+			value = min(max(value, 0) * 10 + (c - '0'), 65535);
+		} else {
+			params.push_back(value);
+			value = -1;
+		}
+	}
+
+	params.push_back(value);
+
+	// Missing parameters and, for most sequences, zeros take the default
+	auto param = [&](size_t i, int def) { return i < params.size() && params[i] > 0 ? params[i] : def; };
+	size_t n = param(0, 1);
+
+	if (prefix == '?') {
+		if (final_byte == 'h' || final_byte == 'l') {
+			bool enable = final_byte == 'h';
+			for (int mode : params) {
+				if (mode == 7) {
+					mAutowrap = enable;
+				} else if (mode == 1049 || mode == 1047 || mode == 47) {
+					set_alternate_screen(enable);
+				}
+			}
+		}
+
+		return;
+	} else if (prefix) {
+		return;
+	}
+
+	switch (final_byte) {
+		case 'A': move_to(mRow >= mTop ? max(mRow - min(n, mRow), mTop) : mRow - min(n, mRow), mCol); break;
+		case 'B': move_to(mRow <= mBottom ? min(mRow + n, mBottom) : mRow + n, mCol); break;
+		case 'C': move_to(mRow, mCol + n); break;
+		case 'D': move_to(mRow, mCol - min(n, mCol)); break;
+		case 'E': move_to(mRow <= mBottom ? min(mRow + n, mBottom) : mRow + n, 0); break;
+		case 'F': move_to(mRow >= mTop ? max(mRow - min(n, mRow), mTop) : mRow - min(n, mRow), 0); break;
+		case 'G':
+		case '`': move_to(mRow, n - 1); break;
+		case 'd': move_to(n - 1, mCol); break;
+		case 'H':
+		case 'f': move_to(n - 1, param(1, 1) - 1); break;
+		case 'J': {
+			int mode = max(params[0], 0);
+			if (mode == 0) {
+				erase(mRow, mCol, mCols);
+				for (size_t row = mRow + 1; row < mRows; row++) {
+					erase(row, 0, mCols);
+				}
+			} else if (mode == 1) {
+				for (size_t row = 0; row < mRow; row++) {
+					erase(row, 0, mCols);
+				}
+
+				erase(mRow, 0, mCol + 1);
+			} else if (mode == 2 || mode == 3) {
+				for (size_t row = 0; row < mRows; row++) {
+					erase(row, 0, mCols);
+				}
+			}
+		} break;
+		case 'K': {
+			int mode = max(params[0], 0);
+			if (mode == 0) {
+				erase(mRow, mCol, mCols);
+			} else if (mode == 1) {
+				erase(mRow, 0, mCol + 1);
+			} else if (mode == 2) {
+				erase(mRow, 0, mCols);
+			}
+		} break;
+		case 'X': erase(mRow, mCol, min(mCol + n, mCols)); break;
+		case 'P': {
+			n = min(n, mCols - mCol);
+			auto row = mCells.begin() + mRow * mCols;
+			rotate(row + mCol, row + mCol + n, row + mCols);
+			erase(mRow, mCols - n, mCols);
+		} break;
+		case '@': {
+			n = min(n, mCols - mCol);
+			auto row = mCells.begin() + mRow * mCols;
+			rotate(row + mCol, row + mCols - n, row + mCols);
+			erase(mRow, mCol, mCol + n);
+		} break;
+		case 'L':
+			if (mRow >= mTop && mRow <= mBottom) {
+				scroll_down(mRow, mBottom, n);
+			}
+
+			break;
+		case 'M':
+			if (mRow >= mTop && mRow <= mBottom) {
+				scroll_up(mRow, mBottom, n);
+			}
+
+			break;
+		case 'S': scroll_up(mTop, mBottom, n); break;
+		case 'T': scroll_down(mTop, mBottom, n); break;
+		case 'r': {
+			size_t top = param(0, 1) - 1, bottom = min((size_t)param(1, (int)mRows), mRows) - 1;
+			if (top < bottom) {
+				mTop = top;
+				mBottom = bottom;
+				move_to(0, 0);
+			}
+		} break;
+		case 's': mSaved = {mRow, mCol, mAttrs}; break;
+		case 'u':
+			move_to(mSaved.row, mSaved.col);
+			mAttrs = mSaved.attrs;
+			break;
+		case 'm': sgr(params); break;
+		default: break;
+	}
+}
+
+void VtScreen::sgr(const vector<int>& params) {
+	// Extended colors are either 5;INDEX or 2;R;G;B
+	auto color = [&](size_t& i) -> uint32_t {
+		if (i + 2 < params.size() && params[i + 1] == 5) {
+			i += 2;
+			return (uint32_t)max(params[i], 0) & 0xFF;
+		} else if (i + 4 < params.size() && params[i + 1] == 2) {
+			i += 4;
+			auto channel = [](int v) { return (uint32_t)clamp(v, 0, 255); };
+			return VtAttributes::TRUE_COLOR | channel(params[i - 2]) << 16 | channel(params[i - 1]) << 8 | channel(params[i]);
+		}
+
+		i = params.size();
+		return VtAttributes::DEFAULT_COLOR;
+	};
+
+	for (size_t i = 0; i < params.size(); i++) {
+		int p = max(params[i], 0);
+		switch (p) {
+			case 0: mAttrs = {}; break;
+			case 1: mAttrs.flags |= VtAttributes::Bold; break;
+			case 2: mAttrs.flags |= VtAttributes::Dim; break;
+			case 3: mAttrs.flags |= VtAttributes::Italic; break;
+			case 4: mAttrs.flags |= VtAttributes::Underline; break;
+			case 5:
+			case 6: mAttrs.flags |= VtAttributes::Blink; break;
+			case 7: mAttrs.flags |= VtAttributes::Inverse; break;
+			case 8: mAttrs.flags |= VtAttributes::Hidden; break;
+			case 9: mAttrs.flags |= VtAttributes::Strikethrough; break;
+			case 22: mAttrs.flags &= ~(VtAttributes::Bold | VtAttributes::Dim); break;
+			case 23: mAttrs.flags &= ~VtAttributes::Italic; break;
+			case 24: mAttrs.flags &= ~VtAttributes::Underline; break;
+			case 25: mAttrs.flags &= ~VtAttributes::Blink; break;
+			case 27: mAttrs.flags &= ~VtAttributes::Inverse; break;
+			case 28: mAttrs.flags &= ~VtAttributes::Hidden; break;
+			case 29: mAttrs.flags &= ~VtAttributes::Strikethrough; break;
+			case 38: mAttrs.fg = color(i); break;
+			case 39: mAttrs.fg = VtAttributes::DEFAULT_COLOR; break;
+			case 48: mAttrs.bg = color(i); break;
+			case 49: mAttrs.bg = VtAttributes::DEFAULT_COLOR; break;
+			default:
+				if (p >= 30 && p <= 37) {
+					mAttrs.fg = p - 30;
+				} else if (p >= 40 && p <= 47) {
+					mAttrs.bg = p - 40;
+				} else if (p >= 90 && p <= 97) {
+					mAttrs.fg = p - 90 + 8;
+				} else if (p >= 100 && p <= 107) {
+					mAttrs.bg = p - 100 + 8;
+				}
+
+				break;
+		}
+	}
+}
+
+void VtScreen::line_feed() {
+	mWrapPending = false;
+	if (mRow == mBottom) {
+		scroll_up(mTop, mBottom, 1);
+	} else if (mRow + 1 < mRows) {
+		++mRow;
+	}
+}
+
+void VtScreen::reverse_line_feed() {
+	mWrapPending = false;
+	if (mRow == mTop) {
+		scroll_down(mTop, mBottom, 1);
+	} else if (mRow > 0) {
+		--mRow;
+	}
+}
+
+void VtScreen::scroll_up(size_t top, size_t bottom, size_t n) {
+	n = min(n, bottom + 1 - top);
+	auto begin = mCells.begin() + top * mCols, end = mCells.begin() + (bottom + 1) * mCols;
+	rotate(begin, begin + n * mCols, end);
+	for (size_t row = bottom + 1 - n; row <= bottom; row++) {
+		erase(row, 0, mCols);
+	}
+
+	mLastRow = SIZE_MAX;
+}
+
+void VtScreen::scroll_down(size_t top, size_t bottom, size_t n) {
+	n = min(n, bottom + 1 - top);
+	auto begin = mCells.begin() + top * mCols, end = mCells.begin() + (bottom + 1) * mCols;
+	rotate(begin, end - n * mCols, end);
+	for (size_t row = top; row < top + n; row++) {
+		erase(row, 0, mCols);
+	}
+
+	mLastRow = SIZE_MAX;
+}
+
+void VtScreen::erase(size_t row, size_t begin, size_t end) {
+	// Erasing half of a wide character erases all of it
+	while (begin > 0 && begin < mCols && at(row, begin).text.empty()) {
+		--begin;
+	}
+
+	while (end < mCols && at(row, end).text.empty()) {
+		++end;
+	}
+
+	for (size_t col = begin; col < end; col++) {
+		at(row, col) = blank();
+	}
+}
+
+void VtScreen::move_to(size_t row, size_t col) {
+	mWrapPending = false;
+	mRow = min(row, mRows - 1);
+	mCol = min(col, mCols - 1);
+}
+
+void VtScreen::set_alternate_screen(bool enabled) {
+	if (enabled == mAlternate) {
+		return;
+	}
+
+	if (enabled) {
+		mSavedBeforeAlternate = {mRow, mCol, mAttrs};
+	}
+
+	swap(mCells, mOtherCells);
+	mAlternate = enabled;
+	if (enabled) {
+		mCells.assign(mCols * mRows, blank());
+	} else {
+		move_to(mSavedBeforeAlternate.row, mSavedBeforeAlternate.col);
+		mAttrs = mSavedBeforeAlternate.attrs;
+	}
+}
+
+VtCell VtScreen::blank() const {
+	// Erased cells take on the current background color, like in xterm
+	VtCell result;
+	result.attrs.bg = mAttrs.bg;
+	return result;
+}
+
+string VtScreen::row_text(size_t row) const {
+	string result;
+	for (size_t col = 0; col < mCols; col++) {
+		result += cell(row, col).text;
+	}
+
+	return result;
+}
+
+string VtScreen::first_difference(const VtScreen& other) const {
+	if (mCols != other.mCols || mRows != other.mRows) {
+		return format("size {}x{} vs {}x{}", mCols, mRows, other.mCols, other.mRows);
+	}
+
+	auto describe = [](const VtCell& cell) {
+		return format("\"{}\" (fg {:x}, bg {:x}, flags {:x})", cell.text, cell.attrs.fg, cell.attrs.bg, cell.attrs.flags);
+	};
+
+	for (size_t row = 0; row < mRows; row++) {
+		for (size_t col = 0; col < mCols; col++) {
+			if (cell(row, col) != other.cell(row, col)) {
+				return format(
+					"row {}, column {}: {} vs {} in \"{}\" vs \"{}\"",
+					row,
+					col,
+					describe(cell(row, col)),
+					describe(other.cell(row, col)),
+					row_text(row),
+					other.row_text(row)
+				);
+			}
+		}
+	}
+
+	if (mRow != other.mRow || mCol != other.mCol) {
+		return format("cursor at row {}, column {} vs row {}, column {}", mRow, mCol, other.mRow, other.mCol);
+	}
+
+	return {};
+}
+
+} // namespace ttt
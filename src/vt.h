@@ -0,0 +1,118 @@
+// This file was developed by Thomas Müller <contact@tom94.net>.
+// It is published under the GPLv3 License; see the LICENSE file.
+
+#pragma once
+
+#include "text.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ttt {
+
+// Graphic rendition of a cell as set by SGR. Colors are DEFAULT_COLOR, an index into the 256-color palette, or a 24-bit color
+// tagged with TRUE_COLOR.
+struct VtAttributes {
+	static constexpr uint32_t DEFAULT_COLOR = 0xFFFFFFFF;
+	static constexpr uint32_t TRUE_COLOR = 0x1000000;
+
+	enum Flags : uint16_t {
+		Bold = 1 << 0,
+		Dim = 1 << 1,
+		Italic = 1 << 2,
+		Underline = 1 << 3,
+		Blink = 1 << 4,
+		Inverse = 1 << 5,
+		Hidden = 1 << 6,
+		Strikethrough = 1 << 7,
+	};
+
+	uint32_t fg = DEFAULT_COLOR;
+	uint32_t bg = DEFAULT_COLOR;
+	uint16_t flags = 0;
+
+	bool operator==(const VtAttributes&) const = default;
+};
+
+struct VtCell {
+	std::string text = " "; // The character along with any zero-width characters that follow it; empty right of a wide character
+	VtAttributes attrs;
+
+	bool operator==(const VtCell&) const = default;
+};
+
+// Model of the screen of a VT100/xterm-style terminal, covering what full-screen programs like ttt rely on: UTF-8 text with
+// wide characters and autowrap, cursor movement, SGR attributes, erasing, scroll regions, saving and restoring the cursor, and
+// the alternate screen. Queries and unknown sequences are consumed without effect. Characters are as wide as `widths` says,
+// which should be the same as what the program that writes to the terminal assumes.
+class VtScreen {
+public:
+	VtScreen(size_t cols, size_t rows, const WidthContext& widths = {});
+
+	// Applies bytes written to the terminal. Sequences may be split across calls.
+	void feed(std::string_view bytes);
+
+	size_t cols() const { return mCols; }
+	size_t rows() const { return mRows; }
+	size_t cursor_row() const { return mRow; }
+	size_t cursor_col() const { return mCol; }
+
+	const VtCell& cell(size_t row, size_t col) const { return mCells[row * mCols + col]; }
+
+	// The characters of a row without attributes, including trailing blanks
+	std::string row_text(size_t row) const;
+
+	// Describes the first cell (or cursor position) in which `other` shows something else, or returns an empty string if both
+	// look the same.
+	std::string first_difference(const VtScreen& other) const;
+
+private:
+	enum class State { Ground, Escape, EscapeIntermediate, Csi, String, StringEscape };
+
+	struct SavedCursor {
+		size_t row = 0, col = 0;
+		VtAttributes attrs;
+	};
+
+	void print(char32_t c, std::string_view text);
+	void control(char c);
+	void escape(char c);
+	void csi(char final_byte);
+	void sgr(const std::vector<int>& params);
+
+	void line_feed();
+	void reverse_line_feed();
+	void scroll_up(size_t top, size_t bottom, size_t n);
+	void scroll_down(size_t top, size_t bottom, size_t n);
+	void erase(size_t row, size_t begin, size_t end);
+	void move_to(size_t row, size_t col);
+	void set_alternate_screen(bool enabled);
+
+	VtCell blank() const;
+	VtCell& at(size_t row, size_t col) { return mCells[row * mCols + col]; }
+
+	size_t mCols, mRows;
+	WidthContext mWidths;
+
+	std::vector<VtCell> mCells, mOtherCells;
+	bool mAlternate = false;
+
+	size_t mRow = 0, mCol = 0;
+	bool mWrapPending = false; // Whether the cursor is past the last column, such that the next character wraps
+	bool mAutowrap = true;
+	size_t mTop = 0, mBottom; // Scroll region, inclusive
+	VtAttributes mAttrs;
+	SavedCursor mSaved, mSavedBeforeAlternate;
+
+	// Where the last character went, such that zero-width characters can be appended to it
+	size_t mLastRow = SIZE_MAX, mLastCol = 0;
+
+	State mState = State::Ground;
+	std::string mSequence; // Parameters and intermediates of the escape sequence being parsed
+	std::string mUtf8;     // Bytes of an incomplete UTF-8 character
+};
+
+} // namespace ttt